@@ -0,0 +1,1003 @@
+// Benchmarks radix_tree against std::set, std::unordered_set and a
+// naive trie on several key distributions, reporting the time and the
+// number of allocations per operation and the memory held per key.
+//
+// usage: rt-bench [--keys N] [--repeat R] [--threads T] [--batch-keys B]
+//
+// Every key set is generated from a fixed seed. Each benchmark runs R
+// times on a fresh container and the fastest run is reported, which
+// keeps the numbers stable enough to compare between builds. The time
+// to destroy a container holding all the topic keys is reported next,
+// then batched lookups in a tree of B random keys, N unless given,
+// followed by lookups of 64-bit integers and of IPv4 routes, by
+// lookups and inserts in trees of each fan-out, and by storms of
+// inserts and erasures below nodes with hundreds of children.
+// With --threads, the concurrent trees are also run with 1, 2, 4, ... T
+// threads.
+
+#include "concurrent_radix_tree.hpp"
+#include "fixed_key_tree.hpp"
+#include "key_sets.hpp"
+#include "naive_trie.hpp"
+#include "node_allocator.hpp"
+#include "olc_radix_tree.hpp"
+#include "radix_tree.hpp"
+#include "route_table.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+
+// Allocations made through operator new and through the node allocator
+// given to the trees.
+std::atomic<std::size_t> allocations{0};
+std::atomic<std::size_t> live_bytes{0};
+
+// Room for the size of each block in front of it, keeping the block
+// aligned for any type.
+constexpr std::size_t block_header = alignof(std::max_align_t);
+
+void* counted_allocate(std::size_t size)
+{
+    auto* block = static_cast<unsigned char*>(std::malloc(size
+                                                          + block_header));
+    if (!block)
+        return nullptr;
+    std::memcpy(block, &size, sizeof(size));
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    live_bytes.fetch_add(size, std::memory_order_relaxed);
+    return block + block_header;
+}
+
+void counted_deallocate(void* data)
+{
+    if (!data)
+        return;
+    unsigned char* block = static_cast<unsigned char*>(data) - block_header;
+    std::size_t size;
+    std::memcpy(&size, block, sizeof(size));
+    live_bytes.fetch_sub(size, std::memory_order_relaxed);
+    std::free(block);
+}
+
+// Counts the nodes of the trees, which don't go through operator new.
+class counting_allocator : public node_allocator
+{
+public:
+    unsigned char* allocate(std::size_t size) override
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        live_bytes.fetch_add(size, std::memory_order_relaxed);
+        return allocator_.allocate(size);
+    }
+
+    void deallocate(unsigned char* data, std::size_t size) override
+    {
+        live_bytes.fetch_sub(size, std::memory_order_relaxed);
+        allocator_.deallocate(data, size);
+    }
+
+    unsigned char* reallocate(unsigned char* data,
+                              std::size_t old_size,
+                              std::size_t new_size) override
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        live_bytes.fetch_add(new_size, std::memory_order_relaxed);
+        live_bytes.fetch_sub(old_size, std::memory_order_relaxed);
+        return allocator_.reallocate(data, old_size, new_size);
+    }
+
+private:
+    malloc_allocator allocator_;
+};
+
+counting_allocator& tree_allocator()
+{
+    static counting_allocator allocator;
+    return allocator;
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+    void* data = counted_allocate(size);
+    if (!data)
+        throw std::bad_alloc();
+    return data;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept
+{
+    return counted_allocate(size);
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept
+{
+    return counted_allocate(size);
+}
+
+void operator delete(void* data) noexcept
+{
+    counted_deallocate(data);
+}
+
+void operator delete[](void* data) noexcept
+{
+    counted_deallocate(data);
+}
+
+void operator delete(void* data, std::size_t) noexcept
+{
+    counted_deallocate(data);
+}
+
+void operator delete[](void* data, std::size_t) noexcept
+{
+    counted_deallocate(data);
+}
+
+namespace
+{
+
+const unsigned char* bytes(std::string const& key)
+{
+    return reinterpret_cast<const unsigned char*>(key.data());
+}
+
+void count_key(unsigned char* data, std::size_t size, void* arg)
+{
+    static_cast<void>(data);
+    *static_cast<std::size_t*>(arg) += size;
+}
+
+// The containers benchmarked, behind a common interface. apply()
+// visits every key and returns a value depending on all of them so
+// the visit can't be optimized away.
+
+class radix_tree_container
+{
+public:
+    static const char* name() { return "radix_tree"; }
+
+    radix_tree_container()
+        : tree_(tree_allocator())
+    {}
+
+    void insert(std::string const& key)
+    {
+        tree_.insert(bytes(key), key.size());
+    }
+
+    void erase(std::string const& key)
+    {
+        tree_.erase(bytes(key), key.size());
+    }
+
+    bool contains(std::string const& key) const
+    {
+        return tree_.contains(bytes(key), key.size());
+    }
+
+    std::size_t apply()
+    {
+        std::size_t total = 0;
+        tree_.apply(count_key, &total);
+        return total;
+    }
+
+private:
+    radix_tree tree_;
+};
+
+// A tree whose nodes come from a slab allocator, which frees them all
+// at once when the tree is destroyed.
+class slab_radix_tree_container
+{
+public:
+    static const char* name() { return "radix_tree + slab"; }
+
+    void insert(std::string const& key)
+    {
+        tree_.insert(bytes(key), key.size());
+    }
+
+private:
+    slab_allocator allocator_;
+    radix_tree tree_{allocator_};
+};
+
+class set_container
+{
+public:
+    static const char* name() { return "std::set"; }
+
+    void insert(std::string const& key) { set_.insert(key); }
+    void erase(std::string const& key) { set_.erase(key); }
+    bool contains(std::string const& key) const { return set_.count(key); }
+
+    std::size_t apply()
+    {
+        std::size_t total = 0;
+        for (auto const& key : set_)
+            total += key.size();
+        return total;
+    }
+
+private:
+    std::set<std::string> set_;
+};
+
+class unordered_set_container
+{
+public:
+    static const char* name() { return "std::unordered_set"; }
+
+    void insert(std::string const& key) { set_.insert(key); }
+    void erase(std::string const& key) { set_.erase(key); }
+    bool contains(std::string const& key) const { return set_.count(key); }
+
+    std::size_t apply()
+    {
+        std::size_t total = 0;
+        for (auto const& key : set_)
+            total += key.size();
+        return total;
+    }
+
+private:
+    std::unordered_set<std::string> set_;
+};
+
+class naive_trie_container
+{
+public:
+    static const char* name() { return "naive trie"; }
+
+    void insert(std::string const& key)
+    {
+        trie_.insert(bytes(key), key.size());
+    }
+
+    void erase(std::string const& key)
+    {
+        trie_.erase(bytes(key), key.size());
+    }
+
+    bool contains(std::string const& key) const
+    {
+        return trie_.contains(bytes(key), key.size());
+    }
+
+    std::size_t apply()
+    {
+        std::size_t total = 0;
+        trie_.apply(count_key, &total);
+        return total;
+    }
+
+private:
+    naive_trie trie_;
+};
+
+double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+struct measurement
+{
+    double insert_ns = 0;
+    double erase_ns = 0;
+    double hit_ns = 0;
+    double miss_ns = 0;
+    double apply_ns = 0; // Per key.
+    double insert_allocations = 0;
+    double erase_allocations = 0;
+    double bytes_per_key = 0;
+};
+
+// Keeps the fastest time seen so far.
+void keep_fastest(double& best, double ns, bool first)
+{
+    if (first || ns < best)
+        best = ns;
+}
+
+// Dummy results of the lookups, so they aren't optimized away.
+volatile std::size_t sink;
+
+template <typename Container>
+measurement run(std::vector<std::string> const& keys,
+                std::vector<std::string> const& lookups,
+                std::vector<std::string> const& misses,
+                std::size_t repeat)
+{
+    measurement m;
+    double n = static_cast<double>(keys.size());
+
+    for (std::size_t r = 0; r < repeat; ++r) {
+        bool first = r == 0;
+        std::size_t bytes_before = live_bytes.load();
+        Container* container = new Container;
+
+        std::size_t allocations_before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        for (auto const& key : keys)
+            container->insert(key);
+        keep_fastest(m.insert_ns, elapsed_ns(start) / n, first);
+        m.insert_allocations =
+            static_cast<double>(allocations.load() - allocations_before) / n;
+        m.bytes_per_key =
+            static_cast<double>(live_bytes.load() - bytes_before) / n;
+
+        std::size_t found = 0;
+        start = std::chrono::steady_clock::now();
+        for (auto const& key : lookups)
+            found += container->contains(key);
+        keep_fastest(m.hit_ns, elapsed_ns(start) / n, first);
+
+        start = std::chrono::steady_clock::now();
+        for (auto const& key : misses)
+            found += container->contains(key);
+        keep_fastest(m.miss_ns, elapsed_ns(start) / n, first);
+
+        start = std::chrono::steady_clock::now();
+        found += container->apply();
+        keep_fastest(m.apply_ns, elapsed_ns(start) / n, first);
+
+        allocations_before = allocations.load();
+        start = std::chrono::steady_clock::now();
+        for (auto const& key : lookups)
+            container->erase(key);
+        keep_fastest(m.erase_ns, elapsed_ns(start) / n, first);
+        m.erase_allocations =
+            static_cast<double>(allocations.load() - allocations_before) / n;
+
+        delete container;
+        sink = found;
+    }
+    return m;
+}
+
+void print_measurement(const char* name, measurement const& m)
+{
+    std::printf("  %-20s %8.1f %8.1f %8.1f %8.1f %8.1f %8.2f %8.2f %9.1f\n",
+                name, m.insert_ns, m.erase_ns, m.hit_ns, m.miss_ns,
+                m.apply_ns, m.insert_allocations, m.erase_allocations,
+                m.bytes_per_key);
+}
+
+void run_key_set(const char* name,
+                 std::vector<std::string> const& keys,
+                 std::size_t repeat)
+{
+    // Lookups and erasures visit the keys in a different order than
+    // they were inserted in. Misses share all of a key but its end.
+    std::vector<std::string> lookups = keys;
+    std::shuffle(lookups.begin(), lookups.end(), std::minstd_rand(4));
+    std::vector<std::string> misses;
+    misses.reserve(lookups.size());
+    for (auto const& key : lookups)
+        misses.push_back(key + '\xff');
+
+    std::size_t total = 0;
+    for (auto const& key : keys)
+        total += key.size();
+    std::printf("%s: %zu keys of %.1f bytes on average\n", name, keys.size(),
+                static_cast<double>(total)
+                    / static_cast<double>(keys.size()));
+    std::printf("  %-20s %8s %8s %8s %8s %8s %8s %8s %9s\n", "ns/op",
+                "insert", "erase", "hit", "miss", "apply", "alloc/in",
+                "alloc/er", "bytes/key");
+
+    print_measurement(radix_tree_container::name(),
+                      run<radix_tree_container>(keys, lookups, misses,
+                                                repeat));
+    print_measurement(set_container::name(),
+                      run<set_container>(keys, lookups, misses, repeat));
+    print_measurement(unordered_set_container::name(),
+                      run<unordered_set_container>(keys, lookups, misses,
+                                                   repeat));
+    print_measurement(naive_trie_container::name(),
+                      run<naive_trie_container>(keys, lookups, misses,
+                                                repeat));
+    std::printf("\n");
+}
+
+template <typename Container>
+double run_teardown(std::vector<std::string> const& keys, std::size_t repeat)
+{
+    double best = 0;
+    for (std::size_t r = 0; r < repeat; ++r) {
+        Container* container = new Container;
+        for (auto const& key : keys)
+            container->insert(key);
+        auto start = std::chrono::steady_clock::now();
+        delete container;
+        keep_fastest(best,
+                     elapsed_ns(start) / static_cast<double>(keys.size()),
+                     r == 0);
+    }
+    return best;
+}
+
+void print_teardown(const char* name, double ns)
+{
+    std::printf("  %-20s %8.1f\n", name, ns);
+}
+
+void run_teardowns(std::vector<std::string> const& keys, std::size_t repeat)
+{
+    std::printf("teardown: ns/key to destroy a container holding %zu "
+                "topic keys\n", keys.size());
+    print_teardown(radix_tree_container::name(),
+                   run_teardown<radix_tree_container>(keys, repeat));
+    print_teardown(slab_radix_tree_container::name(),
+                   run_teardown<slab_radix_tree_container>(keys, repeat));
+    print_teardown(set_container::name(),
+                   run_teardown<set_container>(keys, repeat));
+    print_teardown(unordered_set_container::name(),
+                   run_teardown<unordered_set_container>(keys, repeat));
+    std::printf("\n");
+}
+
+// Integer keys, which the tree takes by value through fixed_key_tree.
+// The sets of strings above are no match for those, so the tree is
+// compared with sets of integers here.
+
+class integer_tree : public fixed_key_tree<std::uint64_t>
+{
+public:
+    integer_tree()
+        : fixed_key_tree(tree_allocator())
+    {}
+};
+
+bool set_contains(integer_tree const& tree, std::uint64_t key)
+{
+    return tree.contains(key);
+}
+
+template <typename Set>
+bool set_contains(Set const& set, std::uint64_t key)
+{
+    return set.count(key) > 0;
+}
+
+template <typename Set>
+void print_integer_lookups(const char* name,
+                           std::vector<std::uint64_t> const& keys,
+                           std::vector<std::uint64_t> const& misses,
+                           std::size_t repeat)
+{
+    double n = static_cast<double>(keys.size());
+    double insert_ns = 0;
+    double hit_ns = 0;
+    double miss_ns = 0;
+    double bytes_per_key = 0;
+    for (std::size_t r = 0; r < repeat; ++r) {
+        bool first = r == 0;
+        std::size_t bytes_before = live_bytes.load();
+        Set* set = new Set;
+
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint64_t key : keys)
+            set->insert(key);
+        keep_fastest(insert_ns, elapsed_ns(start) / n, first);
+        bytes_per_key =
+            static_cast<double>(live_bytes.load() - bytes_before) / n;
+
+        std::size_t found = 0;
+        start = std::chrono::steady_clock::now();
+        for (std::uint64_t key : keys)
+            found += set_contains(*set, key);
+        keep_fastest(hit_ns, elapsed_ns(start) / n, first);
+
+        start = std::chrono::steady_clock::now();
+        for (std::uint64_t key : misses)
+            found += set_contains(*set, key);
+        keep_fastest(miss_ns, elapsed_ns(start) / n, first);
+
+        delete set;
+        sink = found;
+    }
+    std::printf("  %-20s %8.1f %8.1f %8.1f %9.1f\n",
+                name, insert_ns, hit_ns, miss_ns, bytes_per_key);
+}
+
+// Lookups of the keys in batches, and a scan over all of them.
+void print_tree_batches(std::vector<std::uint64_t> const& keys,
+                        std::size_t repeat)
+{
+    double n = static_cast<double>(keys.size());
+    integer_tree tree;
+    for (std::uint64_t key : keys)
+        tree.insert(key);
+
+    std::unique_ptr<bool[]> results(new bool[keys.size()]);
+    double batch_ns = 0;
+    double scan_ns = 0;
+    for (std::size_t r = 0; r < repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        tree.contains_batch(keys.data(), keys.size(), results.get());
+        keep_fastest(batch_ns, elapsed_ns(start) / n, r == 0);
+
+        std::size_t total = 0;
+        start = std::chrono::steady_clock::now();
+        tree.scan(0,
+                  UINT64_MAX,
+                  [](std::uint64_t const& key, void* arg) {
+                      *static_cast<std::size_t*>(arg) += key;
+                  },
+                  &total);
+        keep_fastest(scan_ns, elapsed_ns(start) / n, r == 0);
+        sink = total + results[0];
+    }
+    std::printf("  %-20s %8s %8.1f\n", "  contains_batch", "", batch_ns);
+    std::printf("  %-20s %8s %8.1f\n", "  scan", "", scan_ns);
+}
+
+void run_integer_keys(const char* name,
+                      std::vector<std::uint64_t> keys,
+                      std::size_t repeat)
+{
+    // Misses are drawn from the whole key space, hits are looked up in
+    // a different order than they were inserted in.
+    std::minstd_rand rng(5);
+    std::vector<std::uint64_t> misses;
+    std::unordered_set<std::uint64_t> present(keys.begin(), keys.end());
+    while (misses.size() < keys.size()) {
+        std::uint64_t key = std::uint64_t(rng()) << 32 ^ rng();
+        if (!present.count(key))
+            misses.push_back(key);
+    }
+    std::shuffle(keys.begin(), keys.end(), rng);
+
+    std::printf("%s: %zu 64-bit keys\n", name, keys.size());
+    std::printf("  %-20s %8s %8s %8s %9s\n", "ns/op", "insert", "hit",
+                "miss", "bytes/key");
+    print_integer_lookups<integer_tree>(
+        "fixed_key_tree", keys, misses, repeat);
+    print_tree_batches(keys, repeat);
+    print_integer_lookups<std::set<std::uint64_t>>(
+        "std::set", keys, misses, repeat);
+    print_integer_lookups<std::unordered_set<std::uint64_t>>(
+        "std::unordered_set", keys, misses, repeat);
+    std::printf("\n");
+}
+
+// Longest prefix matches of random addresses against a table of count
+// IPv4 routes, most of them /24 like in Internet routing tables.
+void run_routes(std::size_t count, std::size_t repeat)
+{
+    std::minstd_rand rng(6);
+    route_table<std::uint32_t, std::uint32_t> table(tree_allocator());
+    for (std::size_t i = 0; i < count; ++i) {
+        unsigned share = rng() % 100;
+        auto length = static_cast<unsigned>(
+            share < 60 ? 24
+            : share < 75 ? 22 + rng() % 2
+            : share < 90 ? 16 + rng() % 6
+                         : 8 + rng() % 25);
+        table.insert_or_assign(static_cast<std::uint32_t>(rng()),
+                               length,
+                               static_cast<std::uint32_t>(i));
+    }
+    std::vector<std::uint32_t> addresses;
+    for (std::size_t i = 0; i < count; ++i)
+        addresses.push_back(static_cast<std::uint32_t>(rng()));
+
+    double best = 0;
+    for (std::size_t r = 0; r < repeat; ++r) {
+        std::size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint32_t address : addresses)
+            found += table.longest_match(address) != nullptr;
+        keep_fastest(best,
+                     elapsed_ns(start) / static_cast<double>(count),
+                     r == 0);
+        sink = found;
+    }
+    std::printf("routes: %zu IPv4 prefixes, %.1f ns per longest match\n\n",
+                table.size(), best);
+}
+
+// Batched lookups against a loop of single ones, on count random keys
+// of 16 to 31 bytes looked up in random order. The memory held by the
+// tree is printed along with the times, so that it can be checked
+// against the size of the last-level cache: the batches only pay off
+// once the nodes don't fit in it.
+void run_batches(std::size_t count, std::size_t repeat)
+{
+    std::vector<std::string> keys = random_byte_keys(count);
+    radix_tree tree(tree_allocator());
+    for (auto const& key : keys)
+        tree.insert(bytes(key), key.size());
+
+    std::shuffle(keys.begin(), keys.end(), std::minstd_rand(12));
+    std::vector<const unsigned char*> data;
+    std::vector<std::size_t> sizes;
+    for (auto const& key : keys) {
+        data.push_back(bytes(key));
+        sizes.push_back(key.size());
+    }
+
+    double n = static_cast<double>(keys.size());
+    std::unique_ptr<bool[]> results(new bool[keys.size()]);
+    double contains_ns = 0;
+    double contains_batch_ns = 0;
+    double prefix_ns = 0;
+    double prefix_batch_ns = 0;
+    for (std::size_t r = 0; r < repeat; ++r) {
+        bool first = r == 0;
+        std::size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t k = 0; k < keys.size(); ++k)
+            found += tree.contains(data[k], sizes[k]);
+        keep_fastest(contains_ns, elapsed_ns(start) / n, first);
+
+        start = std::chrono::steady_clock::now();
+        tree.contains_batch(data.data(), sizes.data(), keys.size(),
+                            results.get());
+        keep_fastest(contains_batch_ns, elapsed_ns(start) / n, first);
+        found += results[0];
+
+        start = std::chrono::steady_clock::now();
+        for (std::size_t k = 0; k < keys.size(); ++k)
+            found += tree.any_prefix_of(data[k], sizes[k]);
+        keep_fastest(prefix_ns, elapsed_ns(start) / n, first);
+
+        start = std::chrono::steady_clock::now();
+        tree.any_prefix_of_batch(data.data(), sizes.data(), keys.size(),
+                                 results.get());
+        keep_fastest(prefix_batch_ns, elapsed_ns(start) / n, first);
+        sink = found + results[0];
+    }
+    std::printf("batches: %zu random keys of 16 to 31 bytes, tree of "
+                "%.1f MiB\n",
+                keys.size(),
+                static_cast<double>(tree.memory_usage()) / (1 << 20));
+    std::printf("  %-20s %8s %8s\n", "ns/op", "single", "batch");
+    std::printf("  %-20s %8.1f %8.1f\n", "contains",
+                contains_ns, contains_batch_ns);
+    std::printf("  %-20s %8.1f %8.1f\n\n", "any_prefix_of",
+                prefix_ns, prefix_batch_ns);
+}
+
+// Inserts and lookups in a tree where every node has the same number of
+// edges, which shows how the cost of searching a node grows with its
+// fan-out. The keys are all the strings of depth digits in base fanout,
+// at most count of them, with each digit spread over the byte range.
+// They're inserted in random order, so new edges land anywhere in their
+// nodes. The last column is the lookup time divided by the depth.
+void run_fanout(std::size_t fanout, std::size_t count, std::size_t repeat)
+{
+    std::size_t depth = 1;
+    std::size_t total = fanout;
+    while (total * fanout <= count) {
+        total *= fanout;
+        ++depth;
+    }
+
+    std::vector<unsigned char> bytes(total * depth);
+    std::vector<const unsigned char*> keys(total);
+    for (std::size_t k = 0; k < total; ++k) {
+        unsigned char* key = bytes.data() + k * depth;
+        std::size_t rest = k;
+        for (std::size_t d = depth; d-- > 0;) {
+            std::size_t digit = rest % fanout;
+            key[d] = static_cast<unsigned char>(digit * (256 / fanout));
+            rest /= fanout;
+        }
+        keys[k] = key;
+    }
+    std::shuffle(keys.begin(), keys.end(), std::minstd_rand(8));
+
+    double n = static_cast<double>(total);
+    double insert_ns = 0;
+    double hit_ns = 0;
+    for (std::size_t r = 0; r < repeat; ++r) {
+        bool first = r == 0;
+        radix_tree* tree = new radix_tree(tree_allocator());
+
+        auto start = std::chrono::steady_clock::now();
+        for (const unsigned char* key : keys)
+            tree->insert(key, depth);
+        keep_fastest(insert_ns, elapsed_ns(start) / n, first);
+
+        std::size_t found = 0;
+        start = std::chrono::steady_clock::now();
+        for (const unsigned char* key : keys)
+            found += tree->contains(key, depth);
+        keep_fastest(hit_ns, elapsed_ns(start) / n, first);
+
+        delete tree;
+        sink = found;
+    }
+    std::printf("  %8zu %8zu %8zu %8.1f %8.1f %8.1f\n",
+                fanout, total, depth, insert_ns, hit_ns,
+                hit_ns / static_cast<double>(depth));
+}
+
+void run_fanouts(std::size_t count, std::size_t repeat)
+{
+    std::printf("fan-out: trees whose nodes all have the same number of "
+                "edges\n");
+    std::printf("  %8s %8s %8s %8s %8s %8s\n", "edges", "keys", "depth",
+                "insert", "hit", "hit/node");
+    // Either side of the thresholds where nodes change how they search
+    // their edges.
+    const std::size_t fanouts[] = {2, 4, 5, 8, 16, 17, 32, 64, 128, 256};
+    for (std::size_t fanout : fanouts)
+        run_fanout(fanout, count, repeat);
+    std::printf("\n");
+}
+
+// Subscribe and unsubscribe storms: about count keys spread over nodes
+// of 200 children each, all inserted and then all erased in random
+// order, so that every node grows and shrinks through the capacities
+// in between. The children are short enough to be held in the slots of
+// their parents, so the allocations are those of the parents growing
+// and shrinking.
+void run_storm(std::size_t count, std::size_t repeat)
+{
+    const std::size_t children = 200;
+    std::size_t parents = std::max<std::size_t>(count / children, 1);
+    std::vector<std::string> keys;
+    for (std::size_t p = 0; p < parents; ++p) {
+        std::string parent = "storm." + std::to_string(p) + ".";
+        for (std::size_t c = 0; c < children; ++c)
+            keys.push_back(parent + static_cast<char>(32 + c));
+    }
+    std::vector<std::string> inserts = keys;
+    std::shuffle(inserts.begin(), inserts.end(), std::minstd_rand(9));
+    std::vector<std::string> erasures = keys;
+    std::shuffle(erasures.begin(), erasures.end(), std::minstd_rand(10));
+
+    double n = static_cast<double>(keys.size());
+    measurement m;
+    for (std::size_t r = 0; r < repeat; ++r) {
+        bool first = r == 0;
+        radix_tree* tree = new radix_tree(tree_allocator());
+
+        std::size_t allocations_before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        for (auto const& key : inserts)
+            tree->insert(bytes(key), key.size());
+        keep_fastest(m.insert_ns, elapsed_ns(start) / n, first);
+        m.insert_allocations =
+            static_cast<double>(allocations.load() - allocations_before) / n;
+        m.bytes_per_key = static_cast<double>(tree->memory_usage()) / n;
+
+        allocations_before = allocations.load();
+        start = std::chrono::steady_clock::now();
+        for (auto const& key : erasures)
+            tree->erase(bytes(key), key.size());
+        keep_fastest(m.erase_ns, elapsed_ns(start) / n, first);
+        m.erase_allocations =
+            static_cast<double>(allocations.load() - allocations_before) / n;
+
+        sink = tree->size();
+        delete tree;
+    }
+    std::printf("storm: %zu nodes of %zu children, inserted and erased in "
+                "random order\n", parents, children);
+    std::printf("  %-20s %8s %8s %8s %8s %9s\n", "ns/op", "insert", "erase",
+                "alloc/in", "alloc/er", "bytes/key");
+    std::printf("  %-20s %8.1f %8.1f %8.2f %8.2f %9.1f\n\n",
+                radix_tree_container::name(), m.insert_ns, m.erase_ns,
+                m.insert_allocations, m.erase_allocations, m.bytes_per_key);
+}
+
+// Thread-safe trees for the scaling runs.
+
+class locked_tree
+{
+public:
+    static const char* name() { return "radix_tree + mutex"; }
+
+    void insert(std::string const& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tree_.insert(bytes(key), key.size());
+    }
+
+    void erase(std::string const& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tree_.erase(bytes(key), key.size());
+    }
+
+    bool contains(std::string const& key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tree_.contains(bytes(key), key.size());
+    }
+
+private:
+    std::mutex mutex_;
+    radix_tree tree_;
+};
+
+template <typename Tree, const char* Name>
+class shared_tree
+{
+public:
+    static const char* name() { return Name; }
+
+    void insert(std::string const& key)
+    {
+        tree_.insert(bytes(key), key.size());
+    }
+
+    void erase(std::string const& key)
+    {
+        tree_.erase(bytes(key), key.size());
+    }
+
+    bool contains(std::string const& key)
+    {
+        return tree_.contains(bytes(key), key.size());
+    }
+
+private:
+    Tree tree_;
+};
+
+char concurrent_name[] = "concurrent_radix_tree";
+char olc_name[] = "olc_radix_tree";
+
+// Each thread subscribes its share of the keys, looks them up and
+// unsubscribes them again. Returns millions of operations per second.
+template <typename Tree>
+double run_threads(std::vector<std::string> const& keys,
+                   std::size_t nthreads,
+                   std::size_t repeat)
+{
+    double best = 0;
+    for (std::size_t r = 0; r < repeat; ++r) {
+        Tree tree;
+        std::atomic<std::size_t> found(0);
+        std::vector<std::thread> threads;
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t t = 0; t < nthreads; ++t) {
+            threads.emplace_back([&keys, &tree, &found, t, nthreads]() {
+                std::size_t local = 0;
+                for (std::size_t k = t; k < keys.size(); k += nthreads)
+                    tree.insert(keys[k]);
+                for (std::size_t k = t; k < keys.size(); k += nthreads)
+                    local += tree.contains(keys[k]);
+                for (std::size_t k = t; k < keys.size(); k += nthreads)
+                    tree.erase(keys[k]);
+                found += local;
+            });
+        }
+        for (auto& thread : threads)
+            thread.join();
+        double mops = 3.0 * static_cast<double>(keys.size())
+                      / elapsed_ns(start) * 1000.0;
+        best = std::max(best, mops);
+        sink = found.load();
+    }
+    return best;
+}
+
+template <typename Tree>
+void print_scaling(std::vector<std::string> const& keys,
+                   std::size_t max_threads,
+                   std::size_t repeat)
+{
+    std::printf("  %-22s", Tree::name());
+    for (std::size_t n = 1; n <= max_threads; n *= 2)
+        std::printf(" %8.2f", run_threads<Tree>(keys, n, repeat));
+    std::printf("\n");
+}
+
+void run_scaling(std::vector<std::string> const& keys,
+                 std::size_t max_threads,
+                 std::size_t repeat)
+{
+    std::printf("scaling: topic keys, Mops/s by thread count "
+                "(%u hardware threads)\n",
+                std::thread::hardware_concurrency());
+    std::printf("  %-22s", "threads");
+    for (std::size_t n = 1; n <= max_threads; n *= 2)
+        std::printf(" %8zu", n);
+    std::printf("\n");
+    print_scaling<locked_tree>(keys, max_threads, repeat);
+    print_scaling<shared_tree<concurrent_radix_tree, concurrent_name>>(
+        keys, max_threads, repeat);
+    print_scaling<shared_tree<olc_radix_tree, olc_name>>(
+        keys, max_threads, repeat);
+}
+
+std::size_t parse_count(const char* arg)
+{
+    char* end;
+    unsigned long value = std::strtoul(arg, &end, 10);
+    if (*end != '\0' || value == 0) {
+        std::fprintf(stderr, "rt-bench: invalid count '%s'\n", arg);
+        std::exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t count = 100000;
+    std::size_t repeat = 5;
+    std::size_t threads = 0;
+    std::size_t batch_count = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (i + 1 < argc && std::strcmp(argv[i], "--keys") == 0) {
+            count = parse_count(argv[++i]);
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--repeat") == 0) {
+            repeat = parse_count(argv[++i]);
+        } else if (i + 1 < argc && std::strcmp(argv[i], "--threads") == 0) {
+            threads = parse_count(argv[++i]);
+        } else if (i + 1 < argc
+                   && std::strcmp(argv[i], "--batch-keys") == 0) {
+            batch_count = parse_count(argv[++i]);
+        } else {
+            std::fprintf(stderr,
+                         "usage: rt-bench [--keys N] [--repeat R] "
+                         "[--threads T] [--batch-keys B]\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+#ifndef NDEBUG
+    std::printf("warning: assertions are enabled, configure with "
+                "-DCMAKE_BUILD_TYPE=Release for meaningful numbers\n\n");
+#endif
+
+    run_key_set("random", random_keys(count), repeat);
+    run_key_set("topics", topic_keys(count), repeat);
+    run_key_set("long topics", long_topic_keys(count), repeat);
+    run_key_set("urls", url_keys(count), repeat);
+    run_key_set("dense integers", dense_integer_keys(count), repeat);
+    run_teardowns(topic_keys(count), repeat);
+    run_batches(batch_count > 0 ? batch_count : count, repeat);
+
+    std::vector<std::uint64_t> ids;
+    for (std::size_t i = 0; i < count; ++i)
+        ids.push_back(i);
+    run_integer_keys("dense ids", ids, repeat);
+    std::mt19937_64 rng(7);
+    for (auto& id : ids)
+        id = rng();
+    run_integer_keys("random ids", ids, repeat);
+    run_routes(count, repeat);
+    run_fanouts(count, repeat);
+    run_storm(count, repeat);
+    if (threads > 0)
+        run_scaling(topic_keys(count), threads, repeat);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,158 @@
+#include "key_sets.hpp"
+
+#include <cstdint>
+#include <random>
+#include <unordered_set>
+
+namespace
+{
+
+// Draws keys until there are enough distinct ones, keeping them in the
+// order they were first drawn.
+template <typename Generator>
+std::vector<std::string> distinct_keys(std::size_t count, Generator next)
+{
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    while (keys.size() < count) {
+        std::string key = next();
+        if (seen.insert(key).second)
+            keys.push_back(key);
+    }
+    return keys;
+}
+
+template <typename T, std::size_t N>
+const T& pick(std::minstd_rand& rng, const T (&items)[N])
+{
+    return items[rng() % N];
+}
+
+}
+
+std::vector<std::string> random_keys(std::size_t count)
+{
+    std::minstd_rand rng(1);
+    return distinct_keys(count, [&rng]() {
+        const char* chars = "abcdefghijklmnopqrstuvwxyz0123456789";
+        std::size_t length = rng() % 50 + 1;
+        std::string key;
+        for (std::size_t i = 0; i < length; ++i)
+            key.push_back(chars[rng() % 36]);
+        return key;
+    });
+}
+
+std::vector<std::string> topic_keys(std::size_t count)
+{
+    static const char* const regions[] = {
+        "eu", "us", "ap", "sa", "af", "me", "cn", "au"
+    };
+    static const char* const services[] = {
+        "billing", "orders", "users", "search", "payments", "shipping",
+        "inventory", "catalog", "reviews", "auth", "sessions", "metrics",
+        "alerts", "reports", "exports", "imports"
+    };
+    static const char* const events[] = {
+        "created", "updated", "deleted", "viewed", "failed", "retried",
+        "queued", "done"
+    };
+
+    std::minstd_rand rng(2);
+    return distinct_keys(count, [&rng]() {
+        std::string key = pick(rng, regions);
+        key += '.';
+        key += pick(rng, services);
+        key += ".entity";
+        key += std::to_string(rng() % 20000);
+        key += '.';
+        key += pick(rng, events);
+        return key;
+    });
+}
+
+std::vector<std::string> long_topic_keys(std::size_t count)
+{
+    static const char* const tenants[] = {
+        "acme-corp", "globex-industries", "initech", "umbrella-research"
+    };
+    static const char* const regions[] = {
+        "eu-west-1", "eu-central-1", "us-east-1", "us-west-2",
+        "ap-southeast-2"
+    };
+    static const char* const metrics[] = {
+        "cpu", "memory", "disk/read-bytes", "disk/write-bytes",
+        "network/rx-packets", "network/tx-packets", "temperature"
+    };
+
+    std::minstd_rand rng(5);
+    return distinct_keys(count, [&rng]() {
+        std::string key = "telemetry/";
+        key += pick(rng, tenants);
+        key += '/';
+        key += pick(rng, regions);
+        key += "/cluster-";
+        key += std::to_string(rng() % 10);
+        key += "/rack-";
+        key += std::to_string(rng() % 4);
+        key += "/host-";
+        key += std::to_string(rng() % 100000);
+        key += '/';
+        key += pick(rng, metrics);
+        return key;
+    });
+}
+
+std::vector<std::string> url_keys(std::size_t count)
+{
+    static const char* const tlds[] = {"com", "org", "net", "io"};
+    static const char* const words[] = {
+        "about", "api", "blog", "cart", "docs", "download", "en", "faq",
+        "help", "images", "index", "item", "news", "product", "search",
+        "static", "support", "user", "v1", "v2", "video", "wiki"
+    };
+
+    std::minstd_rand rng(3);
+    return distinct_keys(count, [&rng]() {
+        std::string key = "https://www.site";
+        key += std::to_string(rng() % 500);
+        key += '.';
+        key += pick(rng, tlds);
+        std::size_t segments = rng() % 4 + 1;
+        for (std::size_t i = 0; i < segments; ++i) {
+            key += '/';
+            key += pick(rng, words);
+        }
+        if (rng() % 2 == 0) {
+            key += "?id=";
+            key += std::to_string(rng() % 100000);
+        }
+        return key;
+    });
+}
+
+std::vector<std::string> random_byte_keys(std::size_t count)
+{
+    std::minstd_rand rng(11);
+    return distinct_keys(count, [&rng]() {
+        std::string key(16 + rng() % 16, '\0');
+        for (auto& c : key)
+            c = static_cast<char>(rng());
+        return key;
+    });
+}
+
+std::vector<std::string> dense_integer_keys(std::size_t count)
+{
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        std::string key(8, '\0');
+        for (std::size_t b = 0; b < 8; ++b)
+            key[7 - b] = static_cast<char>((static_cast<std::uint64_t>(i)
+                                            >> (8 * b)) & 0xff);
+        keys.push_back(key);
+    }
+    return keys;
+}
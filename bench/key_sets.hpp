@@ -0,0 +1,36 @@
+#ifndef KEY_SETS_HPP
+#define KEY_SETS_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Key distributions for the benchmarks. Every set is generated from a
+// fixed seed and has no duplicates, so runs on different builds work
+// on exactly the same keys.
+
+// Keys of 1 to 50 characters drawn from [a-z0-9], as in the fuzz tests.
+std::vector<std::string> random_keys(std::size_t count);
+
+// Dot-separated topic hierarchies such as "eu.billing.account42.created",
+// where most keys share long prefixes with many others.
+std::vector<std::string> topic_keys(std::size_t count);
+
+// Topic paths of 40 to 100 bytes such as
+// "telemetry/acme-corp/eu-west-1/cluster-07/rack-12/host-0042/cpu",
+// where a few hundred long paths are shared by all keys below them and
+// end up compressed into single nodes.
+std::vector<std::string> long_topic_keys(std::size_t count);
+
+// URLs with a few hundred hosts, paths built from a small vocabulary and
+// an optional query string.
+std::vector<std::string> url_keys(std::size_t count);
+
+// Keys of 16 to 31 random bytes, which share no more than their first
+// few bytes, so that a tree of them has about as many nodes as keys.
+std::vector<std::string> random_byte_keys(std::size_t count);
+
+// The integers 0 to count - 1 as 8-byte big-endian keys.
+std::vector<std::string> dense_integer_keys(std::size_t count);
+
+#endif
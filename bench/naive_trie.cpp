@@ -0,0 +1,148 @@
+#include "naive_trie.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <string>
+
+naive_trie::naive_trie()
+    : size_(0)
+{}
+
+naive_trie::~naive_trie()
+{
+    for (std::size_t i = 0; i < root_.count; ++i)
+        free_nodes(root_.next[i]);
+    delete[] root_.next;
+}
+
+void naive_trie::free_nodes(trie_node* n)
+{
+    if (!n)
+        return;
+    for (std::size_t i = 0; i < n->count; ++i)
+        free_nodes(n->next[i]);
+    delete[] n->next;
+    delete n;
+}
+
+bool naive_trie::insert(const unsigned char* key, std::size_t size)
+{
+    trie_node* n = &root_;
+    for (std::size_t i = 0; i < size; ++i) {
+        unsigned char c = key[i];
+        if (n->count == 0) {
+            n->min = c;
+            n->count = 1;
+            n->next = new trie_node*[1]();
+        } else if (c < n->min || c >= n->min + n->count) {
+            // Grow the table to cover the new byte.
+            unsigned char min = c < n->min ? c : n->min;
+            std::size_t end = n->min + n->count;
+            if (static_cast<std::size_t>(c) + 1 > end)
+                end = static_cast<std::size_t>(c) + 1;
+            auto** next = new trie_node*[end - min]();
+            std::memcpy(next + (n->min - min), n->next,
+                        n->count * sizeof(trie_node*));
+            delete[] n->next;
+            n->next = next;
+            n->min = min;
+            n->count = static_cast<std::uint16_t>(end - min);
+        }
+
+        trie_node*& child = n->next[c - n->min];
+        if (!child) {
+            child = new trie_node;
+            ++n->live;
+        }
+        n = child;
+    }
+
+    ++size_;
+    return ++n->refcount == 1;
+}
+
+// Returns whether the key was found. Nodes left without keys or
+// children are freed on the way back up.
+bool naive_trie::erase(trie_node* n, const unsigned char* key, std::size_t size)
+{
+    if (size == 0) {
+        if (n->refcount == 0)
+            return false;
+        --n->refcount;
+        return true;
+    }
+
+    unsigned char c = *key;
+    if (c < n->min || c >= n->min + n->count || !n->next[c - n->min])
+        return false;
+    trie_node*& child = n->next[c - n->min];
+    if (!erase(child, key + 1, size - 1))
+        return false;
+
+    if (child->refcount == 0 && child->live == 0) {
+        delete[] child->next;
+        delete child;
+        child = nullptr;
+        if (--n->live == 0) {
+            delete[] n->next;
+            n->next = nullptr;
+            n->count = 0;
+        }
+    }
+    return true;
+}
+
+bool naive_trie::erase(const unsigned char* key, std::size_t size)
+{
+    if (!erase(&root_, key, size))
+        return false;
+    --size_;
+    return true;
+}
+
+bool naive_trie::contains(const unsigned char* key, std::size_t size) const
+{
+    const trie_node* n = &root_;
+    for (std::size_t i = 0; i < size; ++i) {
+        unsigned char c = key[i];
+        if (c < n->min || c >= n->min + n->count || !n->next[c - n->min])
+            return false;
+        n = n->next[c - n->min];
+    }
+    return n->refcount > 0;
+}
+
+void naive_trie::visit_keys(const trie_node* n,
+                            std::string& key,
+                            void (*func)(unsigned char* data,
+                                         std::size_t size,
+                                         void* arg),
+                            void* arg)
+{
+    if (n->refcount > 0) {
+        std::string copy = key;
+        for (std::uint32_t i = 0; i < n->refcount; ++i)
+            func(reinterpret_cast<unsigned char*>(&copy[0]), copy.size(), arg);
+    }
+    for (std::size_t i = 0; i < n->count; ++i) {
+        if (!n->next[i])
+            continue;
+        key.push_back(static_cast<char>(n->min + i));
+        visit_keys(n->next[i], key, func, arg);
+        key.pop_back();
+    }
+}
+
+void naive_trie::apply(void (*func)(unsigned char* data,
+                                    std::size_t size,
+                                    void* arg),
+                       void* arg) const
+{
+    std::string key;
+    visit_keys(&root_, key, func, arg);
+}
+
+std::size_t naive_trie::size() const
+{
+    return size_;
+}
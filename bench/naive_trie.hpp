@@ -0,0 +1,53 @@
+#ifndef NAIVE_TRIE_HPP
+#define NAIVE_TRIE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A trie with a node for every byte of every key, used as a baseline.
+// Like the libzmq trie radix_tree is meant to replace, each node keeps
+// its children in a table covering the bytes from the smallest to the
+// largest one it has an edge for.
+class naive_trie
+{
+public:
+    naive_trie();
+    ~naive_trie();
+
+    naive_trie(naive_trie const&) = delete;
+    naive_trie& operator=(naive_trie const&) = delete;
+
+    // These have the same semantics as the radix_tree functions of the
+    // same name.
+    bool insert(const unsigned char* key, std::size_t size);
+    bool erase(const unsigned char* key, std::size_t size);
+    bool contains(const unsigned char* key, std::size_t size) const;
+    void apply(void (*func)(unsigned char* data, std::size_t size, void* arg),
+               void* arg) const;
+    std::size_t size() const;
+
+private:
+    struct trie_node
+    {
+        std::uint32_t refcount = 0;
+        std::uint16_t count = 0; // Size of the table.
+        std::uint16_t live = 0; // Non-null entries in the table.
+        unsigned char min = 0; // Byte of the first entry in the table.
+        trie_node** next = nullptr;
+    };
+
+    static void free_nodes(trie_node* n);
+    static bool erase(trie_node* n, const unsigned char* key, std::size_t size);
+    static void visit_keys(const trie_node* n,
+                           std::string& key,
+                           void (*func)(unsigned char* data,
+                                        std::size_t size,
+                                        void* arg),
+                           void* arg);
+
+    trie_node root_;
+    std::size_t size_;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include "concurrent_radix_tree.hpp"
+#include "epoch.hpp"
+
+#include <cassert>
+
+concurrent_radix_tree::retiring_allocator::retiring_allocator(
+    node_allocator& allocator)
+    : allocator_(&allocator)
+{}
+
+concurrent_radix_tree::retiring_allocator::~retiring_allocator()
+{
+    for (block const& b : pending_)
+        allocator_->deallocate(b.data, b.size);
+    for (block const& b : retired_)
+        allocator_->deallocate(b.data, b.size);
+}
+
+unsigned char* concurrent_radix_tree::retiring_allocator::allocate(
+    std::size_t size)
+{
+    return allocator_->allocate(size);
+}
+
+void concurrent_radix_tree::retiring_allocator::deallocate(
+    unsigned char* data,
+    std::size_t size)
+{
+    pending_.push_back(block{data, size, 0});
+}
+
+void concurrent_radix_tree::retiring_allocator::retire_pending(
+    std::uint64_t epoch)
+{
+    for (block& b : pending_) {
+        b.epoch = epoch;
+        retired_.push_back(b);
+    }
+    pending_.clear();
+}
+
+void concurrent_radix_tree::retiring_allocator::reclaim(
+    std::uint64_t oldest_active_epoch)
+{
+    // Blocks are retired in epoch order.
+    std::size_t k = 0;
+    while (k < retired_.size() && retired_[k].epoch < oldest_active_epoch) {
+        allocator_->deallocate(retired_[k].data, retired_[k].size);
+        ++k;
+    }
+    retired_.erase(retired_.begin(),
+                   retired_.begin() + static_cast<std::ptrdiff_t>(k));
+}
+
+// ----------------------------------------------------------------------
+
+concurrent_radix_tree::concurrent_radix_tree()
+    : concurrent_radix_tree(default_node_allocator())
+{}
+
+concurrent_radix_tree::concurrent_radix_tree(node_allocator& allocator)
+    : allocator_(allocator)
+    , tree_(allocator_)
+    , root_(tree_.root_.data_)
+    , size_(0)
+    , memory_usage_(tree_.memory_usage())
+    , node_count_(tree_.node_count())
+{}
+
+concurrent_radix_tree::~concurrent_radix_tree() = default;
+
+void concurrent_radix_tree::publish()
+{
+    // A reader that loaded the old root announced an epoch no later
+    // than the one read here, so it keeps the replaced nodes alive
+    // until it finishes. Readers starting after the increment can
+    // only load the new root.
+    root_.store(tree_.root_.data_);
+    std::uint64_t epoch = advance_epoch();
+    allocator_.retire_pending(epoch);
+    allocator_.reclaim(oldest_active_epoch());
+    size_.store(tree_.size(), std::memory_order_relaxed);
+    memory_usage_.store(tree_.memory_usage(), std::memory_order_relaxed);
+    node_count_.store(tree_.node_count(), std::memory_order_relaxed);
+}
+
+bool concurrent_radix_tree::insert(const unsigned char* key, std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    tree_.copy_path(key, size);
+    bool inserted = tree_.insert(key, size);
+    publish();
+    return inserted;
+}
+
+bool concurrent_radix_tree::erase(const unsigned char* key, std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (!tree_.contains(key, size))
+        return false; // Nothing to copy.
+    tree_.copy_path(key, size);
+    bool erased = tree_.erase(key, size);
+    assert(erased);
+    publish();
+    return erased;
+}
+
+void concurrent_radix_tree::build_from_sorted(const unsigned char* const* keys,
+                                              const std::size_t* sizes,
+                                              std::size_t count)
+{
+    // The old nodes are handed to the retiring allocator and the new
+    // tree is private until it is published.
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    tree_.build_from_sorted(keys, sizes, count);
+    publish();
+}
+
+bool concurrent_radix_tree::contains(const unsigned char* key,
+                                     std::size_t size) const
+{
+    read_section section;
+    return radix_tree::contains(node(root_.load()), key, size);
+}
+
+void concurrent_radix_tree::contains_batch(const unsigned char* const* keys,
+                                           const std::size_t* sizes,
+                                           std::size_t count,
+                                           bool* results) const
+{
+    read_section section;
+    radix_tree::contains_batch(node(root_.load()),
+                               keys, sizes, count, results);
+}
+
+bool concurrent_radix_tree::any_prefix_of(const unsigned char* data,
+                                          std::size_t size) const
+{
+    read_section section;
+    return radix_tree::any_prefix_of(node(root_.load()), data, size);
+}
+
+void concurrent_radix_tree::any_prefix_of_batch(
+    const unsigned char* const* data,
+    const std::size_t* sizes,
+    std::size_t count,
+    bool* results) const
+{
+    read_section section;
+    radix_tree::any_prefix_of_batch(node(root_.load()),
+                                    data, sizes, count, results);
+}
+
+void concurrent_radix_tree::match_prefixes(
+    const unsigned char* data,
+    std::size_t size,
+    void (*func)(const unsigned char* data, std::size_t size, void* arg),
+    void* arg) const
+{
+    read_section section;
+    radix_tree::match_prefixes(node(root_.load()), data, size, func, arg);
+}
+
+void concurrent_radix_tree::apply(void (*func)(unsigned char* data,
+                                               std::size_t size,
+                                               void* arg),
+                                  void* arg) const
+{
+    read_section section;
+    radix_tree::apply(node(root_.load()), func, arg);
+}
+
+std::size_t concurrent_radix_tree::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
+
+std::size_t concurrent_radix_tree::memory_usage() const
+{
+    return memory_usage_.load(std::memory_order_relaxed);
+}
+
+std::size_t concurrent_radix_tree::node_count() const
+{
+    return node_count_.load(std::memory_order_relaxed);
+}
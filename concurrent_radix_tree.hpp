@@ -0,0 +1,121 @@
+#ifndef CONCURRENT_RADIX_TREE_HPP
+#define CONCURRENT_RADIX_TREE_HPP
+
+#include "node_allocator.hpp"
+#include "radix_tree.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// A radix tree that can be read from any number of threads while it is
+// being modified.
+//
+// Lookups take no locks. They read the root from an atomic pointer and
+// walk nodes that are never modified once other threads can reach them.
+// Modifications are serialized by a mutex. A writer copies every node
+// on the path it is about to change, makes the change to the copies and
+// publishes the new root with a single atomic store, so readers see
+// either the old tree or the new one.
+//
+// Nodes replaced by a writer are reclaimed through epoch-based
+// reclamation: each lookup announces the global epoch it started in,
+// and a replaced node is only freed once every lookup that could have
+// seen it has finished.
+class concurrent_radix_tree
+{
+public:
+    concurrent_radix_tree();
+    // The allocator supplied is only used by writers, under the mutex,
+    // and has to outlive the tree.
+    explicit concurrent_radix_tree(node_allocator& allocator);
+    // No other thread may be using the tree at this point.
+    ~concurrent_radix_tree();
+
+    concurrent_radix_tree(concurrent_radix_tree const&) = delete;
+    concurrent_radix_tree& operator=(concurrent_radix_tree const&) = delete;
+
+    // Writers. These have the same semantics as the radix_tree
+    // functions of the same name.
+    bool insert(const unsigned char* key, std::size_t size);
+    bool erase(const unsigned char* key, std::size_t size);
+    void build_from_sorted(const unsigned char* const* keys,
+                           const std::size_t* sizes,
+                           std::size_t count);
+
+    // Readers. These never block and may run concurrently with writers
+    // and with each other.
+    bool contains(const unsigned char* key, std::size_t size) const;
+    void contains_batch(const unsigned char* const* keys,
+                        const std::size_t* sizes,
+                        std::size_t count,
+                        bool* results) const;
+    bool any_prefix_of(const unsigned char* data, std::size_t size) const;
+    void any_prefix_of_batch(const unsigned char* const* data,
+                             const std::size_t* sizes,
+                             std::size_t count,
+                             bool* results) const;
+    // The function supplied runs while the reader holds on to its
+    // epoch, so it should be quick.
+    void match_prefixes(const unsigned char* data,
+                        std::size_t size,
+                        void (*func)(const unsigned char* data,
+                                     std::size_t size,
+                                     void* arg),
+                        void* arg) const;
+    void apply(void (*func)(unsigned char* data, std::size_t size, void* arg),
+               void* arg) const;
+    std::size_t size() const;
+    // These are as of the last modification, like size().
+    std::size_t memory_usage() const;
+    std::size_t node_count() const;
+
+private:
+    // Defers deallocation of nodes until no reader can reach them.
+    // Blocks deallocated during a modification wait in pending_ until
+    // the new root is published, and then in retired_ until the epoch
+    // they were retired in is older than that of every active reader.
+    class retiring_allocator : public node_allocator
+    {
+    public:
+        explicit retiring_allocator(node_allocator& allocator);
+        ~retiring_allocator() override;
+
+        unsigned char* allocate(std::size_t size) override;
+        void deallocate(unsigned char* data, std::size_t size) override;
+
+        // Tags the blocks deallocated since the last call with the
+        // epoch supplied.
+        void retire_pending(std::uint64_t epoch);
+        // Frees blocks retired before the epoch supplied.
+        void reclaim(std::uint64_t oldest_active_epoch);
+
+    private:
+        struct block
+        {
+            unsigned char* data;
+            std::size_t size;
+            std::uint64_t epoch;
+        };
+
+        node_allocator* allocator_;
+        std::vector<block> pending_;
+        std::vector<block> retired_;
+    };
+
+    // Makes the writer's root visible to readers and reclaims what
+    // they can no longer reach.
+    void publish();
+
+    std::mutex write_mutex_;
+    retiring_allocator allocator_;
+    radix_tree tree_; // Only accessed by writers.
+    std::atomic<unsigned char*> root_;
+    std::atomic<std::size_t> size_;
+    std::atomic<std::size_t> memory_usage_;
+    std::atomic<std::size_t> node_count_;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "epoch.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+
+// A reader's announcement of the epoch its current lookup started in.
+// Each thread takes a record on its first lookup and hands it back when
+// it exits. Records are never freed, so writers can scan the list
+// without synchronizing with threads coming and going.
+struct reader_record
+{
+    std::atomic<std::uint64_t> epoch{0}; // 0 while the thread isn't reading.
+    std::atomic<bool> taken{false};
+    reader_record* next = nullptr;
+    std::size_t depth = 0; // Nesting of read sections in the owner thread.
+};
+
+namespace
+{
+
+// The epoch is shared by all trees, which lets a thread use a single
+// record no matter how many trees it reads from.
+std::atomic<std::uint64_t> global_epoch{1};
+std::atomic<reader_record*> reader_records{nullptr};
+
+reader_record* acquire_record()
+{
+    for (reader_record* record = reader_records.load(); record;
+         record = record->next) {
+        bool expected = false;
+        if (!record->taken.load(std::memory_order_relaxed)
+            && record->taken.compare_exchange_strong(expected, true))
+            return record;
+    }
+
+    auto* record = new reader_record;
+    record->taken.store(true);
+    record->next = reader_records.load();
+    while (!reader_records.compare_exchange_weak(record->next, record)) {
+    }
+    return record;
+}
+
+struct record_owner
+{
+    reader_record* record;
+
+    record_owner()
+        : record(acquire_record())
+    {}
+
+    ~record_owner()
+    {
+        record->taken.store(false, std::memory_order_release);
+    }
+};
+
+reader_record& local_record()
+{
+    thread_local record_owner owner;
+    return *owner.record;
+}
+
+}
+
+read_section::read_section()
+    : record_(local_record())
+{
+    if (record_.depth++ == 0)
+        record_.epoch.store(global_epoch.load());
+}
+
+read_section::~read_section()
+{
+    if (--record_.depth == 0)
+        record_.epoch.store(0, std::memory_order_release);
+}
+
+std::uint64_t advance_epoch()
+{
+    return global_epoch.fetch_add(1);
+}
+
+std::uint64_t oldest_active_epoch()
+{
+    std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+    for (reader_record* record = reader_records.load(); record;
+         record = record->next) {
+        std::uint64_t epoch = record->epoch.load();
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+    return oldest;
+}
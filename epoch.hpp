@@ -0,0 +1,38 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include <cstdint>
+
+// Epoch-based reclamation shared by the concurrent trees.
+//
+// Readers announce the global epoch for as long as they may hold
+// pointers to nodes. A writer that unlinks a node advances the epoch
+// and tags the node with the epoch it read; the node can be freed once
+// that epoch is older than the one announced by every active reader.
+
+struct reader_record;
+
+// Announces the global epoch for as long as it is in scope. Nested
+// sections keep the epoch of the outermost one.
+class read_section
+{
+public:
+    read_section();
+    ~read_section();
+
+    read_section(read_section const&) = delete;
+    read_section& operator=(read_section const&) = delete;
+
+private:
+    reader_record& record_;
+};
+
+// Advances the global epoch and returns the one it replaced, which is
+// what nodes unlinked before the call are tagged with.
+std::uint64_t advance_epoch();
+
+// Returns the oldest epoch announced by an active reader, or the
+// largest epoch there is if no thread is reading.
+std::uint64_t oldest_active_epoch();
+
+#endif
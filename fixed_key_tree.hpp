@@ -0,0 +1,242 @@
+#ifndef FIXED_KEY_TREE_HPP
+#define FIXED_KEY_TREE_HPP
+
+#include "node_allocator.hpp"
+#include "radix_tree.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// An IPv6 address, or any other 16-byte key, in network byte order.
+struct ipv6_address
+{
+    unsigned char bytes[16];
+};
+
+// Encodes keys of type Key as width bytes that compare in the same
+// order as the keys, so that the tree's byte order is the key order.
+template <typename Key, typename Enable = void>
+struct fixed_key_traits;
+
+// Integers are stored big-endian, with the sign bit of signed types
+// flipped so that negative numbers come first.
+template <typename Key>
+struct fixed_key_traits<
+    Key,
+    typename std::enable_if<std::is_integral<Key>::value>::type>
+{
+    using unsigned_type = typename std::make_unsigned<Key>::type;
+
+    static constexpr std::size_t width = sizeof(Key);
+    static constexpr unsigned_type sign_bit = std::is_signed<Key>::value
+        ? static_cast<unsigned_type>(unsigned_type(1) << (width * 8 - 1))
+        : unsigned_type(0);
+
+    static void encode(Key key, unsigned char* bytes)
+    {
+        auto value = static_cast<unsigned_type>(
+            static_cast<unsigned_type>(key) ^ sign_bit);
+        for (std::size_t i = width; i > 0; --i) {
+            bytes[i - 1] = static_cast<unsigned char>(value);
+            value = static_cast<unsigned_type>(value >> 8);
+        }
+    }
+
+    static Key decode(const unsigned char* bytes)
+    {
+        unsigned_type value = 0;
+        for (std::size_t i = 0; i < width; ++i)
+            value = static_cast<unsigned_type>(value << 8 | bytes[i]);
+        return static_cast<Key>(static_cast<unsigned_type>(value ^ sign_bit));
+    }
+};
+
+template <>
+struct fixed_key_traits<ipv6_address>
+{
+    static constexpr std::size_t width = sizeof(ipv6_address::bytes);
+
+    static void encode(ipv6_address const& key, unsigned char* bytes)
+    {
+        std::memcpy(bytes, key.bytes, width);
+    }
+
+    static ipv6_address decode(const unsigned char* bytes)
+    {
+        ipv6_address key;
+        std::memcpy(key.bytes, bytes, width);
+        return key;
+    }
+};
+
+// A radix tree of fixed-width keys, such as 64-bit identifiers or IP
+// addresses, which takes the keys by value and hands them back in
+// ascending order.
+//
+// Since every key has the same length, no key is a prefix of another:
+// all keys end in leaves, and every node below the root takes at least
+// one byte of the key, which bounds the depth of the tree by the width
+// of the keys. Keys are encoded into buffers on the stack, so lookups
+// and updates allocate nothing beyond the nodes of the tree.
+//
+// Like radix_tree, the tree counts how many times each key was
+// inserted, and holds a key until it is erased as many times.
+template <typename Key>
+class fixed_key_tree
+{
+public:
+    using traits = fixed_key_traits<Key>;
+
+    static constexpr std::size_t width = traits::width;
+
+    fixed_key_tree();
+    // Stores the tree's nodes using the allocator supplied, which has
+    // to outlive the tree.
+    explicit fixed_key_tree(node_allocator& allocator);
+
+    fixed_key_tree(fixed_key_tree const&) = delete;
+    fixed_key_tree& operator=(fixed_key_tree const&) = delete;
+
+    // Returns true if the key wasn't already present in the tree.
+    bool insert(Key const& key);
+
+    // Returns true if the key was actually removed from the tree.
+    bool erase(Key const& key);
+
+    bool contains(Key const& key) const;
+
+    // Looks up count keys at once, storing whether the tree contains
+    // keys[k] in results[k], like radix_tree::contains_batch().
+    void contains_batch(const Key* keys, std::size_t count, bool* results)
+        const;
+
+    // Replaces the contents of the tree with the keys supplied, which
+    // must be sorted in ascending order.
+    void build_from_sorted(const Key* keys, std::size_t count);
+
+    // Applies the function supplied to each key k in the tree with
+    // first <= k <= last, in ascending order.
+    void scan(Key const& first,
+              Key const& last,
+              void (*func)(Key const& key, void* arg),
+              void* arg) const;
+
+    std::size_t size() const;
+    std::size_t memory_usage() const;
+
+private:
+    // Keys are looked up in groups of this many by contains_batch().
+    static constexpr std::size_t batch_size = 64;
+
+    radix_tree tree_;
+};
+
+template <typename Key>
+constexpr std::size_t fixed_key_tree<Key>::width;
+
+template <typename Key>
+fixed_key_tree<Key>::fixed_key_tree()
+    : fixed_key_tree(default_node_allocator())
+{}
+
+template <typename Key>
+fixed_key_tree<Key>::fixed_key_tree(node_allocator& allocator)
+    : tree_(allocator)
+{}
+
+template <typename Key>
+bool fixed_key_tree<Key>::insert(Key const& key)
+{
+    unsigned char bytes[width];
+    traits::encode(key, bytes);
+    return tree_.insert(bytes, width);
+}
+
+template <typename Key>
+bool fixed_key_tree<Key>::erase(Key const& key)
+{
+    unsigned char bytes[width];
+    traits::encode(key, bytes);
+    return tree_.erase(bytes, width);
+}
+
+template <typename Key>
+bool fixed_key_tree<Key>::contains(Key const& key) const
+{
+    unsigned char bytes[width];
+    traits::encode(key, bytes);
+    return tree_.contains(bytes, width);
+}
+
+template <typename Key>
+void fixed_key_tree<Key>::contains_batch(const Key* keys,
+                                         std::size_t count,
+                                         bool* results) const
+{
+    unsigned char bytes[batch_size][width];
+    const unsigned char* data[batch_size];
+    std::size_t sizes[batch_size];
+    for (std::size_t k = 0; k < batch_size; ++k) {
+        data[k] = bytes[k];
+        sizes[k] = width;
+    }
+
+    for (std::size_t first = 0; first < count; first += batch_size) {
+        std::size_t n = count - first < batch_size ? count - first
+                                                   : batch_size;
+        for (std::size_t k = 0; k < n; ++k)
+            traits::encode(keys[first + k], bytes[k]);
+        tree_.contains_batch(data, sizes, n, results + first);
+    }
+}
+
+template <typename Key>
+void fixed_key_tree<Key>::build_from_sorted(const Key* keys,
+                                            std::size_t count)
+{
+    std::vector<unsigned char> bytes(count * width);
+    std::vector<const unsigned char*> data(count);
+    std::vector<std::size_t> sizes(count, width);
+    for (std::size_t k = 0; k < count; ++k) {
+        data[k] = bytes.data() + k * width;
+        traits::encode(keys[k], bytes.data() + k * width);
+    }
+    tree_.build_from_sorted(data.data(), sizes.data(), count);
+}
+
+template <typename Key>
+void fixed_key_tree<Key>::scan(Key const& first,
+                               Key const& last,
+                               void (*func)(Key const& key, void* arg),
+                               void* arg) const
+{
+    unsigned char low[width];
+    unsigned char high[width];
+    traits::encode(first, low);
+    traits::encode(last, high);
+
+    for (auto it = tree_.lower_bound(low, width); it != tree_.end(); ++it) {
+        assert(it.size() == width);
+        if (std::memcmp(it.data(), high, width) > 0)
+            break;
+        func(traits::decode(it.data()), arg);
+    }
+}
+
+template <typename Key>
+std::size_t fixed_key_tree<Key>::size() const
+{
+    return tree_.size();
+}
+
+template <typename Key>
+std::size_t fixed_key_tree<Key>::memory_usage() const
+{
+    return tree_.memory_usage();
+}
+
+#endif
@@ -0,0 +1,59 @@
+#include "frozen_radix_tree.hpp"
+
+#include <utility>
+
+frozen_radix_tree::frozen_radix_tree()
+{}
+
+frozen_radix_tree::frozen_radix_tree(radix_tree const& tree)
+{
+    tree.serialize(buffer_);
+    buffer_.shrink_to_fit();
+    view_ = snapshot_view(buffer_.data());
+}
+
+frozen_radix_tree::frozen_radix_tree(frozen_radix_tree&& other)
+    : buffer_(std::move(other.buffer_))
+    , view_(other.view_)
+{
+    other.view_ = snapshot_view();
+}
+
+frozen_radix_tree& frozen_radix_tree::operator=(frozen_radix_tree&& other)
+{
+    buffer_ = std::move(other.buffer_);
+    view_ = other.view_;
+    other.view_ = snapshot_view();
+    return *this;
+}
+
+bool frozen_radix_tree::contains(const unsigned char* key,
+                                 std::size_t size) const
+{
+    return view_.contains(key, size);
+}
+
+bool frozen_radix_tree::any_prefix_of(const unsigned char* data,
+                                      std::size_t size) const
+{
+    return view_.any_prefix_of(data, size);
+}
+
+void frozen_radix_tree::match_prefixes(
+    const unsigned char* data,
+    std::size_t size,
+    void (*func)(const unsigned char* data, std::size_t size, void* arg),
+    void* arg) const
+{
+    view_.match_prefixes(data, size, func, arg);
+}
+
+std::size_t frozen_radix_tree::size() const
+{
+    return view_.size();
+}
+
+std::size_t frozen_radix_tree::memory_usage() const
+{
+    return buffer_.size();
+}
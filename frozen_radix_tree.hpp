@@ -0,0 +1,48 @@
+#ifndef FROZEN_RADIX_TREE_HPP
+#define FROZEN_RADIX_TREE_HPP
+
+#include "radix_tree.hpp"
+#include "snapshot.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// An immutable copy of a radix tree in the compact form of a snapshot,
+// for trees that stop changing once they are loaded.
+//
+// All nodes live in a single buffer in breadth-first order, with 4-byte
+// headers instead of 20, 32-bit offsets instead of child pointers and
+// leaves with the same prefix stored once, so the tree takes a fraction
+// of the memory of the original and more of it stays in the cache.
+class frozen_radix_tree
+{
+public:
+    // An empty tree.
+    frozen_radix_tree();
+    // Freezes a copy of the tree supplied, which is left as it was.
+    explicit frozen_radix_tree(radix_tree const& tree);
+
+    frozen_radix_tree(frozen_radix_tree&& other);
+    frozen_radix_tree& operator=(frozen_radix_tree&& other);
+
+    // These have the same semantics as the radix_tree functions of the
+    // same name.
+    bool contains(const unsigned char* key, std::size_t size) const;
+    bool any_prefix_of(const unsigned char* data, std::size_t size) const;
+    void match_prefixes(const unsigned char* data,
+                        std::size_t size,
+                        void (*func)(const unsigned char* data,
+                                     std::size_t size,
+                                     void* arg),
+                        void* arg) const;
+    std::size_t size() const;
+
+    // Bytes taken by the nodes.
+    std::size_t memory_usage() const;
+
+private:
+    std::vector<unsigned char> buffer_;
+    snapshot_view view_;
+};
+
+#endif
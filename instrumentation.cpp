@@ -0,0 +1,89 @@
+#include "instrumentation.hpp"
+
+#if defined(RADIX_TREE_INSTRUMENTATION)
+
+thread_local radix_tree_instruments* current_instruments = nullptr;
+
+radix_tree_instruments::radix_tree_instruments()
+    : trace_func(nullptr)
+    , trace_arg(nullptr)
+{
+    reset();
+}
+
+radix_tree_metrics radix_tree_instruments::snapshot() const
+{
+    auto load = [](std::atomic<std::uint64_t> const& counter) {
+        return counter.load(std::memory_order_relaxed);
+    };
+
+    radix_tree_metrics metrics;
+    metrics.lookups = load(lookups);
+    metrics.nodes_visited = load(nodes_visited);
+    metrics.prefix_bytes_compared = load(prefix_bytes_compared);
+    metrics.splits = load(splits);
+    metrics.merges = load(merges);
+    metrics.reallocations = load(reallocations);
+    metrics.bytes_moved = load(bytes_moved);
+    for (std::size_t op = 0; op < radix_tree_operation_count; ++op) {
+        for (std::size_t b = 0; b < latency_bucket_count; ++b)
+            metrics.latencies[op][b] = load(latencies[op][b]);
+    }
+    return metrics;
+}
+
+void radix_tree_instruments::reset()
+{
+    auto clear = [](std::atomic<std::uint64_t>& counter) {
+        counter.store(0, std::memory_order_relaxed);
+    };
+
+    clear(lookups);
+    clear(nodes_visited);
+    clear(prefix_bytes_compared);
+    clear(splits);
+    clear(merges);
+    clear(reallocations);
+    clear(bytes_moved);
+    for (auto& buckets : latencies) {
+        for (auto& bucket : buckets)
+            clear(bucket);
+    }
+}
+
+instrumented_operation::instrumented_operation(
+    radix_tree_instruments& instruments,
+    radix_tree_operation operation,
+    const unsigned char* key,
+    std::size_t size)
+    : instruments_(instruments)
+    , outer_(current_instruments)
+    , operation_(operation)
+    , key_(key)
+    , size_(size)
+    , start_(std::chrono::steady_clock::now())
+{
+    current_instruments = &instruments;
+}
+
+instrumented_operation::~instrumented_operation()
+{
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    auto ns = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+            .count());
+    current_instruments = outer_;
+
+    std::size_t bucket = 0;
+    while (bucket + 1 < latency_bucket_count && ns >> (bucket + 1) != 0)
+        ++bucket;
+    instruments_.latencies[static_cast<std::size_t>(operation_)][bucket]
+        .fetch_add(1, std::memory_order_relaxed);
+
+    if (instruments_.trace_func)
+        instruments_.trace_func(
+            radix_tree_trace_event{operation_, key_, size_, ns},
+            instruments_.trace_arg);
+}
+
+#endif
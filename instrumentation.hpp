@@ -0,0 +1,151 @@
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(RADIX_TREE_INSTRUMENTATION)
+#include <atomic>
+#include <chrono>
+#endif
+
+// Counters, latency histograms and tracing for the operations of a
+// radix_tree, for finding out what the tree was doing when latency
+// went up.
+//
+// All of this is compiled in by defining RADIX_TREE_INSTRUMENTATION,
+// which the CMake option of the same name does for the library and for
+// everything linking to it. Otherwise the hooks in the tree compile to
+// nothing, trees have no counters to update, radix_tree::metrics()
+// returns zeros and radix_tree::set_trace() does nothing.
+
+// The operations that are timed and traced. Other operations aren't
+// timed, and only count the work they do when called from these.
+enum class radix_tree_operation
+{
+    insert,
+    erase,
+    contains,
+    contains_batch,
+    any_prefix_of,
+    any_prefix_of_batch,
+    longest_prefix,
+    longest_prefix_batch,
+    match_prefixes
+};
+
+constexpr std::size_t radix_tree_operation_count = 9;
+
+// Bucket i of a latency histogram counts the operations that took from
+// 2^i to 2^(i+1) - 1 nanoseconds. Bucket 0 also counts those that took
+// no measurable time, and the last bucket counts everything slower.
+constexpr std::size_t latency_bucket_count = 32;
+
+// A copy of the counters of a tree, as returned by radix_tree::metrics().
+struct radix_tree_metrics
+{
+    std::uint64_t lookups; // Walks down from the root, one per key.
+    std::uint64_t nodes_visited;
+    std::uint64_t prefix_bytes_compared;
+    std::uint64_t splits; // Nodes split to make room for a key.
+    std::uint64_t merges; // Nodes merged with their only child.
+    std::uint64_t reallocations; // Nodes reallocated to resize them.
+    std::uint64_t bytes_moved; // Bytes copied, or possibly moved, by those.
+
+    // Indexed by operation, then by bucket.
+    std::uint64_t latencies[radix_tree_operation_count][latency_bucket_count];
+};
+
+// Passed to the trace function after each operation. The key is the
+// key or data the operation was given, or nullptr for the batched
+// operations, in which case size is the number of keys in the batch.
+struct radix_tree_trace_event
+{
+    radix_tree_operation operation;
+    const unsigned char* key;
+    std::size_t size;
+    std::uint64_t nanoseconds;
+};
+
+using radix_tree_trace_func = void (*)(radix_tree_trace_event const& event,
+                                       void* arg);
+
+#if defined(RADIX_TREE_INSTRUMENTATION)
+
+// The live counters of a tree. They are updated with relaxed atomic
+// increments, so that lookups running on several threads at once don't
+// race on them.
+struct radix_tree_instruments
+{
+    radix_tree_instruments();
+
+    radix_tree_metrics snapshot() const;
+    void reset();
+
+    std::atomic<std::uint64_t> lookups;
+    std::atomic<std::uint64_t> nodes_visited;
+    std::atomic<std::uint64_t> prefix_bytes_compared;
+    std::atomic<std::uint64_t> splits;
+    std::atomic<std::uint64_t> merges;
+    std::atomic<std::uint64_t> reallocations;
+    std::atomic<std::uint64_t> bytes_moved;
+    std::atomic<std::uint64_t>
+        latencies[radix_tree_operation_count][latency_bucket_count];
+
+    // Set while no operation runs on the tree.
+    radix_tree_trace_func trace_func;
+    void* trace_arg;
+};
+
+// The instruments of the tree whose operation is running on this
+// thread, if any. The static functions doing the actual work find the
+// counters to update here rather than taking them as an argument.
+extern thread_local radix_tree_instruments* current_instruments;
+
+// Times an operation of the tree whose instruments are supplied, and
+// points current_instruments at them while it runs.
+class instrumented_operation
+{
+public:
+    instrumented_operation(radix_tree_instruments& instruments,
+                           radix_tree_operation operation,
+                           const unsigned char* key,
+                           std::size_t size);
+    ~instrumented_operation();
+
+    instrumented_operation(instrumented_operation const&) = delete;
+    instrumented_operation& operator=(instrumented_operation const&) = delete;
+
+private:
+    radix_tree_instruments& instruments_;
+    radix_tree_instruments* outer_;
+    radix_tree_operation operation_;
+    const unsigned char* key_;
+    std::size_t size_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+inline void count_event(
+    std::atomic<std::uint64_t> radix_tree_instruments::*counter,
+    std::uint64_t amount)
+{
+    radix_tree_instruments* instruments = current_instruments;
+    if (instruments)
+        (instruments->*counter).fetch_add(amount, std::memory_order_relaxed);
+}
+
+#define RADIX_TREE_COUNT(counter, amount) \
+    count_event(&radix_tree_instruments::counter, amount)
+#define RADIX_TREE_OPERATION(instruments, operation, key, size) \
+    instrumented_operation instrumented_operation_( \
+        instruments, radix_tree_operation::operation, key, size)
+
+#else
+
+#define RADIX_TREE_COUNT(counter, amount) static_cast<void>(0)
+#define RADIX_TREE_OPERATION(instruments, operation, key, size) \
+    static_cast<void>(0)
+
+#endif
+
+#endif
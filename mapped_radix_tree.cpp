@@ -0,0 +1,90 @@
+#include "mapped_radix_tree.hpp"
+
+#include <cassert>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_radix_tree::mapped_radix_tree()
+    : mapping_(nullptr)
+    , mapping_size_(0)
+{}
+
+mapped_radix_tree::~mapped_radix_tree()
+{
+    close();
+}
+
+bool mapped_radix_tree::open(const char* path)
+{
+    assert(path);
+
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping stays valid after the descriptor is closed.
+    auto size = static_cast<std::size_t>(st.st_size);
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    auto* data = static_cast<const unsigned char*>(mapping);
+    if (!is_snapshot(data, size)) {
+        ::munmap(mapping, size);
+        return false;
+    }
+
+    mapping_ = mapping;
+    mapping_size_ = size;
+    view_ = snapshot_view(data);
+    return true;
+}
+
+void mapped_radix_tree::close()
+{
+    if (!mapping_)
+        return;
+
+    view_ = snapshot_view();
+    ::munmap(mapping_, mapping_size_);
+    mapping_ = nullptr;
+    mapping_size_ = 0;
+}
+
+bool mapped_radix_tree::contains(const unsigned char* key,
+                                 std::size_t size) const
+{
+    return view_.contains(key, size);
+}
+
+bool mapped_radix_tree::any_prefix_of(const unsigned char* data,
+                                      std::size_t size) const
+{
+    return view_.any_prefix_of(data, size);
+}
+
+void mapped_radix_tree::match_prefixes(
+    const unsigned char* data,
+    std::size_t size,
+    void (*func)(const unsigned char* data, std::size_t size, void* arg),
+    void* arg) const
+{
+    view_.match_prefixes(data, size, func, arg);
+}
+
+std::size_t mapped_radix_tree::size() const
+{
+    return view_.size();
+}
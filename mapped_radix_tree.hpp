@@ -0,0 +1,50 @@
+#ifndef MAPPED_RADIX_TREE_HPP
+#define MAPPED_RADIX_TREE_HPP
+
+#include "snapshot.hpp"
+
+#include <cstddef>
+
+// A read-only radix tree that answers lookups straight from the mapped
+// pages of a file written by radix_tree::serialize().
+//
+// Opening a tree costs a single mmap() however many keys it holds, and
+// processes that map the same file share one copy of it in the page
+// cache. The file is trusted beyond its header, so it should only come
+// from radix_tree::serialize() on a machine of the same byte order.
+class mapped_radix_tree
+{
+public:
+    // An empty tree, until a file is opened.
+    mapped_radix_tree();
+    ~mapped_radix_tree();
+
+    mapped_radix_tree(mapped_radix_tree const&) = delete;
+    mapped_radix_tree& operator=(mapped_radix_tree const&) = delete;
+
+    // Maps the file at the path supplied in place of the current one.
+    // Returns false, leaving the tree empty, if the file can't be mapped
+    // or doesn't hold a snapshot.
+    bool open(const char* path);
+    // Unmaps the file, leaving the tree empty.
+    void close();
+
+    // These have the same semantics as the radix_tree functions of the
+    // same name.
+    bool contains(const unsigned char* key, std::size_t size) const;
+    bool any_prefix_of(const unsigned char* data, std::size_t size) const;
+    void match_prefixes(const unsigned char* data,
+                        std::size_t size,
+                        void (*func)(const unsigned char* data,
+                                     std::size_t size,
+                                     void* arg),
+                        void* arg) const;
+    std::size_t size() const;
+
+private:
+    void* mapping_;
+    std::size_t mapping_size_;
+    snapshot_view view_;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include "node_allocator.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+node_allocator::~node_allocator() = default;
+
+unsigned char* node_allocator::reallocate(unsigned char* data,
+                                          std::size_t old_size,
+                                          std::size_t new_size)
+{
+    unsigned char* new_data = allocate(new_size);
+    std::memcpy(new_data, data, old_size < new_size ? old_size : new_size);
+    deallocate(data, old_size);
+    return new_data;
+}
+
+bool node_allocator::release_all()
+{
+    return false;
+}
+
+// ----------------------------------------------------------------------
+
+unsigned char* malloc_allocator::allocate(std::size_t size)
+{
+    auto* data = static_cast<unsigned char*>(std::malloc(size));
+    assert(data);
+    return data;
+}
+
+void malloc_allocator::deallocate(unsigned char* data, std::size_t size)
+{
+    static_cast<void>(size);
+    std::free(data);
+}
+
+unsigned char* malloc_allocator::reallocate(unsigned char* data,
+                                            std::size_t old_size,
+                                            std::size_t new_size)
+{
+    static_cast<void>(old_size);
+    auto* new_data = static_cast<unsigned char*>(std::realloc(data, new_size));
+    assert(new_data);
+    return new_data;
+}
+
+node_allocator& default_node_allocator()
+{
+    static malloc_allocator allocator;
+    return allocator;
+}
+
+// ----------------------------------------------------------------------
+
+tracking_allocator::tracking_allocator(node_allocator& allocator)
+    : allocator_(&allocator)
+    , blocks_(0)
+    , bytes_(0)
+{}
+
+unsigned char* tracking_allocator::allocate(std::size_t size)
+{
+    ++blocks_;
+    bytes_ += size;
+    return allocator_->allocate(size);
+}
+
+void tracking_allocator::deallocate(unsigned char* data, std::size_t size)
+{
+    assert(blocks_ > 0 && bytes_ >= size);
+    --blocks_;
+    bytes_ -= size;
+    allocator_->deallocate(data, size);
+}
+
+unsigned char* tracking_allocator::reallocate(unsigned char* data,
+                                              std::size_t old_size,
+                                              std::size_t new_size)
+{
+    assert(bytes_ >= old_size);
+    bytes_ = bytes_ - old_size + new_size;
+    return allocator_->reallocate(data, old_size, new_size);
+}
+
+bool tracking_allocator::release_all()
+{
+    if (!allocator_->release_all())
+        return false;
+    blocks_ = 0;
+    bytes_ = 0;
+    return true;
+}
+
+std::size_t tracking_allocator::blocks() const
+{
+    return blocks_;
+}
+
+std::size_t tracking_allocator::bytes() const
+{
+    return bytes_;
+}
+
+node_allocator& tracking_allocator::target() const
+{
+    return *allocator_;
+}
+
+void tracking_allocator::adopt(tracking_allocator& other)
+{
+    assert(other.allocator_ == allocator_);
+    blocks_ += other.blocks_;
+    bytes_ += other.bytes_;
+    other.blocks_ = 0;
+    other.bytes_ = 0;
+}
+
+// ----------------------------------------------------------------------
+
+// Large blocks are preceded by a header holding the previous and next
+// blocks in the list. The header takes up one granule so that the
+// block itself stays aligned.
+static unsigned char* large_prev(unsigned char* header)
+{
+    unsigned char* prev;
+    std::memcpy(&prev, header, sizeof(prev));
+    return prev;
+}
+
+static unsigned char* large_next(unsigned char* header)
+{
+    unsigned char* next;
+    std::memcpy(&next, header + sizeof(next), sizeof(next));
+    return next;
+}
+
+static void set_large_prev(unsigned char* header, unsigned char* prev)
+{
+    std::memcpy(header, &prev, sizeof(prev));
+}
+
+static void set_large_next(unsigned char* header, unsigned char* next)
+{
+    std::memcpy(header + sizeof(next), &next, sizeof(next));
+}
+
+slab_allocator::slab_allocator(std::size_t slab_size)
+    : slab_size_(slab_size < max_class_size ? max_class_size : slab_size)
+    , reserved_bytes_(0)
+    , cursor_(nullptr)
+    , slab_end_(nullptr)
+    , free_lists_(max_class_size / granularity, nullptr)
+    , large_blocks_(nullptr)
+{
+    static_assert(2 * sizeof(void*) <= granularity,
+                  "large block header must fit in one granule");
+}
+
+slab_allocator::~slab_allocator()
+{
+    release_all();
+}
+
+unsigned char* slab_allocator::allocate(std::size_t size)
+{
+    assert(size > 0);
+
+    if (size > max_class_size)
+        return allocate_large(size);
+
+    std::size_t size_class = (size - 1) / granularity;
+    unsigned char* block = free_lists_[size_class];
+    if (block) {
+        // Pop the block off the free list. Free blocks hold a pointer
+        // to the next free block of the same class.
+        std::memcpy(&free_lists_[size_class], block, sizeof(block));
+        return block;
+    }
+
+    std::size_t block_size = (size_class + 1) * granularity;
+    if (static_cast<std::size_t>(slab_end_ - cursor_) < block_size) {
+        auto* slab = static_cast<unsigned char*>(std::malloc(slab_size_));
+        assert(slab);
+        slabs_.push_back(slab);
+        reserved_bytes_ += slab_size_;
+        cursor_ = slab;
+        slab_end_ = slab + slab_size_;
+    }
+    block = cursor_;
+    cursor_ += block_size;
+    return block;
+}
+
+void slab_allocator::deallocate(unsigned char* data, std::size_t size)
+{
+    assert(size > 0);
+
+    if (size > max_class_size) {
+        deallocate_large(data);
+        reserved_bytes_ -= granularity + size;
+        return;
+    }
+
+    std::size_t size_class = (size - 1) / granularity;
+    std::memcpy(data, &free_lists_[size_class], sizeof(data));
+    free_lists_[size_class] = data;
+}
+
+unsigned char* slab_allocator::reallocate(unsigned char* data,
+                                          std::size_t old_size,
+                                          std::size_t new_size)
+{
+    if (old_size <= max_class_size && new_size <= max_class_size
+        && (old_size - 1) / granularity == (new_size - 1) / granularity)
+        return data; // The block already has room for the new size.
+    return node_allocator::reallocate(data, old_size, new_size);
+}
+
+bool slab_allocator::release_all()
+{
+    for (unsigned char* slab : slabs_)
+        std::free(slab);
+    slabs_.clear();
+    while (large_blocks_) {
+        unsigned char* next = large_next(large_blocks_);
+        std::free(large_blocks_);
+        large_blocks_ = next;
+    }
+    for (auto& head : free_lists_)
+        head = nullptr;
+    cursor_ = nullptr;
+    slab_end_ = nullptr;
+    reserved_bytes_ = 0;
+    return true;
+}
+
+std::size_t slab_allocator::reserved_bytes() const
+{
+    return reserved_bytes_;
+}
+
+unsigned char* slab_allocator::allocate_large(std::size_t size)
+{
+    auto* header = static_cast<unsigned char*>(
+        std::malloc(granularity + size));
+    assert(header);
+    set_large_prev(header, nullptr);
+    set_large_next(header, large_blocks_);
+    if (large_blocks_)
+        set_large_prev(large_blocks_, header);
+    large_blocks_ = header;
+    reserved_bytes_ += granularity + size;
+    return header + granularity;
+}
+
+void slab_allocator::deallocate_large(unsigned char* data)
+{
+    unsigned char* header = data - granularity;
+    unsigned char* prev = large_prev(header);
+    unsigned char* next = large_next(header);
+    if (prev)
+        set_large_next(prev, next);
+    else
+        large_blocks_ = next;
+    if (next)
+        set_large_prev(next, prev);
+    std::free(header);
+}
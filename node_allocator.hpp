@@ -0,0 +1,129 @@
+#ifndef NODE_ALLOCATOR_HPP
+#define NODE_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Interface for the storage backing the data layout of tree nodes.
+//
+// A tree hands its allocator the exact size of each layout, both when
+// allocating and when deallocating, so implementations don't need to
+// keep any bookkeeping per block.
+//
+// Blocks returned by allocate() and reallocate() must be aligned to at
+// least 2 bytes: trees tell nodes apart from leaves held in pointer
+// slots by bit 0 of the pointer, which has to be clear for a node.
+class node_allocator
+{
+public:
+    virtual ~node_allocator();
+
+    virtual unsigned char* allocate(std::size_t size) = 0;
+    virtual void deallocate(unsigned char* data, std::size_t size) = 0;
+
+    // Resizes a block, keeping the first min(old_size, new_size) bytes.
+    // The default implementation allocates, copies and deallocates.
+    virtual unsigned char* reallocate(unsigned char* data,
+                                      std::size_t old_size,
+                                      std::size_t new_size);
+
+    // Frees every block handed out by this allocator at once. Returns
+    // false if the allocator can't do that, in which case the blocks
+    // have to be deallocated one by one.
+    virtual bool release_all();
+};
+
+// Allocates each block with malloc(). This is the default allocator.
+class malloc_allocator : public node_allocator
+{
+public:
+    unsigned char* allocate(std::size_t size) override;
+    void deallocate(unsigned char* data, std::size_t size) override;
+    unsigned char* reallocate(unsigned char* data,
+                              std::size_t old_size,
+                              std::size_t new_size) override;
+};
+
+// Returns the malloc_allocator shared by trees that aren't given one.
+node_allocator& default_node_allocator();
+
+// Forwards to another allocator, keeping count of the blocks and bytes
+// handed out and not yet deallocated. Trees use one to keep track of
+// their memory usage.
+class tracking_allocator : public node_allocator
+{
+public:
+    explicit tracking_allocator(node_allocator& allocator);
+
+    unsigned char* allocate(std::size_t size) override;
+    void deallocate(unsigned char* data, std::size_t size) override;
+    unsigned char* reallocate(unsigned char* data,
+                              std::size_t old_size,
+                              std::size_t new_size) override;
+    bool release_all() override;
+
+    std::size_t blocks() const;
+    std::size_t bytes() const;
+
+    // The allocator blocks are forwarded to.
+    node_allocator& target() const;
+
+    // Takes over the counts of another tracking_allocator with the same
+    // target, whose blocks now belong to this one, e.g. when nodes move
+    // from one tree to another.
+    void adopt(tracking_allocator& other);
+
+private:
+    node_allocator* allocator_;
+    std::size_t blocks_;
+    std::size_t bytes_;
+};
+
+// Carves blocks out of large slabs, rounding each size up to a
+// multiple of 16 bytes. Freed blocks are kept in a free list per size
+// class and reused before the slab is carved any further, so nodes
+// created together end up next to each other in memory.
+//
+// Blocks too large for any size class are allocated with malloc() and
+// kept in a list, so release_all() can free everything at once. A tree
+// destroyed while using a slab_allocator releases it this way instead
+// of freeing its nodes one by one, which means a slab_allocator must
+// not be shared between trees.
+//
+// This allocator isn't thread-safe.
+class slab_allocator : public node_allocator
+{
+public:
+    explicit slab_allocator(std::size_t slab_size = 64 * 1024);
+    ~slab_allocator() override;
+
+    slab_allocator(slab_allocator const&) = delete;
+    slab_allocator& operator=(slab_allocator const&) = delete;
+
+    unsigned char* allocate(std::size_t size) override;
+    void deallocate(unsigned char* data, std::size_t size) override;
+    unsigned char* reallocate(unsigned char* data,
+                              std::size_t old_size,
+                              std::size_t new_size) override;
+    bool release_all() override;
+
+    // Total number of bytes obtained from malloc().
+    std::size_t reserved_bytes() const;
+
+private:
+    static constexpr std::size_t granularity = 16;
+    static constexpr std::size_t max_class_size = 1024;
+
+    unsigned char* allocate_large(std::size_t size);
+    void deallocate_large(unsigned char* data);
+
+    std::size_t slab_size_;
+    std::size_t reserved_bytes_;
+    unsigned char* cursor_; // Next unused byte in the current slab.
+    unsigned char* slab_end_;
+    std::vector<unsigned char*> slabs_;
+    std::vector<unsigned char*> free_lists_;
+    unsigned char* large_blocks_; // Doubly-linked list of large blocks.
+};
+
+#endif
@@ -0,0 +1,713 @@
+#include "olc_radix_tree.hpp"
+#include "epoch.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <new>
+#include <thread>
+
+namespace
+{
+
+// The version word in front of each node. The lowest bit marks a node
+// that has been replaced or removed, the next one a node held by a
+// writer, and the rest count the modifications made to the node.
+constexpr std::size_t version_size = sizeof(std::uint64_t);
+constexpr std::uint64_t obsolete_bit = 1;
+constexpr std::uint64_t locked_bit = 2;
+
+// Writers free retired blocks in batches of at least this many, so
+// that they don't scan the readers and the retired list on every
+// modification.
+constexpr std::size_t reclaim_threshold = 64;
+
+std::atomic<std::uint64_t>& version(node n)
+{
+    return *reinterpret_cast<std::atomic<std::uint64_t>*>(n.data_
+                                                          - version_size);
+}
+
+// Reads the version of a node before reading the node itself. Returns
+// false if a writer holds the node or has replaced it.
+bool read_version(node n, std::uint64_t& v)
+{
+    v = version(n).load();
+    return (v & (obsolete_bit | locked_bit)) == 0;
+}
+
+// A writer changes the nodes it holds while lookups may be reading
+// them, so those bytes are only ever stored through store_byte() and
+// loaded through load_bytes(), which keeps the accesses atomic. A
+// store releases what the writer built before it, such as the node a
+// pointer it stores leads to, to the lookups that load it.
+unsigned char load_byte(const unsigned char* byte)
+{
+    return reinterpret_cast<const std::atomic<unsigned char>*>(byte)->load(
+        std::memory_order_acquire);
+}
+
+void load_bytes(unsigned char* to, const unsigned char* from, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+        to[i] = load_byte(from + i);
+}
+
+void store_byte(unsigned char* byte, unsigned char value)
+{
+    reinterpret_cast<std::atomic<unsigned char>*>(byte)->store(
+        value, std::memory_order_release);
+}
+
+// Checks that a node hasn't changed since its version was read.
+bool validate(node n, std::uint64_t v)
+{
+    // Keeps the reads of the node from moving past the check.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version(n).load() == v;
+}
+
+// Copies the header of a node with the version supplied, returning
+// false if the node changed. Lookups read the rest of the node at the
+// offsets the copy gives, which stay within the node even if a writer
+// changes it afterwards, since nodes never change size in place.
+bool read_header(node n, std::uint64_t v, unsigned char* header)
+{
+    load_bytes(header, n.data_, node::header_size);
+    return validate(n, v);
+}
+
+// Returns the number of leading bytes of the data supplied that match
+// the prefix of the node whose header is supplied. The prefix is at
+// least size bytes long, and is copied out a chunk at a time.
+std::size_t match_prefix(node n,
+                         node header,
+                         const unsigned char* data,
+                         std::size_t size)
+{
+    assert(!header.prefix_is_external());
+    const unsigned char* prefix = n.data_ + header.prefix_chunk_offset();
+    unsigned char chunk[64];
+    std::size_t i = 0;
+    while (i < size) {
+        std::size_t length = std::min(size - i, sizeof(chunk));
+        load_bytes(chunk, prefix + i, length);
+        std::size_t common = common_prefix_length(chunk, data + i, length);
+        i += common;
+        if (common < length)
+            break;
+    }
+    return i;
+}
+
+// Finds the child a lookup continues at, or returns false if there is
+// no edge for the byte. The node's header is supplied, and a writer may
+// be changing the edges, which only have to be read from within the
+// node until the version is checked.
+bool read_edge(node n,
+               node header,
+               unsigned char byte,
+               std::size_t& i,
+               node& child)
+{
+    std::size_t count = header.edgecount();
+    std::size_t room = header.capacity();
+    const unsigned char* bytes = n.data_ + header.first_bytes_offset();
+    if (header.node_ptrs_offset() - header.first_bytes_offset() > room) {
+        // The node has a child index.
+        i = load_byte(n.data_ + header.child_index_offset() + byte);
+        if (i >= count || load_byte(bytes + i) != byte)
+            return false;
+    } else {
+        // Small nodes are scanned, up to the first byte that isn't
+        // below the one looked up.
+        unsigned char first[256];
+        assert(count <= sizeof(first));
+        load_bytes(first, bytes, count);
+        i = 0;
+        while (i < count && first[i] < byte)
+            ++i;
+        if (i == count || first[i] != byte)
+            return false;
+    }
+
+    unsigned char* data;
+    load_bytes(reinterpret_cast<unsigned char*>(&data),
+               n.data_ + header.node_ptrs_offset() + i * sizeof(data),
+               sizeof(data));
+    child = node(data);
+    return true;
+}
+
+// The nodes held by a writer, which are released when it goes out of
+// scope.
+class lock_set
+{
+public:
+    lock_set() = default;
+
+    ~lock_set()
+    {
+        // Nodes that were replaced stay locked, which is harmless
+        // since nothing can reach them to lock them again.
+        for (std::size_t i = 0; i < count_; ++i) {
+            node n(nodes_[i]);
+            if (!(version(n).load() & obsolete_bit))
+                version(n).fetch_add(locked_bit); // Carries into the count.
+        }
+    }
+
+    lock_set(lock_set const&) = delete;
+    lock_set& operator=(lock_set const&) = delete;
+
+    // Locks a node, which fails if its version is no longer the one
+    // supplied. Locking a node that is already held succeeds.
+    bool lock(node n, std::uint64_t v)
+    {
+        for (std::size_t i = 0; i < count_; ++i) {
+            if (nodes_[i] == n.data_)
+                return true;
+        }
+        assert(count_ < max_locks);
+        if (!version(n).compare_exchange_strong(v, v | locked_bit))
+            return false;
+        nodes_[count_++] = n.data_;
+        return true;
+    }
+
+    bool holds(node n) const
+    {
+        for (std::size_t i = 0; i < count_; ++i) {
+            if (nodes_[i] == n.data_)
+                return true;
+        }
+        return false;
+    }
+
+    // Locks the child at edge i of a node that is already held.
+    bool lock_child(node n, std::size_t i)
+    {
+        node child = n.node_at(i);
+        std::uint64_t v;
+        return read_version(child, v) && lock(child, v);
+    }
+
+private:
+    // Erasing a key that merges its parent with a sibling touches the
+    // most nodes: the grandparent, parent, node and sibling.
+    static constexpr std::size_t max_locks = 4;
+
+    unsigned char* nodes_[max_locks] = {};
+    std::size_t count_ = 0;
+};
+
+// Copies of the nodes a writer holds, on which radix_tree makes the
+// modification, so that no node a lookup can reach changes through a
+// plain store. Afterwards, the copies still in place are written back
+// into their nodes through store_byte(), and the nodes whose copies
+// were replaced or removed are retired in turn.
+class shadow_set
+{
+public:
+    // Copies come from the versioned allocator, so that radix_tree can
+    // replace them like any other node. Those written back are freed
+    // straight away through the allocator underneath, since no lookup
+    // has seen them.
+    shadow_set(node_allocator& allocator, node_allocator& blocks)
+        : allocator_(allocator)
+        , blocks_(blocks)
+    {}
+
+    shadow_set(shadow_set const&) = delete;
+    shadow_set& operator=(shadow_set const&) = delete;
+
+    // Replaces the nodes of a match that the writer holds with copies.
+    // A node that appears more than once, such as the root, gets a
+    // single copy.
+    match_result copy(match_result result, lock_set const& locks)
+    {
+        for (node* n : {&result.current_node,
+                        &result.parent_node,
+                        &result.grandparent_node}) {
+            if (locks.holds(*n))
+                *n = copy(*n);
+        }
+        return result;
+    }
+
+    // The copy of a node, or the node itself if it wasn't copied.
+    node shadow(node n) const
+    {
+        for (std::size_t i = 0; i < count_; ++i) {
+            if (originals_[i] == n)
+                return copies_[i];
+        }
+        return n;
+    }
+
+    // Writes the copies back, or retires the nodes they were made from,
+    // and points the root supplied at the node it was copied from if it
+    // is one of the copies written back.
+    void publish(node& root)
+    {
+        // Edges to copies written back lead to their nodes instead.
+        for (std::size_t i = 0; i < count_; ++i) {
+            if (!kept(copies_[i]))
+                continue;
+            for (std::size_t k = 0; k < copies_[i].edgecount(); ++k)
+                copies_[i].set_node_at(k, original(copies_[i].node_at(k)));
+        }
+        root = original(root);
+
+        for (std::size_t i = 0; i < count_; ++i) {
+            node o = originals_[i];
+            node c = copies_[i];
+            if (kept(c)) {
+                // A copy changed in place never outgrows its block.
+                std::size_t size = c.size();
+                assert(size <= sizes_[i]);
+                for (std::size_t b = 0; b < size; ++b) {
+                    if (c.data_[b] != o.data_[b])
+                        store_byte(o.data_ + b, c.data_[b]);
+                }
+                blocks_.deallocate(c.data_ - version_size,
+                                   sizes_[i] + version_size);
+            } else {
+                allocator_.deallocate(o.data_, sizes_[i]);
+            }
+        }
+        count_ = 0;
+    }
+
+private:
+    // At most the node, its parent and its grandparent are held.
+    static constexpr std::size_t max_copies = 3;
+
+    node copy(node n)
+    {
+        for (std::size_t i = 0; i < count_; ++i) {
+            if (originals_[i] == n)
+                return copies_[i];
+        }
+        assert(count_ < max_copies);
+        std::size_t size = n.size();
+        node c(allocator_.allocate(size));
+        std::memcpy(c.data_, n.data_, size);
+        originals_[count_] = n;
+        sizes_[count_] = size;
+        copies_[count_++] = c;
+        return c;
+    }
+
+    // Whether radix_tree kept a copy in place rather than replacing or
+    // removing it, which marks the copy obsolete.
+    static bool kept(node c)
+    {
+        return !(version(c).load() & obsolete_bit);
+    }
+
+    node original(node n) const
+    {
+        for (std::size_t i = 0; i < count_; ++i) {
+            if (copies_[i] == n && kept(n))
+                return originals_[i];
+        }
+        return n;
+    }
+
+    node_allocator& allocator_;
+    node_allocator& blocks_;
+    node originals_[max_copies] = {node(nullptr), node(nullptr),
+                                   node(nullptr)};
+    node copies_[max_copies] = {node(nullptr), node(nullptr), node(nullptr)};
+    std::size_t sizes_[max_copies] = {0, 0, 0};
+    std::size_t count_ = 0;
+};
+
+// What radix_tree::match() returns, with the versions the nodes had.
+// If a writer got in the way, valid is false and the walk has to start
+// over.
+struct olc_match
+{
+    bool valid;
+    match_result result;
+    std::uint64_t current_version;
+    std::uint64_t parent_version;
+    std::uint64_t grandparent_version;
+    // Read from the current node along with its version.
+    std::uint32_t prefix_length;
+    std::uint32_t refcount;
+};
+
+// Walks the tree like radix_tree::match() without locking anything.
+olc_match optimistic_match(node root,
+                           const unsigned char* key,
+                           std::size_t size)
+{
+    olc_match restart{false, match_result{0, 0, 0, 0, root, root, root},
+                      0, 0, 0, 0, 0};
+    std::uint64_t v;
+    if (!read_version(root, v))
+        return restart;
+
+    std::size_t i = 0;
+    std::size_t j = 0;
+    std::size_t edge_idx = 0;
+    std::size_t gp_edge_idx = 0;
+    node current_node = root;
+    node parent_node = root;
+    node grandparent_node = root;
+    std::uint64_t parent_version = v;
+    std::uint64_t grandparent_version = v;
+    unsigned char header[node::header_size];
+
+    while (true) {
+        // The header is checked before it is relied on, while the
+        // prefix and the edges can change at any time until the version
+        // is checked again.
+        if (!read_header(current_node, v, header))
+            return restart;
+        std::uint32_t prefix_length = node(header).prefix_length();
+        j = match_prefix(current_node,
+                         node(header),
+                         key + i,
+                         std::min<std::size_t>(prefix_length, size - i));
+        i += j;
+        if (j != prefix_length || i == size)
+            break;
+
+        std::size_t k;
+        node child = current_node;
+        if (!read_edge(current_node, node(header), key[i], k, child))
+            break;
+        if (!validate(current_node, v))
+            return restart;
+
+        std::uint64_t child_version;
+        if (!read_version(child, child_version))
+            return restart;
+        gp_edge_idx = edge_idx;
+        edge_idx = k;
+        grandparent_node = parent_node;
+        grandparent_version = parent_version;
+        parent_node = current_node;
+        parent_version = v;
+        current_node = child;
+        v = child_version;
+    }
+
+    if (!validate(current_node, v))
+        return restart;
+    return olc_match{true,
+                     match_result{i, j, edge_idx, gp_edge_idx, current_node,
+                                  parent_node, grandparent_node},
+                     v, parent_version, grandparent_version,
+                     node(header).prefix_length(), node(header).refcount()};
+}
+
+// Works like radix_tree::any_prefix_of(), returning false if it has
+// to start over.
+bool optimistic_any_prefix_of(node root,
+                              const unsigned char* data,
+                              std::size_t size,
+                              bool& found)
+{
+    std::uint64_t v;
+    if (!read_version(root, v))
+        return false;
+
+    std::size_t i = 0;
+    node current_node = root;
+    unsigned char header[node::header_size];
+
+    while (true) {
+        if (!read_header(current_node, v, header))
+            return false;
+        std::uint32_t prefix_length = node(header).prefix_length();
+        if (size - i < prefix_length
+            || match_prefix(current_node, node(header), data + i,
+                            prefix_length) != prefix_length) {
+            found = false;
+            break;
+        }
+        i += prefix_length;
+
+        found = node(header).refcount() > 0;
+        if (found || i == size)
+            break;
+        std::size_t k;
+        node child = current_node;
+        if (!read_edge(current_node, node(header), data[i], k, child))
+            break;
+        if (!validate(current_node, v))
+            return false;
+        if (!read_version(child, v))
+            return false;
+        current_node = child;
+    }
+
+    return validate(current_node, v);
+}
+
+void free_nodes(node_allocator& allocator, node root)
+{
+    std::vector<node> stack{root};
+    while (!stack.empty()) {
+        node n = stack.back();
+        stack.pop_back();
+        for (std::size_t i = 0; i < n.edgecount(); ++i)
+            stack.push_back(n.node_at(i));
+        allocator.deallocate(n.data_ - version_size,
+                             n.size() + version_size);
+    }
+}
+
+}
+
+olc_radix_tree::versioned_allocator::versioned_allocator(
+    node_allocator& allocator)
+    : allocator_(&allocator)
+{}
+
+unsigned char* olc_radix_tree::versioned_allocator::allocate(std::size_t size)
+{
+    unsigned char* data = allocator_->allocate(size + version_size);
+    new (data) std::atomic<std::uint64_t>(0);
+    return data + version_size;
+}
+
+void olc_radix_tree::versioned_allocator::deallocate(unsigned char* data,
+                                                     std::size_t size)
+{
+    // Lookups that still hold the node will start over when they next
+    // check its version.
+    version(node(data)).fetch_or(obsolete_bit);
+    deallocated.push_back(block{data - version_size, size + version_size, 0});
+}
+
+// ----------------------------------------------------------------------
+
+olc_radix_tree::olc_radix_tree()
+    : olc_radix_tree(default_node_allocator())
+{}
+
+olc_radix_tree::olc_radix_tree(node_allocator& allocator)
+    : allocator_(&allocator)
+    , root_(nullptr)
+    , size_(0)
+    , reclaim_limit_(reclaim_threshold)
+{
+    versioned_allocator versioned(allocator);
+    root_.store(make_node(versioned, 0, 0, 0).data_);
+}
+
+olc_radix_tree::~olc_radix_tree()
+{
+    free_nodes(*allocator_, node(root_.load()));
+    for (block const& b : retired_)
+        allocator_->deallocate(b.data, b.size);
+}
+
+void olc_radix_tree::retire(std::vector<block>& blocks)
+{
+    if (blocks.empty())
+        return;
+
+    // The nodes were unlinked before their writer released its locks,
+    // so a reader that can still reach them has announced an epoch no
+    // later than the one read here.
+    std::uint64_t epoch = advance_epoch();
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    for (block& b : blocks) {
+        b.epoch = epoch;
+        retired_.push_back(b);
+    }
+    if (retired_.size() < reclaim_limit_)
+        return;
+
+    // Writers retire blocks concurrently, so they aren't in epoch
+    // order.
+    std::uint64_t oldest = oldest_active_epoch();
+    std::size_t kept = 0;
+    for (block const& b : retired_) {
+        if (b.epoch < oldest)
+            allocator_->deallocate(b.data, b.size);
+        else
+            retired_[kept++] = b;
+    }
+    retired_.resize(kept);
+
+    // A reader that stays in its read section for a while keeps blocks
+    // from being freed, so wait for the list to grow before scanning it
+    // again.
+    reclaim_limit_ = kept < reclaim_threshold / 2 ? reclaim_threshold
+                                                  : 2 * kept;
+}
+
+bool olc_radix_tree::try_insert(versioned_allocator& allocator,
+                                const unsigned char* key,
+                                std::size_t size,
+                                bool& inserted)
+{
+    olc_match m = optimistic_match(node(root_.load()), key, size);
+    if (!m.valid)
+        return false;
+    match_result const& result = m.result;
+    node current_node = result.current_node;
+
+    lock_set locks;
+    if (!locks.lock(current_node, m.current_version))
+        return false;
+
+    // The current node is replaced when it is split or when it has no
+    // room for another edge, in which case the parent's edge to it has
+    // to be updated as well. The root has no parent, but then the
+    // parent is the root itself.
+    bool found = result.nkey == size
+                 && result.nprefix == current_node.prefix_length();
+    bool adds_edge = result.nkey != size
+                     && (result.nkey == 0
+                         || result.nprefix == current_node.prefix_length());
+    bool moves = !found
+                 && !(adds_edge
+                      && current_node.edgecount() < current_node.capacity());
+    if (moves && !locks.lock(result.parent_node, m.parent_version))
+        return false;
+
+    // The root only changes when the writer holding it replaces it.
+    node root(root_.load());
+    unsigned char* old_root = root.data_;
+    shadow_set shadows(allocator, *allocator_);
+    match_result shadowed = shadows.copy(result, locks);
+    root = shadows.shadow(root);
+    inserted = radix_tree::insert_at(allocator, root, shadowed, key, size);
+    shadows.publish(root);
+    if (root.data_ != old_root)
+        root_.store(root.data_);
+    return true;
+}
+
+bool olc_radix_tree::try_erase(versioned_allocator& allocator,
+                               const unsigned char* key,
+                               std::size_t size,
+                               bool& erased)
+{
+    olc_match m = optimistic_match(node(root_.load()), key, size);
+    if (!m.valid)
+        return false;
+    match_result const& result = m.result;
+    node current_node = result.current_node;
+    node parent_node = result.parent_node;
+
+    if (result.nkey != size || result.nprefix != m.prefix_length
+        || m.refcount == 0) {
+        erased = false;
+        return true;
+    }
+
+    lock_set locks;
+    if (!locks.lock(current_node, m.current_version))
+        return false;
+
+    // The current node can't change any more, so we can tell which
+    // other nodes erase_at() is going to touch.
+    if (current_node.refcount() == 1 && current_node.edgecount() < 2) {
+        if (!locks.lock(parent_node, m.parent_version))
+            return false;
+        if (current_node.edgecount() == 1) {
+            // The child is merged into the current node.
+            if (!locks.lock_child(current_node, 0))
+                return false;
+        } else {
+            // The current node is removed from the parent, which may
+            // move the parent or merge it with the other child.
+            if (!locks.lock(result.grandparent_node, m.grandparent_version))
+                return false;
+            if (parent_node.edgecount() == 2 && parent_node.refcount() == 0
+                && parent_node.prefix_length() > 0
+                && !locks.lock_child(parent_node, !result.edge_index))
+                return false;
+        }
+    }
+
+    node root(root_.load());
+    unsigned char* old_root = root.data_;
+    shadow_set shadows(allocator, *allocator_);
+    match_result shadowed = shadows.copy(result, locks);
+    root = shadows.shadow(root);
+    erased = radix_tree::erase_at(allocator, root, shadowed, size);
+    assert(erased);
+    shadows.publish(root);
+    if (root.data_ != old_root)
+        root_.store(root.data_);
+    return true;
+}
+
+bool olc_radix_tree::insert(const unsigned char* key, std::size_t size)
+{
+    assert(key);
+    assert(size > 0);
+
+    versioned_allocator allocator(*allocator_);
+    bool inserted = false;
+    {
+        read_section section;
+        while (!try_insert(allocator, key, size, inserted))
+            std::this_thread::yield();
+    }
+    retire(allocator.deallocated);
+    size_.fetch_add(1, std::memory_order_relaxed);
+    return inserted;
+}
+
+bool olc_radix_tree::erase(const unsigned char* key, std::size_t size)
+{
+    assert(key);
+    assert(size > 0);
+
+    versioned_allocator allocator(*allocator_);
+    bool erased = false;
+    {
+        read_section section;
+        while (!try_erase(allocator, key, size, erased))
+            std::this_thread::yield();
+    }
+    retire(allocator.deallocated);
+    if (erased)
+        size_.fetch_sub(1, std::memory_order_relaxed);
+    return erased;
+}
+
+bool olc_radix_tree::contains(const unsigned char* key,
+                              std::size_t size) const
+{
+    assert(key);
+
+    read_section section;
+    while (true) {
+        olc_match m = optimistic_match(node(root_.load()), key, size);
+        if (m.valid) {
+            return m.result.nkey == size
+                   && m.result.nprefix == m.prefix_length
+                   && m.refcount > 0;
+        }
+        std::this_thread::yield();
+    }
+}
+
+bool olc_radix_tree::any_prefix_of(const unsigned char* data,
+                                   std::size_t size) const
+{
+    assert(data);
+
+    read_section section;
+    bool found = false;
+    while (!optimistic_any_prefix_of(node(root_.load()), data, size, found))
+        std::this_thread::yield();
+    return found;
+}
+
+std::size_t olc_radix_tree::size() const
+{
+    return size_.load(std::memory_order_relaxed);
+}
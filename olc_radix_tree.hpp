@@ -0,0 +1,103 @@
+#ifndef OLC_RADIX_TREE_HPP
+#define OLC_RADIX_TREE_HPP
+
+#include "node_allocator.hpp"
+#include "radix_tree.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// A radix tree that any number of threads can modify and read at once,
+// using optimistic lock coupling.
+//
+// Every node is preceded by a version word. Lookups, including the one
+// each modification starts with, take no locks: they note the version
+// of a node before reading it and check that it hasn't changed before
+// relying on what they read, starting over from the root if it has.
+// A writer then locks only the nodes its modification touches, by
+// moving each of them from the version it saw to a locked state, so
+// modifications to different parts of the tree proceed in parallel.
+// Locking never waits, so writers can't deadlock; a writer that finds
+// a node locked or changed releases its locks and starts over.
+//
+// Writers modify copies of the nodes they hold and write the bytes that
+// changed back with atomic stores, and lookups read nodes with atomic
+// loads, so a lookup racing with a writer reads stale bytes rather
+// than undefined ones before its version check sends it back.
+//
+// Nodes replaced or removed by a writer are marked obsolete, which
+// sends lookups still holding them back to the root, and are reclaimed
+// through the same epochs as concurrent_radix_tree.
+class olc_radix_tree
+{
+public:
+    olc_radix_tree();
+    // The allocator has to be safe to call from several threads at once,
+    // as malloc_allocator is, and has to outlive the tree.
+    explicit olc_radix_tree(node_allocator& allocator);
+    // No other thread may be using the tree at this point.
+    ~olc_radix_tree();
+
+    olc_radix_tree(olc_radix_tree const&) = delete;
+    olc_radix_tree& operator=(olc_radix_tree const&) = delete;
+
+    // These have the same semantics as the radix_tree functions of the
+    // same name, and may all run concurrently with each other.
+    bool insert(const unsigned char* key, std::size_t size);
+    bool erase(const unsigned char* key, std::size_t size);
+    bool contains(const unsigned char* key, std::size_t size) const;
+    bool any_prefix_of(const unsigned char* data, std::size_t size) const;
+    std::size_t size() const;
+
+private:
+    struct block
+    {
+        unsigned char* data; // Start of the version word.
+        std::size_t size;
+        std::uint64_t epoch;
+    };
+
+    // Allocates nodes with a version word in front of them for a single
+    // modification. Deallocated nodes are marked obsolete and collected
+    // until the modification is over and they can be retired.
+    class versioned_allocator : public node_allocator
+    {
+    public:
+        explicit versioned_allocator(node_allocator& allocator);
+
+        unsigned char* allocate(std::size_t size) override;
+        void deallocate(unsigned char* data, std::size_t size) override;
+
+        std::vector<block> deallocated;
+
+    private:
+        node_allocator* allocator_;
+    };
+
+    // Make a single attempt at a modification, returning false if a
+    // writer got in the way and the attempt has to be repeated.
+    bool try_insert(versioned_allocator& allocator,
+                    const unsigned char* key,
+                    std::size_t size,
+                    bool& inserted);
+    bool try_erase(versioned_allocator& allocator,
+                   const unsigned char* key,
+                   std::size_t size,
+                   bool& erased);
+
+    // Tags the blocks supplied with a new epoch and frees those that no
+    // reader can reach any more.
+    void retire(std::vector<block>& blocks);
+
+    node_allocator* allocator_;
+    std::atomic<unsigned char*> root_;
+    std::atomic<std::size_t> size_;
+    std::mutex retired_mutex_;
+    std::vector<block> retired_;
+    std::size_t reclaim_limit_; // Size of retired_ that triggers a scan.
+};
+
+#endif
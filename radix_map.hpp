@@ -0,0 +1,313 @@
+#ifndef RADIX_MAP_HPP
+#define RADIX_MAP_HPP
+
+#include "node_allocator.hpp"
+#include "radix_tree.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// A radix tree that maps each key to a value of type T.
+//
+// Every node has a slot for the value of the key it holds, so the walk
+// that finds a key finds its value too. Values of small, trivially
+// copyable types are stored in the slot itself. Other values are
+// allocated separately and the slot holds a pointer to them.
+//
+// Unlike radix_tree, the map holds each key at most once. Nodes move
+// when they are split, merged or resized, so values stored in the
+// slots move with them: a modification of the map invalidates all
+// references to its values.
+template <typename T>
+class radix_map
+{
+public:
+    radix_map();
+    // Stores the map's nodes using the allocator supplied, which has to
+    // outlive the map.
+    explicit radix_map(node_allocator& allocator);
+    ~radix_map();
+
+    radix_map(radix_map const&) = delete;
+    radix_map& operator=(radix_map const&) = delete;
+
+    // Returns the value of the key, or nullptr if the map doesn't hold
+    // the key.
+    T* find(const unsigned char* key, std::size_t size);
+    const T* find(const unsigned char* key, std::size_t size) const;
+
+    // Sets the value of the key, adding the key if the map doesn't hold
+    // it yet, and returns the value as stored in the map.
+    T& insert_or_assign(const unsigned char* key,
+                        std::size_t size,
+                        T const& value);
+
+    // Returns true if the key was actually removed from the map.
+    bool erase(const unsigned char* key, std::size_t size);
+
+    // Returns the value of the longest key in the map that is a prefix
+    // of the data supplied, or nullptr if there is none, and stores the
+    // length of that key in *length unless length is nullptr.
+    T* longest_prefix(const unsigned char* data,
+                      std::size_t size,
+                      std::size_t* length = nullptr);
+    const T* longest_prefix(const unsigned char* data,
+                            std::size_t size,
+                            std::size_t* length = nullptr) const;
+
+    // Applies the function supplied to each key in the map that is a
+    // prefix of the data supplied, shortest key first, along with its
+    // value. The function receives the data along with the length of
+    // the matching key.
+    void match_prefixes(const unsigned char* data,
+                        std::size_t size,
+                        void (*func)(const unsigned char* data,
+                                     std::size_t size,
+                                     T& value,
+                                     void* arg),
+                        void* arg);
+    void match_prefixes(const unsigned char* data,
+                        std::size_t size,
+                        void (*func)(const unsigned char* data,
+                                     std::size_t size,
+                                     T const& value,
+                                     void* arg),
+                        void* arg) const;
+
+    std::size_t size() const;
+
+private:
+    static constexpr bool is_inline =
+        std::is_trivially_copyable<T>::value
+        && sizeof(T) <= sizeof(void*)
+        && alignof(T) <= alignof(void*);
+    static constexpr std::size_t slot_size = is_inline ? sizeof(T)
+                                                       : sizeof(T*);
+
+    // Returns the value held by a node holding a key.
+    static T* value_at(node n);
+    // Returns true if the match ended at the node holding the key.
+    static bool holds_key(const match_result& result, std::size_t size);
+    // Calls visit(i, n) for each node n holding a key that is a prefix
+    // of the data, where i is the length of the key.
+    template <typename Visit>
+    static void visit_prefixes(node root,
+                               const unsigned char* data,
+                               std::size_t size,
+                               Visit visit);
+
+    radix_tree tree_;
+};
+
+template <typename T>
+radix_map<T>::radix_map()
+    : radix_map(default_node_allocator())
+{}
+
+template <typename T>
+radix_map<T>::radix_map(node_allocator& allocator)
+    : tree_(allocator, slot_size)
+{}
+
+template <typename T>
+radix_map<T>::~radix_map()
+{
+    if (is_inline)
+        return;
+
+    // The tree frees the nodes, but the values they point to are ours.
+    std::vector<node> stack{tree_.root_};
+    while (!stack.empty()) {
+        node n = stack.back();
+        stack.pop_back();
+        if (n.refcount() > 0)
+            delete value_at(n);
+        for (std::size_t i = 0; i < n.edgecount(); ++i)
+            stack.push_back(n.node_at(i));
+    }
+}
+
+template <typename T>
+T* radix_map<T>::value_at(node n)
+{
+    assert(n.refcount() > 0);
+
+    if (is_inline)
+        return reinterpret_cast<T*>(n.value());
+    T* value;
+    std::memcpy(&value, n.value(), sizeof(value));
+    return value;
+}
+
+template <typename T>
+bool radix_map<T>::holds_key(const match_result& result, std::size_t size)
+{
+    node current_node = result.current_node;
+    return result.nkey == size
+        && result.nprefix == current_node.prefix_length()
+        && current_node.refcount() > 0;
+}
+
+template <typename T>
+T* radix_map<T>::find(const unsigned char* key, std::size_t size)
+{
+    match_result result = radix_tree::match(tree_.root_, key, size);
+    return holds_key(result, size) ? value_at(result.current_node)
+                                   : nullptr;
+}
+
+template <typename T>
+const T* radix_map<T>::find(const unsigned char* key, std::size_t size) const
+{
+    match_result result = radix_tree::match(tree_.root_, key, size);
+    return holds_key(result, size) ? value_at(result.current_node)
+                                   : nullptr;
+}
+
+template <typename T>
+T& radix_map<T>::insert_or_assign(const unsigned char* key,
+                                  std::size_t size,
+                                  T const& value)
+{
+    match_result result = radix_tree::match(tree_.root_, key, size);
+    if (holds_key(result, size)) {
+        T* stored = value_at(result.current_node);
+        *stored = value;
+        return *stored;
+    }
+
+    // Copy the value before touching the tree, so that a throwing copy
+    // leaves the map as it was. The map doesn't offer count_prefix(),
+    // so the walk above doesn't bother with the subtree counts.
+    T* copy = is_inline ? nullptr : new T(value);
+    node holder = tree_.root_;
+    radix_tree::insert_at(tree_.allocator_,
+                          tree_.root_,
+                          result,
+                          key,
+                          size,
+                          &holder);
+    ++tree_.size_;
+
+    if (is_inline)
+        return *new (holder.value()) T(value);
+    std::memcpy(holder.value(), &copy, sizeof(copy));
+    return *copy;
+}
+
+template <typename T>
+bool radix_map<T>::erase(const unsigned char* key, std::size_t size)
+{
+    match_result result = radix_tree::match(tree_.root_, key, size);
+    if (!holds_key(result, size))
+        return false;
+
+    if (!is_inline)
+        delete value_at(result.current_node);
+    radix_tree::erase_at(tree_.allocator_, tree_.root_, result, size);
+    --tree_.size_;
+    return true;
+}
+
+template <typename T>
+T* radix_map<T>::longest_prefix(const unsigned char* data,
+                                std::size_t size,
+                                std::size_t* length)
+{
+    node holder = tree_.root_;
+    std::size_t found =
+        radix_tree::longest_prefix(tree_.root_, data, size, &holder);
+    if (found == 0)
+        return nullptr;
+    if (length)
+        *length = found;
+    return value_at(holder);
+}
+
+template <typename T>
+const T* radix_map<T>::longest_prefix(const unsigned char* data,
+                                      std::size_t size,
+                                      std::size_t* length) const
+{
+    node holder = tree_.root_;
+    std::size_t found =
+        radix_tree::longest_prefix(tree_.root_, data, size, &holder);
+    if (found == 0)
+        return nullptr;
+    if (length)
+        *length = found;
+    return value_at(holder);
+}
+
+template <typename T>
+template <typename Visit>
+void radix_map<T>::visit_prefixes(node root,
+                                  const unsigned char* data,
+                                  std::size_t size,
+                                  Visit visit)
+{
+    assert(data);
+
+    // This follows radix_tree::match_prefixes().
+    std::size_t i = 0; // Number of characters matched in data.
+    node current_node = root;
+
+    while (true) {
+        std::uint32_t prefix_length = current_node.prefix_length();
+        if (size - i < prefix_length
+            || std::memcmp(current_node.prefix(), data + i, prefix_length))
+            return;
+        i += prefix_length;
+
+        if (current_node.refcount() > 0)
+            visit(i, current_node);
+        if (i == size)
+            return;
+
+        std::size_t k = current_node.find_edge(data[i]);
+        if (k == current_node.edgecount())
+            return; // No outgoing edge.
+        current_node = current_node.node_at(k);
+    }
+}
+
+template <typename T>
+void radix_map<T>::match_prefixes(const unsigned char* data,
+                                  std::size_t size,
+                                  void (*func)(const unsigned char* data,
+                                               std::size_t size,
+                                               T& value,
+                                               void* arg),
+                                  void* arg)
+{
+    visit_prefixes(tree_.root_, data, size, [&](std::size_t i, node n) {
+        func(data, i, *value_at(n), arg);
+    });
+}
+
+template <typename T>
+void radix_map<T>::match_prefixes(const unsigned char* data,
+                                  std::size_t size,
+                                  void (*func)(const unsigned char* data,
+                                               std::size_t size,
+                                               T const& value,
+                                               void* arg),
+                                  void* arg) const
+{
+    visit_prefixes(tree_.root_, data, size, [&](std::size_t i, node n) {
+        func(data, i, *value_at(n), arg);
+    });
+}
+
+template <typename T>
+std::size_t radix_map<T>::size() const
+{
+    return tree_.size();
+}
+
+#endif
@@ -1,17 +1,73 @@
 #include "radix_tree.hpp"
+#include "node_allocator.hpp"
+#include "snapshot.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <utility>
 #include <vector>
 
+// Nodes are searched with SSE2 where the compiler targets it, unless
+// RADIX_TREE_NO_SIMD asks for the portable code, which the tests build
+// to cover it on machines that have SSE2.
+#if defined(__SSE2__) && !defined(RADIX_TREE_NO_SIMD)
+#define RADIX_TREE_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+constexpr std::size_t node::header_size;
+constexpr std::size_t node::max_inline_prefix;
+constexpr std::uint32_t node::max_inline_refcount;
+
 node::node(unsigned char* data)
     : data_(data)
+    , inline_(false)
 {}
 
+node node::inline_leaf(unsigned char* slot)
+{
+    node n(slot);
+    n.inline_ = true;
+    return n;
+}
+
+bool node::is_inline() const
+{
+    return inline_;
+}
+
+// The tag of a leaf held in a pointer slot takes the byte that holds
+// the low bits of a pointer, and the prefix takes the rest of the slot.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+static constexpr std::size_t inline_tag_offset = sizeof(void*) - 1;
+static constexpr std::size_t inline_prefix_offset = 0;
+#else
+static constexpr std::size_t inline_tag_offset = 0;
+static constexpr std::size_t inline_prefix_offset = 1;
+#endif
+static constexpr unsigned char inline_flag = 0x01;
+static constexpr unsigned char inline_length_mask = 0x0e;
+static constexpr unsigned inline_length_shift = 1;
+static constexpr unsigned inline_refcount_shift = 4;
+
+static_assert(node::max_inline_prefix << inline_length_shift
+                  <= inline_length_mask,
+              "the prefix length of an inline leaf must fit in its tag");
+
+// Whether a block can hold a node, whose address must not look like an
+// inline leaf when it is stored in a pointer slot.
+static bool holds_node(const unsigned char* data)
+{
+    return !(reinterpret_cast<std::uintptr_t>(data) & inline_flag);
+}
+
 std::uint32_t node::refcount()
 {
+    if (inline_)
+        return data_[inline_tag_offset] >> inline_refcount_shift;
     std::uint32_t u32;
     std::memcpy(&u32, data_, sizeof(u32));
     return u32;
@@ -19,11 +75,22 @@ std::uint32_t node::refcount()
 
 void node::set_refcount(std::uint32_t value)
 {
+    if (inline_) {
+        assert(value <= max_inline_refcount);
+        unsigned char& tag = data_[inline_tag_offset];
+        tag = static_cast<unsigned char>(
+            (tag & (inline_flag | inline_length_mask))
+            | value << inline_refcount_shift);
+        return;
+    }
     std::memcpy(data_, &value, sizeof(value));
 }
 
 std::uint32_t node::prefix_length()
 {
+    if (inline_)
+        return (data_[inline_tag_offset] & inline_length_mask)
+            >> inline_length_shift;
     std::uint32_t u32;
     std::memcpy(&u32, data_ + sizeof(std::uint32_t), sizeof(u32));
     return u32;
@@ -31,11 +98,20 @@ std::uint32_t node::prefix_length()
 
 void node::set_prefix_length(std::uint32_t value)
 {
+    if (inline_) {
+        assert(value > 0 && value <= max_inline_prefix);
+        unsigned char& tag = data_[inline_tag_offset];
+        tag = static_cast<unsigned char>(
+            (tag & ~inline_length_mask) | value << inline_length_shift);
+        return;
+    }
     std::memcpy(data_ + sizeof(value), &value, sizeof(value));
 }
 
 std::uint32_t node::edgecount()
 {
+    if (inline_)
+        return 0;
     std::uint32_t u32;
     std::memcpy(&u32, data_ + 2 * sizeof(std::uint32_t), sizeof(u32));
     return u32;
@@ -43,27 +119,180 @@ std::uint32_t node::edgecount()
 
 void node::set_edgecount(std::uint32_t value)
 {
+    assert(!inline_);
     std::memcpy(data_ + 2 * sizeof(value), &value, sizeof(value));
 }
 
+// The top bit of the capacity marks a node whose prefix is held
+// elsewhere. Capacities never go past 256.
+static constexpr std::uint16_t external_prefix_flag = 0x8000;
+
+static std::uint16_t capacity_bits(unsigned char* data)
+{
+    std::uint16_t u16;
+    std::memcpy(&u16, data + 3 * sizeof(std::uint32_t), sizeof(u16));
+    return u16;
+}
+
+static void set_capacity_bits(unsigned char* data, std::uint16_t u16)
+{
+    std::memcpy(data + 3 * sizeof(std::uint32_t), &u16, sizeof(u16));
+}
+
+std::uint32_t node::capacity()
+{
+    if (inline_)
+        return 0;
+    return capacity_bits(data_) & ~external_prefix_flag;
+}
+
+void node::set_capacity(std::uint32_t value)
+{
+    assert(!inline_);
+    auto flag = capacity_bits(data_) & external_prefix_flag;
+    set_capacity_bits(data_, static_cast<std::uint16_t>(value | flag));
+}
+
+bool node::prefix_is_external()
+{
+    if (inline_)
+        return false;
+    return (capacity_bits(data_) & external_prefix_flag) != 0;
+}
+
+std::uint32_t node::value_size()
+{
+    if (inline_)
+        return 0;
+    std::uint16_t u16;
+    std::memcpy(&u16,
+                data_ + 3 * sizeof(std::uint32_t) + sizeof(u16),
+                sizeof(u16));
+    return u16;
+}
+
+void node::set_value_size(std::uint32_t value)
+{
+    assert(!inline_);
+    auto u16 = static_cast<std::uint16_t>(value);
+    std::memcpy(data_ + 3 * sizeof(value) + sizeof(u16), &u16, sizeof(u16));
+}
+
+std::uint32_t node::subtree_count()
+{
+    if (inline_)
+        return refcount();
+    std::uint32_t u32;
+    std::memcpy(&u32, data_ + 4 * sizeof(std::uint32_t), sizeof(u32));
+    return u32;
+}
+
+void node::set_subtree_count(std::uint32_t value)
+{
+    // A leaf held in a pointer slot counts its key and nothing else,
+    // which its reference count already does.
+    if (inline_)
+        return;
+    std::memcpy(data_ + 4 * sizeof(value), &value, sizeof(value));
+}
+
+// Values start at the first offset past the header that is aligned for
+// a pointer, so that radix_map can hand out references to them.
+static constexpr std::size_t value_offset =
+    (node::header_size + alignof(void*) - 1) / alignof(void*)
+    * alignof(void*);
+
+static std::size_t value_chunk_size(std::size_t value_size)
+{
+    return value_size > 0 ? value_offset - node::header_size + value_size
+                          : 0;
+}
+
+unsigned char* node::value()
+{
+    assert(value_size() > 0);
+    return data_ + value_offset;
+}
+
+void node::copy_value(node other)
+{
+    assert(value_size() == other.value_size());
+    if (value_size() > 0)
+        std::memcpy(value(), other.value(), value_size());
+}
+
+unsigned char* node::prefix_chunk()
+{
+    return data_ + prefix_chunk_offset();
+}
+
+std::size_t node::prefix_chunk_offset()
+{
+    if (inline_)
+        return inline_prefix_offset;
+    return header_size + value_chunk_size(value_size());
+}
+
+std::size_t node::prefix_chunk_size()
+{
+    return prefix_is_external() ? sizeof(unsigned char*) : prefix_length();
+}
+
 unsigned char* node::prefix()
 {
-    return data_ + 3 * sizeof(std::uint32_t);
+    unsigned char* chunk = prefix_chunk();
+    if (!prefix_is_external())
+        return chunk;
+    unsigned char* bytes;
+    std::memcpy(&bytes, chunk, sizeof(bytes));
+    return bytes;
 }
 
 void node::set_prefix(unsigned char const* bytes)
 {
+    assert(!prefix_is_external());
     std::memcpy(prefix(), bytes, prefix_length());
 }
 
+void node::set_external_prefix(unsigned char const* bytes)
+{
+    assert(!inline_);
+    // Nothing writes to the prefix of a node that holds it elsewhere,
+    // so the bytes are never modified through the pointer.
+    auto* data = const_cast<unsigned char*>(bytes);
+    set_capacity_bits(data_, capacity_bits(data_) | external_prefix_flag);
+    std::memcpy(prefix_chunk(), &data, sizeof(data));
+}
+
+// Nodes with room for more edges than this keep a child index after
+// the chunk of first bytes, and nodes with at most linear_search_limit
+// edges are searched one byte at a time.
+static constexpr std::size_t vector_search_limit = 16;
+static constexpr std::size_t linear_search_limit = 4;
+
+static std::size_t child_index_size(std::size_t capacity)
+{
+    return capacity > vector_search_limit ? 256 : 0;
+}
+
+// The prefix chunk holds either the prefix or a pointer to it.
+static std::size_t node_size(std::size_t prefix_chunk_size,
+                             std::size_t capacity,
+                             std::size_t value_size)
+{
+    return node::header_size + value_chunk_size(value_size)
+        + prefix_chunk_size + capacity + child_index_size(capacity)
+        + capacity * sizeof(void*);
+}
+
 unsigned char* node::first_bytes()
 {
-    return prefix() + prefix_length();
+    return data_ + first_bytes_offset();
 }
 
-void node::set_first_bytes(unsigned char const* bytes)
+std::size_t node::first_bytes_offset()
 {
-    std::memcpy(first_bytes(), bytes, edgecount());
+    return prefix_chunk_offset() + prefix_chunk_size();
 }
 
 unsigned char node::first_byte_at(std::size_t i)
@@ -76,33 +305,217 @@ void node::set_first_byte_at(std::size_t i, unsigned char byte)
 {
     assert(i < edgecount());
     first_bytes()[i] = byte;
+    if (capacity() > vector_search_limit)
+        child_index()[byte] = static_cast<unsigned char>(i);
+}
+
+unsigned char* node::child_index()
+{
+    return data_ + child_index_offset();
+}
+
+std::size_t node::child_index_offset()
+{
+    assert(capacity() > vector_search_limit);
+    return first_bytes_offset() + capacity();
 }
 
 unsigned char* node::node_ptrs()
 {
-    return prefix() + prefix_length() + edgecount();
+    return data_ + node_ptrs_offset();
 }
 
-void node::set_node_ptrs(unsigned char const* ptrs)
+std::size_t node::node_ptrs_offset()
 {
-    std::memcpy(node_ptrs(), ptrs, edgecount() * sizeof(void*));
+    std::size_t room = capacity();
+    return first_bytes_offset() + room + child_index_size(room);
 }
 
 node node::node_at(std::size_t i)
 {
     assert(i < edgecount());
 
+    unsigned char* slot = node_ptrs() + i * sizeof(void*);
     unsigned char* data;
-    std::memcpy(&data, node_ptrs() + i * sizeof(void*), sizeof(data));
+    std::memcpy(&data, slot, sizeof(data));
+    if (!holds_node(data))
+        return inline_leaf(slot);
     return node(data);
 }
 
+#if defined(RADIX_TREE_USE_SSE2)
+static std::size_t count_trailing_zeros(unsigned int mask)
+{
+    assert(mask != 0);
+    return static_cast<std::size_t>(__builtin_ctz(mask));
+}
+#endif
+
+std::size_t node::find_edge(unsigned char byte)
+{
+    std::size_t count = edgecount();
+    std::size_t room = capacity();
+    const unsigned char* bytes = first_bytes();
+
+    if (room > vector_search_limit) {
+        // The child index maps each byte to an edge index. Entries for
+        // bytes without an edge are stale or zero, so the index is only
+        // trusted if the first byte at that index agrees with it.
+        std::size_t i = bytes[room + byte];
+        return i < count && bytes[i] == byte ? i : count;
+    }
+
+#if defined(RADIX_TREE_USE_SSE2)
+    if (count > linear_search_limit) {
+        // The node pointers follow the first bytes, so there are always
+        // at least 16 readable bytes here. Bits for the bytes past the
+        // last edge are masked off.
+        __m128i needle = _mm_set1_epi8(static_cast<char>(byte));
+        __m128i chunk = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(bytes));
+        auto mask = static_cast<unsigned int>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+        mask &= (1u << count) - 1;
+        return mask != 0 ? count_trailing_zeros(mask) : count;
+    }
+#endif
+
+    if (count > linear_search_limit) {
+        std::size_t i = rank(byte);
+        return i < count && bytes[i] == byte ? i : count;
+    }
+
+    // The edges are sorted, so the scan stops at the first byte that
+    // isn't below the one we're looking for.
+    for (std::size_t i = 0; i < count; ++i) {
+        if (bytes[i] >= byte)
+            return bytes[i] == byte ? i : count;
+    }
+    return count;
+}
+
+std::size_t node::rank(unsigned char byte)
+{
+    std::size_t count = edgecount();
+    const unsigned char* bytes = first_bytes();
+
+#if defined(RADIX_TREE_USE_SSE2)
+    if (count > linear_search_limit) {
+        // SSE2 only compares signed bytes, so the top bit of each side
+        // is flipped to keep the unsigned order. The edges are sorted,
+        // so the bytes below the one supplied are the low bits of the
+        // mask, and the first vector that isn't all below it holds the
+        // rank. The first bytes are followed by the child index or by
+        // the node pointers, so whole vectors can be loaded, and bytes
+        // past the last edge are cut off by capping the rank.
+        __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+        __m128i needle = _mm_set1_epi8(static_cast<char>(byte ^ 0x80));
+        for (std::size_t i = 0;; i += 16) {
+            __m128i chunk = _mm_xor_si128(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i)),
+                bias);
+            auto mask = static_cast<unsigned int>(
+                _mm_movemask_epi8(_mm_cmplt_epi8(chunk, needle)));
+            if (mask != 0xffff || count - i <= 16) {
+                std::size_t below = i + count_trailing_zeros(~mask);
+                return below < count ? below : count;
+            }
+        }
+    }
+#endif
+
+    if (count <= linear_search_limit) {
+        std::size_t below = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            below += bytes[i] < byte;
+        return below;
+    }
+
+    // Binary search whose only branch is the loop condition, so the
+    // compiler turns the step into a conditional move and there are no
+    // mispredictions however the bytes fall.
+    const unsigned char* base = bytes;
+    std::size_t length = count;
+    while (length > 1) {
+        std::size_t half = length / 2;
+        base = base[half] < byte ? base + half : base;
+        length -= half;
+    }
+    return static_cast<std::size_t>(base - bytes) + (*base < byte);
+}
+
+// Returns the index of the first byte that differs between two words
+// loaded from memory, given that they differ.
+static std::size_t first_difference(std::uint64_t a, std::uint64_t b)
+{
+    assert(a != b);
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) \
+    && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return static_cast<std::size_t>(__builtin_ctzll(a ^ b)) / 8;
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) \
+    && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return static_cast<std::size_t>(__builtin_clzll(a ^ b)) / 8;
+#else
+    unsigned char x[sizeof(a)];
+    unsigned char y[sizeof(b)];
+    std::memcpy(x, &a, sizeof(a));
+    std::memcpy(y, &b, sizeof(b));
+    std::size_t i = 0;
+    while (x[i] == y[i])
+        ++i;
+    return i;
+#endif
+}
+
+std::size_t common_prefix_length(const unsigned char* a,
+                                 const unsigned char* b,
+                                 std::size_t size)
+{
+    std::size_t i = 0;
+
+#if defined(RADIX_TREE_USE_SSE2)
+    for (; size - i >= 16; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        auto mask = static_cast<unsigned int>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)));
+        if (mask != 0xffff)
+            return i + count_trailing_zeros(~mask);
+    }
+#endif
+
+    std::uint64_t x;
+    std::uint64_t y;
+    for (; size - i >= sizeof(x); i += sizeof(x)) {
+        std::memcpy(&x, a + i, sizeof(x));
+        std::memcpy(&y, b + i, sizeof(y));
+        if (x != y)
+            return i + first_difference(x, y);
+    }
+    if (i == size)
+        return size;
+
+    if (size >= sizeof(x)) {
+        // Finish with the last word, which overlaps bytes that are
+        // already known to be equal.
+        std::size_t last = size - sizeof(x);
+        std::memcpy(&x, a + last, sizeof(x));
+        std::memcpy(&y, b + last, sizeof(y));
+        return x != y ? last + first_difference(x, y) : size;
+    }
+    while (i < size && a[i] == b[i])
+        ++i;
+    return i;
+}
+
 void node::set_node_at(std::size_t i, node n)
 {
     assert(i < edgecount());
-    std::memcpy(node_ptrs() + i * sizeof(void*),
-                &n.data_,
-                sizeof(n.data_));
+    unsigned char* slot = node_ptrs() + i * sizeof(void*);
+    if (n.inline_)
+        std::memmove(slot, n.data_, sizeof(void*));
+    else
+        std::memcpy(slot, &n.data_, sizeof(n.data_));
 }
 
 void node::set_edge_at(std::size_t i, unsigned char byte, node n)
@@ -111,6 +524,99 @@ void node::set_edge_at(std::size_t i, unsigned char byte, node n)
     set_node_at(i, n);
 }
 
+// Rebuilds the child index from the chunk of first bytes.
+static void build_child_index(node n)
+{
+    unsigned char* index = n.child_index();
+    std::memset(index, 0, 256);
+    for (std::size_t i = 0; i < n.edgecount(); ++i)
+        index[n.first_bytes()[i]] = static_cast<unsigned char>(i);
+}
+
+void node::set_edges(node other)
+{
+    assert(edgecount() == other.edgecount());
+
+    std::size_t count = edgecount();
+    std::memcpy(first_bytes(), other.first_bytes(), count);
+    std::memcpy(node_ptrs(), other.node_ptrs(), count * sizeof(void*));
+    if (capacity() > vector_search_limit)
+        build_child_index(*this);
+}
+
+void node::add_edge(node_allocator& allocator, unsigned char byte, node n)
+{
+    std::size_t count = edgecount();
+    if (count == capacity()) {
+        // Grow geometrically so that a node gaining many children is
+        // only reallocated a logarithmic number of times.
+        std::size_t room = count == 0 ? 1 : 2 * count;
+        reshape(allocator, prefix_length(), count, room < 256 ? room : 256);
+    }
+
+    // Shift the edges above the new one up by a slot to keep them
+    // sorted. Their entries in the child index move up along with
+    // them. Entries for bytes without an edge are never trusted, so
+    // the entries of all bytes above the new one are bumped at once,
+    // which compiles to a few vector instructions.
+    std::size_t i = rank(byte);
+    assert(i == count || first_byte_at(i) != byte);
+    unsigned char* bytes = first_bytes();
+    unsigned char* ptrs = node_ptrs();
+    std::memmove(bytes + i + 1, bytes + i, count - i);
+    std::memmove(ptrs + (i + 1) * sizeof(void*),
+                 ptrs + i * sizeof(void*),
+                 (count - i) * sizeof(void*));
+    set_edgecount(static_cast<std::uint32_t>(count + 1));
+    if (capacity() > vector_search_limit) {
+        unsigned char* index = child_index();
+        for (std::size_t b = byte + 1u; b < 256; ++b)
+            index[b] = static_cast<unsigned char>(index[b] + 1);
+    }
+    set_edge_at(i, byte, n);
+}
+
+void node::remove_edge(node_allocator& allocator, std::size_t i)
+{
+    // Shift the edges above the hole down by a slot, and their entries
+    // in the child index with them, as in add_edge(). The entry of the
+    // removed edge goes stale.
+    std::size_t last_idx = edgecount() - 1;
+    assert(i <= last_idx);
+    unsigned char removed = first_byte_at(i);
+    unsigned char* bytes = first_bytes();
+    unsigned char* ptrs = node_ptrs();
+    std::memmove(bytes + i, bytes + i + 1, last_idx - i);
+    std::memmove(ptrs + i * sizeof(void*),
+                 ptrs + (i + 1) * sizeof(void*),
+                 (last_idx - i) * sizeof(void*));
+    set_edgecount(static_cast<std::uint32_t>(last_idx));
+    if (capacity() > vector_search_limit) {
+        unsigned char* index = child_index();
+        for (std::size_t b = removed + 1u; b < 256; ++b)
+            index[b] = static_cast<unsigned char>(index[b] - 1);
+    }
+
+    // Only give memory back once the node is down to a quarter of its
+    // capacity, so that alternating insertions and removals around a
+    // capacity don't reallocate every time.
+    std::size_t room = capacity();
+    if (last_idx <= room / 4)
+        reshape(allocator, prefix_length(), last_idx, room / 2);
+}
+
+// Sets both edges of a node with room for two, in the order of their
+// first bytes, which differ.
+static void set_two_edges(node n, node a, node b)
+{
+    assert(n.edgecount() == 2);
+    assert(a.prefix()[0] != b.prefix()[0]);
+    if (b.prefix()[0] < a.prefix()[0])
+        std::swap(a, b);
+    n.set_edge_at(0, a.prefix()[0], a);
+    n.set_edge_at(1, b.prefix()[0], b);
+}
+
 bool node::operator==(node other) const
 {
     return data_ == other.data_;
@@ -121,52 +627,298 @@ bool node::operator!=(node other) const
     return !(*this == other);
 }
 
-void node::resize(std::size_t prefix_length, std::size_t edgecount)
+std::size_t node::size()
+{
+    if (inline_)
+        return 0;
+    return node_size(prefix_chunk_size(), capacity(), value_size());
+}
+
+void node::resize(node_allocator& allocator,
+                  std::size_t prefix_length,
+                  std::size_t edgecount)
 {
-    std::size_t sz = 3 * sizeof(std::uint32_t) + prefix_length
-        + edgecount * (1 + sizeof(void*));
-    auto* new_data = static_cast<unsigned char*>(std::realloc(data_, sz));
-    assert(new_data);
-    data_ = new_data;
-    set_prefix_length(static_cast<std::uint32_t>(prefix_length));
-    set_edgecount(static_cast<std::uint32_t>(edgecount));
+    reshape(allocator, prefix_length, edgecount, edgecount);
 }
 
-node make_node(std::size_t refs, std::size_t bytes, std::size_t edges)
+void node::reshape(node_allocator& allocator,
+                   std::size_t prefix_length,
+                   std::size_t edgecount,
+                   std::size_t capacity)
 {
-    std::size_t size = 3 * sizeof(std::uint32_t) + bytes
-        + edges * (1 + sizeof(void*));
+    assert(edgecount <= capacity);
 
-    auto* data = static_cast<unsigned char*>(std::malloc(size));
-    assert(data);
+    if (inline_) {
+        rebuild(allocator, prefix_length, edgecount, capacity);
+        return;
+    }
+
+    std::size_t old_prefix_length = this->prefix_length();
+    std::size_t old_edgecount = this->edgecount();
+    std::size_t old_capacity = this->capacity();
+    std::size_t value_size = this->value_size();
+    std::size_t kept = edgecount < old_edgecount ? edgecount : old_edgecount;
+
+    if (prefix_length == old_prefix_length && capacity == old_capacity) {
+        set_edgecount(static_cast<std::uint32_t>(edgecount));
+        return;
+    }
+
+    if (prefix_length == old_prefix_length
+        && child_index_size(capacity) == 0
+        && child_index_size(old_capacity) == 0) {
+        // Only the edge chunks change size, so we can grow or shrink
+        // in place and shift the node pointers to their new offset. An
+        // external prefix stays external.
+        unsigned char* old_ptrs = node_ptrs();
+        std::size_t chunk_size = prefix_chunk_size();
+        RADIX_TREE_COUNT(reallocations, 1);
+        RADIX_TREE_COUNT(bytes_moved,
+                         node_size(chunk_size,
+                                   std::min(capacity, old_capacity),
+                                   value_size));
+        if (capacity < old_capacity)
+            std::memmove(old_ptrs - (old_capacity - capacity),
+                         old_ptrs,
+                         kept * sizeof(void*));
+        data_ = allocator.reallocate(
+            data_,
+            node_size(chunk_size, old_capacity, value_size),
+            node_size(chunk_size, capacity, value_size));
+        assert(holds_node(data_));
+        set_edgecount(static_cast<std::uint32_t>(edgecount));
+        set_capacity(static_cast<std::uint32_t>(capacity));
+        if (capacity > old_capacity)
+            std::memmove(node_ptrs(),
+                         first_bytes() + old_capacity,
+                         kept * sizeof(void*));
+        return;
+    }
+
+    // The child index comes or goes, or the prefix changes length.
+    rebuild(allocator, prefix_length, edgecount, capacity);
+}
+
+void node::expand_prefix(node_allocator& allocator)
+{
+    assert(prefix_is_external());
+    rebuild(allocator, prefix_length(), edgecount(), capacity());
+}
+
+void node::rebuild(node_allocator& allocator,
+                   std::size_t prefix_length,
+                   std::size_t edgecount,
+                   std::size_t capacity)
+{
+    std::size_t old_prefix_length = this->prefix_length();
+    std::size_t old_edgecount = this->edgecount();
+    std::size_t value_size = this->value_size();
+    std::size_t kept = edgecount < old_edgecount ? edgecount : old_edgecount;
+
+    RADIX_TREE_COUNT(reallocations, 1);
+    RADIX_TREE_COUNT(bytes_moved,
+                     node_size(std::min(prefix_length, old_prefix_length),
+                               kept,
+                               value_size));
+    node reshaped = make_node(allocator,
+                              refcount(),
+                              prefix_length,
+                              capacity,
+                              value_size);
+    reshaped.set_edgecount(static_cast<std::uint32_t>(edgecount));
+    reshaped.set_subtree_count(subtree_count());
+    reshaped.copy_value(*this);
+    std::memcpy(reshaped.prefix(),
+                prefix(),
+                prefix_length < old_prefix_length ? prefix_length
+                                                  : old_prefix_length);
+    std::memcpy(reshaped.first_bytes(), first_bytes(), kept);
+    std::memcpy(reshaped.node_ptrs(), node_ptrs(), kept * sizeof(void*));
+    if (capacity > vector_search_limit)
+        build_child_index(reshaped);
+    if (!inline_)
+        allocator.deallocate(data_, size());
+    data_ = reshaped.data_;
+    inline_ = false;
+}
 
-    node n(data);
+static node allocate_node(node_allocator& allocator,
+                          std::size_t refs,
+                          std::size_t prefix_length,
+                          std::size_t prefix_chunk_size,
+                          std::size_t edges,
+                          std::size_t value_bytes)
+{
+    node n(allocator.allocate(
+        node_size(prefix_chunk_size, edges, value_bytes)));
+    assert(holds_node(n.data_));
+    std::memset(n.data_, 0, node::header_size);
     n.set_refcount(static_cast<std::uint32_t>(refs));
-    n.set_prefix_length(static_cast<std::uint32_t>(bytes));
+    n.set_prefix_length(static_cast<std::uint32_t>(prefix_length));
     n.set_edgecount(static_cast<std::uint32_t>(edges));
+    n.set_capacity(static_cast<std::uint32_t>(edges));
+    n.set_value_size(static_cast<std::uint32_t>(value_bytes));
+    n.set_subtree_count(static_cast<std::uint32_t>(refs));
+    return n;
+}
+
+node make_node(node_allocator& allocator,
+               std::size_t refs,
+               std::size_t bytes,
+               std::size_t edges,
+               std::size_t value_bytes)
+{
+    return allocate_node(allocator, refs, bytes, bytes, edges, value_bytes);
+}
+
+node make_external_node(node_allocator& allocator,
+                        std::size_t refs,
+                        const unsigned char* prefix,
+                        std::size_t prefix_length,
+                        std::size_t edges,
+                        std::size_t value_bytes)
+{
+    node n = allocate_node(allocator, refs, prefix_length,
+                           sizeof(prefix), edges, value_bytes);
+    n.set_external_prefix(prefix);
     return n;
 }
 
+// Whether a leaf holding the key the number of times supplied, with a
+// prefix of the length supplied, fits into a pointer slot.
+static bool fits_inline(std::size_t refs, std::size_t prefix_length)
+{
+    return refs > 0 && refs <= node::max_inline_refcount
+        && prefix_length > 0 && prefix_length <= node::max_inline_prefix;
+}
+
+// Makes a leaf in the pointer slot supplied, for set_node_at() to copy
+// into its parent.
+static node make_inline_leaf(unsigned char* slot,
+                             std::size_t refs,
+                             const unsigned char* prefix,
+                             std::size_t prefix_length)
+{
+    assert(fits_inline(refs, prefix_length));
+    std::memset(slot, 0, sizeof(void*));
+    slot[inline_tag_offset] = static_cast<unsigned char>(
+        inline_flag | prefix_length << inline_length_shift
+        | refs << inline_refcount_shift);
+    std::memcpy(slot + inline_prefix_offset, prefix, prefix_length);
+    return node::inline_leaf(slot);
+}
+
+// Copies a leaf held in a pointer slot into the slot supplied, so that
+// it survives its parent changing shape. Other nodes are left alone.
+static node detach(node n, unsigned char* slot)
+{
+    if (!n.is_inline())
+        return n;
+    std::memcpy(slot, n.data_, sizeof(void*));
+    return node::inline_leaf(slot);
+}
+
+// Frees the node supplied, unless it is a leaf held in a pointer slot,
+// which goes away with its parent.
+static void free_node(node_allocator& allocator, node n)
+{
+    if (!n.is_inline())
+        allocator.deallocate(n.data_, n.size());
+}
+
+// Moves the child at the edge supplied into the parent's pointer slot if
+// it is a leaf that fits there, and frees the node it had.
+static void pack_child(node_allocator& allocator, node parent, std::size_t i)
+{
+    node child = parent.node_at(i);
+    if (child.is_inline() || child.edgecount() > 0 || child.value_size() > 0
+        || !fits_inline(child.refcount(), child.prefix_length()))
+        return;
+    unsigned char slot[sizeof(void*)];
+    parent.set_node_at(i, make_inline_leaf(slot,
+                                           child.refcount(),
+                                           child.prefix(),
+                                           child.prefix_length()));
+    allocator.deallocate(child.data_, child.size());
+}
+
 // ----------------------------------------------------------------------
 
 radix_tree::radix_tree()
-    : root_(make_node(0, 0, 0))
+    : radix_tree(default_node_allocator())
+{}
+
+radix_tree::radix_tree(node_allocator& allocator)
+    : radix_tree(allocator, 0)
+{}
+
+radix_tree::radix_tree(node_allocator& allocator, key_storage storage)
+    : radix_tree(allocator, 0, storage)
+{}
+
+radix_tree::radix_tree(node_allocator& allocator,
+                       std::size_t value_size,
+                       key_storage storage)
+    : allocator_(allocator)
+    , root_(make_node(allocator_, 0, 0, 0, value_size))
     , size_(0)
+    , external_keys_(storage == key_storage::external)
 {}
 
-static void free_nodes(node n)
+static void prefetch_node(node n)
 {
-    for (std::size_t i = 0; i < n.edgecount(); ++i)
-        free_nodes(n.node_at(i));
-    std::free(n.data_);
+#if defined(__GNUC__)
+    // The header, the prefix and the first bytes of small nodes share
+    // the first cache line or two.
+    __builtin_prefetch(n.data_);
+    __builtin_prefetch(n.data_ + 64);
+#else
+    static_cast<void>(n);
+#endif
+}
+
+// Frees every node of the tree rooted at the node supplied. The nodes
+// still to be freed are kept on an explicit stack, so a tree of any
+// depth can be freed without overflowing the call stack. Each node is
+// freed as soon as its children have been pushed, and the children are
+// prefetched so that freeing them doesn't wait on the cache.
+static void free_nodes(node_allocator& allocator, node root)
+{
+    // Leaves held in pointer slots go along with their parents.
+    std::vector<node> stack;
+    if (!root.is_inline())
+        stack.push_back(root);
+    while (!stack.empty()) {
+        node n = stack.back();
+        stack.pop_back();
+        for (std::size_t i = 0; i < n.edgecount(); ++i) {
+            node child = n.node_at(i);
+            if (child.is_inline())
+                continue;
+            prefetch_node(child);
+            stack.push_back(child);
+        }
+        allocator.deallocate(n.data_, n.size());
+    }
 }
 
 radix_tree::~radix_tree()
 {
-    free_nodes(root_);
+    // Allocators that can release everything at once spare us the
+    // walk over the whole tree.
+    if (!allocator_.release_all())
+        free_nodes(allocator_, root_);
 }
 
 match_result radix_tree::match(const unsigned char* key, std::size_t size) const
+{
+    return match(root_, key, size);
+}
+
+match_result radix_tree::match(node root,
+                               const unsigned char* key,
+                               std::size_t size,
+                               std::int32_t delta)
 {
     assert(key);
     assert(size > 0);
@@ -175,120 +927,219 @@ match_result radix_tree::match(const unsigned char* key, std::size_t size) const
     std::size_t j = 0; // Number of characters matched in current node.
     std::size_t edge_idx = 0; // Index of outgoing edge from the parent node.
     std::size_t gp_edge_idx = 0; // Index of outgoing edge from grandparent.
-    node current_node = root_; // The node we stopped matching at.
+    node current_node = root; // The node we stopped matching at.
     node parent_node = current_node;
     node grandparent_node = current_node;
+    RADIX_TREE_COUNT(lookups, 1);
 
     while ((current_node.prefix_length() > 0 || current_node.edgecount() > 0)
            && i < size) {
-        for (j = 0; j < current_node.prefix_length(); ++j) {
-            if (current_node.prefix()[j] != key[i])
-                break;
-            ++i;
-        }
-        if (j != current_node.prefix_length())
+        std::uint32_t prefix_length = current_node.prefix_length();
+        std::size_t limit = std::min<std::size_t>(prefix_length, size - i);
+        RADIX_TREE_COUNT(nodes_visited, 1);
+        RADIX_TREE_COUNT(prefix_bytes_compared, limit);
+        j = common_prefix_length(current_node.prefix(), key + i, limit);
+        i += j;
+        if (j != prefix_length)
             break;
 
         // Check if there's an outgoing edge from this node.
-        node next_node = current_node;
-        for (std::size_t k = 0; k < current_node.edgecount(); ++k) {
-            if (i < size && current_node.first_byte_at(k) == key[i]) {
-                gp_edge_idx = edge_idx;
-                edge_idx = k;
-                next_node = current_node.node_at(k);
-                break;
-            }
-        }
-        if (next_node == current_node)
+        if (i == size)
+            break;
+        std::size_t k = current_node.find_edge(key[i]);
+        if (k == current_node.edgecount())
             break; // No outgoing edge.
+        if (delta != 0)
+            current_node.set_subtree_count(
+                current_node.subtree_count()
+                + static_cast<std::uint32_t>(delta));
+        gp_edge_idx = edge_idx;
+        edge_idx = k;
         grandparent_node = parent_node;
         parent_node = current_node;
-        current_node = next_node;
+        current_node = current_node.node_at(k);
     }
 
     return match_result{i, j, edge_idx, gp_edge_idx,
             current_node, parent_node, grandparent_node};
 }
 
-bool radix_tree::insert(const unsigned char* key, std::size_t size)
+static node copy_node(node_allocator& allocator, node n)
+{
+    // A leaf held in a pointer slot was copied along with its parent.
+    if (n.is_inline())
+        return n;
+    std::size_t size = n.size();
+    node copy(allocator.allocate(size));
+    assert(holds_node(copy.data_));
+    std::memcpy(copy.data_, n.data_, size);
+    allocator.deallocate(n.data_, size);
+    return copy;
+}
+
+void radix_tree::copy_path(const unsigned char* key, std::size_t size)
+{
+    assert(key);
+    assert(size > 0);
+
+    // This follows the same path as match().
+    root_ = copy_node(allocator_, root_);
+    node current_node = root_;
+    std::size_t i = 0;
+
+    while ((current_node.prefix_length() > 0 || current_node.edgecount() > 0)
+           && i < size) {
+        std::uint32_t prefix_length = current_node.prefix_length();
+        if (size - i < prefix_length
+            || std::memcmp(current_node.prefix(), key + i, prefix_length))
+            break;
+        i += prefix_length;
+        if (i == size)
+            break;
+
+        std::size_t k = current_node.find_edge(key[i]);
+        if (k == current_node.edgecount())
+            break;
+        node child = copy_node(allocator_, current_node.node_at(k));
+        current_node.set_node_at(k, child);
+        current_node = child;
+    }
+}
+
+bool radix_tree::insert_at(node_allocator& allocator,
+                           node& root,
+                           const match_result& result,
+                           const unsigned char* key,
+                           std::size_t size,
+                           node* holder,
+                           bool external,
+                           bool inline_leaves)
 {
-    match_result result = match(key, size);
     std::size_t i = result.nkey;
     std::size_t j = result.nprefix;
     std::size_t edge_idx = result.edge_index;
     node current_node = result.current_node;
     node parent_node = result.parent_node;
 
+    // The nodes above the current node were counted by match(), and
+    // whatever happens below, the key ends up in the current node's
+    // subtree. A leaf held in a pointer slot has no count of its own,
+    // so it is counted again once it moves into a node.
+    std::uint32_t count = current_node.subtree_count();
+    current_node.set_subtree_count(count + 1);
+
+    // New nodes get a value slot if the nodes of the tree have one.
+    std::size_t value_size = current_node.value_size();
+    inline_leaves = inline_leaves && value_size == 0 && holder == nullptr;
+
+    // A leaf for the rest of the key goes in the parent's pointer slot
+    // if it fits, and otherwise refers to the key if that takes less
+    // room than a copy.
+    unsigned char key_slot[sizeof(void*)];
+    auto make_key_node = [&allocator, &key_slot, key, size, i, value_size,
+                          external, inline_leaves]() -> node {
+        if (inline_leaves && fits_inline(1, size - i))
+            return make_inline_leaf(key_slot, 1, key + i, size - i);
+        if (external && size - i > sizeof(key))
+            return make_external_node(allocator, 1, key + i, size - i, 0,
+                                      value_size);
+        node key_node = make_node(allocator, 1, size - i, 0, value_size);
+        key_node.set_prefix(key + i);
+        return key_node;
+    };
+
+    // The part of a prefix split off below the current node keeps
+    // referring to the key of the current node, which it takes over.
+    // It goes in a pointer slot if it is a leaf that fits.
+    unsigned char split_slot[sizeof(void*)];
+    auto split_prefix = [&allocator, &current_node, &split_slot, j,
+                         value_size, inline_leaves]() -> node {
+        std::size_t length = current_node.prefix_length() - j;
+        if (inline_leaves && current_node.edgecount() == 0
+            && fits_inline(current_node.refcount(), length))
+            return make_inline_leaf(split_slot,
+                                    current_node.refcount(),
+                                    current_node.prefix() + j,
+                                    length);
+        if (current_node.prefix_is_external())
+            return make_external_node(allocator,
+                                      current_node.refcount(),
+                                      current_node.prefix() + j,
+                                      length,
+                                      current_node.edgecount(),
+                                      value_size);
+        node split_node = make_node(allocator,
+                                    current_node.refcount(),
+                                    length,
+                                    current_node.edgecount(),
+                                    value_size);
+        split_node.set_prefix(current_node.prefix() + j);
+        return split_node;
+    };
+
     if (i != size) {
         // Not all characters in the key match.
         if (i == 0 || j == current_node.prefix_length()) {
             // The mismatch is at one of the outgoing edges, so we
             // create an edge from the current node to a new leaf node
             // that has the rest of the key as the prefix.
-            node key_node = make_node(1, size - i, 0);
-            key_node.set_prefix(key + i);
-
-            // Reallocate for one more edge.
-            current_node.resize(current_node.prefix_length(),
-                                current_node.edgecount() + 1);
-
-            // Make room for the new edge. We need to shift the chunk
-            // of node pointers one byte to the right. Since resize()
-            // increments the edgecount by 1, node_ptrs() tells us the
-            // destination address. The chunk of node pointers starts
-            // at one byte to the left of this destination.
-            //
-            // Since the regions can overlap, we use memmove.
-            std::memmove(current_node.node_ptrs(),
-                         current_node.node_ptrs() - 1,
-                         (current_node.edgecount() - 1) * sizeof(void*));
-
-            // Add a link to the new node.
-            current_node.set_edge_at(current_node.edgecount() - 1,
-                                     key[i], key_node);
-
-            // We need to update all pointers to the current node
-            // after the call to resize().
+            node key_node = make_key_node();
+            if (holder)
+                *holder = key_node;
+
+            // Add a link to the new node. This reallocates the current
+            // node if it has no room left for another edge, which is
+            // always the case for a leaf held in a pointer slot.
+            node old_node = current_node;
+            current_node.add_edge(allocator, key[i], key_node);
+            if (old_node.is_inline())
+                current_node.set_subtree_count(count + 1);
+
+            // We need to update all pointers to the current node if
+            // add_edge() moved it. The parent is left alone otherwise:
+            // olc_radix_tree doesn't hold it then, and other writers
+            // may shift its edges, so edge_idx may be stale.
+            if (current_node == old_node)
+                return true;
             if (current_node.prefix_length() == 0)
-                root_.data_ = current_node.data_;
+                root.data_ = current_node.data_;
             else
                 parent_node.set_node_at(edge_idx, current_node);
-            ++size_;
             return true;
         }
 
         // There was a mismatch, so we need to split this node.
+        RADIX_TREE_COUNT(splits, 1);
         //
         // Create two nodes that will be reachable from the parent.
         // One node will have the rest of the characters from the key,
         // and the other node will have the rest of the characters
         // from the current node's prefix.
-        node key_node = make_node(1, size - i, 0);
-        node split_node = make_node(current_node.refcount(),
-                                    current_node.prefix_length() - j,
-                                    current_node.edgecount());
+        node key_node = make_key_node();
+        node split_node = split_prefix();
+        if (holder)
+            *holder = key_node;
 
-        // Copy the prefix chunks to the new nodes.
-        key_node.set_prefix(key + i);
-        split_node.set_prefix(current_node.prefix() + j);
+        // The split node takes over the current node's key along with
+        // its value.
+        split_node.set_subtree_count(count);
+        split_node.copy_value(current_node);
 
         // Copy the current node's edges to the new node.
-        split_node.set_first_bytes(current_node.first_bytes());
-        split_node.set_node_ptrs(current_node.node_ptrs());
+        split_node.set_edges(current_node);
 
         // Resize the current node to accommodate a prefix comprising
         // the matched characters and 2 outgoing edges to the above
         // nodes. Set the refcount to 0 since this node doesn't hold a
         // key.
-        current_node.resize(j, 2);
+        current_node.resize(allocator, j, 2);
         current_node.set_refcount(0);
+        current_node.set_subtree_count(count + 1);
 
         // Add links to the new nodes. We don't need to copy the
         // prefix since resize() retains it in the current node.
-        current_node.set_edge_at(0, key_node.prefix()[0], key_node);
-        current_node.set_edge_at(1, split_node.prefix()[0], split_node);
+        set_two_edges(current_node, key_node, split_node);
 
-        ++size_;
         parent_node.set_node_at(edge_idx, current_node);
         return true;
     }
@@ -296,20 +1147,20 @@ bool radix_tree::insert(const unsigned char* key, std::size_t size)
     if (j != current_node.prefix_length()) {
         // All characters in the key match, but not all characters
         // from the current node's prefix match.
+        RADIX_TREE_COUNT(splits, 1);
 
         // Create a node that contains the rest of the characters from
         // the current node's prefix and the outgoing edges from the
         // current node.
-        node split_node = make_node(current_node.refcount(),
-                                    current_node.prefix_length() - j,
-                                    current_node.edgecount());
-        split_node.set_prefix(current_node.prefix() + j);
-        split_node.set_first_bytes(current_node.first_bytes());
-        split_node.set_node_ptrs(current_node.node_ptrs());
+        node split_node = split_prefix();
+        split_node.set_subtree_count(count);
+        split_node.copy_value(current_node);
+        split_node.set_edges(current_node);
 
         // Resize the current node to hold only the matched characters
         // from its prefix and one edge to the new node.
-        current_node.resize(j, 1);
+        current_node.resize(allocator, j, 1);
+        current_node.set_subtree_count(count + 1);
 
         // Add an edge to the split node and set the refcount to 1
         // since this key wasn't inserted earlier. We don't need to
@@ -317,8 +1168,9 @@ bool radix_tree::insert(const unsigned char* key, std::size_t size)
         // preserved by resize().
         current_node.set_edge_at(0, split_node.prefix()[0], split_node);
         current_node.set_refcount(1);
+        if (holder)
+            *holder = current_node;
 
-        ++size_;
         parent_node.set_node_at(edge_idx, current_node);
         return true;
     }
@@ -326,14 +1178,25 @@ bool radix_tree::insert(const unsigned char* key, std::size_t size)
     assert(i == size);
     assert(j == current_node.prefix_length());
 
-    ++size_;
+    if (current_node.is_inline()
+        && current_node.refcount() == node::max_inline_refcount) {
+        // The tag has no room for another insertion.
+        current_node.rebuild(allocator, j, 0, 0);
+        current_node.set_subtree_count(count + 1);
+        parent_node.set_node_at(edge_idx, current_node);
+    }
     current_node.set_refcount(current_node.refcount() + 1);
+    if (holder)
+        *holder = current_node;
     return current_node.refcount() == 1;
 }
 
-bool radix_tree::erase(const unsigned char* key, std::size_t size)
+bool radix_tree::erase_at(node_allocator& allocator,
+                          node& root,
+                          const match_result& result,
+                          std::size_t size,
+                          bool inline_leaves)
 {
-    match_result result = match(key, size);
     std::size_t i = result.nkey;
     std::size_t j = result.nprefix;
     std::size_t edge_idx = result.edge_index;
@@ -348,27 +1211,43 @@ bool radix_tree::erase(const unsigned char* key, std::size_t size)
 
     assert(parent_node != current_node);
 
+    // match() has already taken the key off the counts of the nodes
+    // above. Merges below carry this count over to the merged node,
+    // which holds the same keys.
     current_node.set_refcount(current_node.refcount() - 1);
-    --size_;
-    if (current_node.refcount() > 0)
+    current_node.set_subtree_count(current_node.subtree_count() - 1);
+    if (current_node.refcount() > 0) {
+        // A leaf may have come down to a count that fits in a slot.
+        if (inline_leaves)
+            pack_child(allocator, parent_node, edge_idx);
         return true;
+    }
 
     std::size_t outgoing_edges = current_node.edgecount();
 
-    if (outgoing_edges > 1)
+    if (outgoing_edges > 1) {
         // This node can't be merged with any other node, so there's
-        // nothing more to do.
+        // nothing more to do, except that it may no longer refer to
+        // the bytes of the key it held.
+        if (current_node.prefix_is_external()) {
+            current_node.expand_prefix(allocator);
+            parent_node.set_node_at(edge_idx, current_node);
+        }
         return true;
+    }
 
     if (outgoing_edges == 1) {
         // Merge this node with the single child node.
-        node child = current_node.node_at(0);
+        RADIX_TREE_COUNT(merges, 1);
+        unsigned char child_slot[sizeof(void*)];
+        node child = detach(current_node.node_at(0), child_slot);
 
         // Make room for the child node's prefix and edges. We need to
         // keep the old prefix length since resize() will overwrite
         // it.
         std::uint32_t old_prefix_length = current_node.prefix_length();
-        current_node.resize(old_prefix_length + child.prefix_length(),
+        current_node.resize(allocator,
+                            old_prefix_length + child.prefix_length(),
                             child.edgecount());
 
         // Append the child node's prefix to the current node.
@@ -377,28 +1256,33 @@ bool radix_tree::erase(const unsigned char* key, std::size_t size)
                     child.prefix_length());
 
         // Copy the rest of child node's data to the current node.
-        current_node.set_first_bytes(child.first_bytes());
-        current_node.set_node_ptrs(child.node_ptrs());
+        current_node.set_edges(child);
         current_node.set_refcount(child.refcount());
+        current_node.copy_value(child);
 
-        std::free(child.data_);
+        free_node(allocator, child);
         parent_node.set_node_at(edge_idx, current_node);
+        if (inline_leaves)
+            pack_child(allocator, parent_node, edge_idx);
         return true;
     }
 
     if (parent_node.edgecount() == 2 && parent_node.refcount() == 0
-        && parent_node != root_) {
+        && parent_node != root) {
         // Removing this node leaves the parent with one child.
         // If the parent doesn't hold a key or if it isn't the root,
         // we can merge it with its single child node.
+        RADIX_TREE_COUNT(merges, 1);
         assert(edge_idx < 2);
-        node other_child = parent_node.node_at(!edge_idx);
+        unsigned char other_slot[sizeof(void*)];
+        node other_child = detach(parent_node.node_at(!edge_idx), other_slot);
 
         // Make room for the child node's prefix and edges. We need to
         // keep the old prefix length since resize() will overwrite
         // it.
         std::uint32_t old_prefix_length = parent_node.prefix_length();
-        parent_node.resize(old_prefix_length + other_child.prefix_length(),
+        parent_node.resize(allocator,
+                           old_prefix_length + other_child.prefix_length(),
                            other_child.edgecount());
 
         // Append the child node's prefix to the current node.
@@ -407,13 +1291,15 @@ bool radix_tree::erase(const unsigned char* key, std::size_t size)
                     other_child.prefix_length());
 
         // Copy the rest of child node's data to the current node.
-        parent_node.set_first_bytes(other_child.first_bytes());
-        parent_node.set_node_ptrs(other_child.node_ptrs());
+        parent_node.set_edges(other_child);
         parent_node.set_refcount(other_child.refcount());
+        parent_node.copy_value(other_child);
 
-        std::free(current_node.data_);
-        std::free(other_child.data_);
+        free_node(allocator, current_node);
+        free_node(allocator, other_child);
         grandparent_node.set_node_at(gp_edge_idx, parent_node);
+        if (inline_leaves)
+            pack_child(allocator, grandparent_node, gp_edge_idx);
         return true;
     }
 
@@ -422,73 +1308,1308 @@ bool radix_tree::erase(const unsigned char* key, std::size_t size)
     // parent.
     assert(outgoing_edges == 0);
 
-    // Move the first byte and node pointer to the back of the byte
-    // and pointer chunks respectively.
-    std::size_t last_idx = parent_node.edgecount() - 1;
-    unsigned char last_byte = parent_node.first_byte_at(last_idx);
-    node last_ptr = parent_node.node_at(last_idx);
-    parent_node.set_edge_at(edge_idx, last_byte, last_ptr);
-
-    // Move the chunk of pointers one byte to the left, effectively
-    // deleting the last byte in the region of first bytes by
-    // overwriting it.
-    std::memmove(parent_node.node_ptrs() - 1,
-                 parent_node.node_ptrs(),
-                 parent_node.edgecount() * sizeof(void*));
-
-    // Shrink the parent node to the new size, which "deletes" the
-    // last pointer in the chunk of node pointers.
-    parent_node.resize(parent_node.prefix_length(),
-                       parent_node.edgecount() - 1);
+    // Drop the edge from the parent. This reallocates the parent
+    // node if it has shrunk to a fraction of its capacity.
+    parent_node.remove_edge(allocator, edge_idx);
 
     // Nothing points to this node now, so we can reclaim it.
-    std::free(current_node.data_);
+    free_node(allocator, current_node);
 
-    if (parent_node.prefix_length() == 0)
-        root_.data_ = parent_node.data_;
-    else
+    if (parent_node.prefix_length() == 0) {
+        root.data_ = parent_node.data_;
+    } else {
         grandparent_node.set_node_at(gp_edge_idx, parent_node);
+        if (inline_leaves)
+            pack_child(allocator, grandparent_node, gp_edge_idx);
+    }
     return true;
 }
 
-bool radix_tree::contains(const unsigned char* key, std::size_t size) const
+bool radix_tree::insert(const unsigned char* key, std::size_t size)
 {
-    match_result result = match(key, size);
-
-    return result.nkey == size
-        && result.nprefix == result.current_node.prefix_length()
-        && result.current_node.refcount();
+    RADIX_TREE_OPERATION(instruments_, insert, key, size);
+    match_result result = match(root_, key, size, 1);
+    bool inserted = insert_at(allocator_, root_, result, key, size,
+                              nullptr, external_keys_, true);
+    ++size_;
+    return inserted;
 }
 
-static void visit_keys(node n,
-                       std::vector<unsigned char>& buffer,
-                       void (*func)(unsigned char* data,
-                                    std::size_t size,
-                                    void* arg),
-                       void *arg)
+bool radix_tree::erase(const unsigned char* key, std::size_t size)
 {
-    for (std::size_t i = 0; i < n.prefix_length(); ++i)
-        buffer.push_back(n.prefix()[i]);
-    if (n.refcount() > 0)
-        func(static_cast<unsigned char*>(buffer.data()), buffer.size(), arg);
-    for (std::size_t i = 0; i < n.edgecount(); ++i)
-        visit_keys(n.node_at(i), buffer, func, arg);
-    for (std::size_t i = 0; i < n.prefix_length(); ++i)
-        buffer.pop_back();
+    RADIX_TREE_OPERATION(instruments_, erase, key, size);
+    // Counting the key off on the way down saves a second walk when it
+    // is found, which is the common case. Otherwise the counts are put
+    // back.
+    if (!erase_at(allocator_, root_, match(root_, key, size, -1), size,
+                  true)) {
+        match(root_, key, size, 1);
+        return false;
+    }
+    --size_;
+    return true;
 }
 
-void radix_tree::apply(void (*func)(unsigned char* data,
-                                    std::size_t size,
-                                    void* arg),
-                       void* arg)
+// A range of sorted keys whose subtree is still to be built, and the
+// edge of the parent node that will lead to it.
+struct build_task
 {
-    std::vector<unsigned char> buffer;
-    visit_keys(root_, buffer, func, arg);
+    std::size_t lo;
+    std::size_t hi;
+    std::size_t depth;
+    node parent;
+    std::size_t edge_idx;
+};
+
+// Returns the index of the first key in keys[lo, hi) for which the
+// predicate is false, given that it is true for a leading run of keys.
+template <typename Predicate>
+static std::size_t partition_point(std::size_t lo,
+                                   std::size_t hi,
+                                   Predicate predicate)
+{
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        if (predicate(mid))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
-std::size_t radix_tree::size() const
+// Builds the node holding keys[lo, hi), all of which share their first
+// depth bytes with the prefixes of the nodes above it, and queues the
+// ranges of its children. The boundaries between the ranges are found
+// by halves, so the work per node doesn't grow with the number of keys
+// below it. If external is set, leaves refer to the keys. Leaves that
+// fit are made in the pointer slot supplied, unless it is nullptr.
+static node build_node(node_allocator& allocator,
+                       const unsigned char* const* keys,
+                       const std::size_t* sizes,
+                       std::size_t lo,
+                       std::size_t hi,
+                       std::size_t depth,
+                       bool is_root,
+                       bool external,
+                       unsigned char* slot,
+                       std::vector<std::size_t>& bounds,
+                       std::vector<build_task>& tasks)
 {
-    return size_;
+    assert(lo < hi);
+
+    // In a sorted range, the prefix shared by all keys is the prefix
+    // shared by the first and the last key. The root always has an
+    // empty prefix.
+    std::size_t end = depth;
+    if (!is_root) {
+        std::size_t limit = sizes[lo] < sizes[hi - 1] ? sizes[lo]
+                                                      : sizes[hi - 1];
+        end += common_prefix_length(keys[lo] + depth,
+                                    keys[hi - 1] + depth,
+                                    limit - depth);
+    }
+
+    // Keys that end here sort before the rest of the range, and the
+    // rest are sorted by their byte at the end of the prefix.
+    std::size_t first_child = partition_point(
+        lo, hi, [sizes, end](std::size_t k) { return sizes[k] == end; });
+
+    bounds.clear();
+    for (std::size_t k = first_child; k < hi;) {
+        bounds.push_back(k);
+        unsigned char byte = keys[k][end];
+        k = partition_point(k + 1, hi, [keys, end, byte](std::size_t m) {
+            return keys[m][end] == byte;
+        });
+    }
+    std::size_t edges = bounds.size();
+    bounds.push_back(hi);
+
+    std::size_t length = end - depth;
+    if (slot && edges == 0 && fits_inline(hi - lo, length))
+        return make_inline_leaf(slot, hi - lo, keys[lo] + depth, length);
+
+    node n(nullptr);
+    if (external && edges == 0 && length > sizeof(keys[lo])) {
+        n = make_external_node(allocator, first_child - lo,
+                               keys[lo] + depth, length, 0);
+    } else {
+        n = make_node(allocator, first_child - lo, length, edges);
+        n.set_prefix(keys[lo] + depth);
+    }
+    n.set_subtree_count(static_cast<std::uint32_t>(hi - lo));
+
+    // The first child comes off the stack first, so nodes are allocated
+    // in depth-first order.
+    for (std::size_t i = edges; i-- > 0;)
+        tasks.push_back(build_task{bounds[i], bounds[i + 1], end, n, i});
+    return n;
+}
+
+// Builds the tree holding keys[0, count), keeping the ranges still to
+// be built on an explicit stack rather than the call stack.
+static node build_sorted(node_allocator& allocator,
+                         const unsigned char* const* keys,
+                         const std::size_t* sizes,
+                         std::size_t count,
+                         bool external)
+{
+    std::vector<std::size_t> bounds;
+    std::vector<build_task> tasks;
+    node root = build_node(allocator, keys, sizes, 0, count, 0, true,
+                           external, nullptr, bounds, tasks);
+    unsigned char slot[sizeof(void*)];
+    while (!tasks.empty()) {
+        build_task task = tasks.back();
+        tasks.pop_back();
+        node child = build_node(allocator, keys, sizes,
+                                task.lo, task.hi, task.depth, false,
+                                external, slot, bounds, tasks);
+        task.parent.set_edge_at(task.edge_idx,
+                                keys[task.lo][task.depth],
+                                child);
+    }
+    return root;
+}
+
+void radix_tree::build_from_sorted(const unsigned char* const* keys,
+                                   const std::size_t* sizes,
+                                   std::size_t count)
+{
+#ifndef NDEBUG
+    for (std::size_t k = 0; k < count; ++k) {
+        assert(keys[k]);
+        assert(sizes[k] > 0);
+        if (k == 0)
+            continue;
+        std::size_t limit = sizes[k - 1] < sizes[k] ? sizes[k - 1]
+                                                    : sizes[k];
+        int order = std::memcmp(keys[k - 1], keys[k], limit);
+        assert(order < 0 || (order == 0 && sizes[k - 1] <= sizes[k]));
+    }
+#endif
+
+    if (!allocator_.release_all())
+        free_nodes(allocator_, root_);
+
+    root_ = count > 0
+        ? build_sorted(allocator_, keys, sizes, count, external_keys_)
+        : make_node(allocator_, 0, 0, 0);
+    size_ = count;
+}
+
+// Points the edge of the parent node supplied, or the root if there is
+// no parent, at the node supplied.
+static void set_slot(node& root, node parent, std::size_t edge_idx, node n)
+{
+    if (parent.data_ == nullptr)
+        root = n;
+    else
+        parent.set_node_at(edge_idx, n);
+}
+
+// Drops the first count bytes of the node's prefix.
+static void trim_prefix(node_allocator& allocator, node& n, std::size_t count)
+{
+    assert(count < n.prefix_length());
+    std::size_t remaining = n.prefix_length() - count;
+    if (n.is_inline()) {
+        std::memmove(n.prefix(), n.prefix() + count, remaining);
+        n.set_prefix_length(static_cast<std::uint32_t>(remaining));
+        return;
+    }
+    if (n.prefix_is_external()) {
+        n.set_external_prefix(n.prefix() + count);
+        n.set_prefix_length(static_cast<std::uint32_t>(remaining));
+        return;
+    }
+    std::memmove(n.prefix(), n.prefix() + count, remaining);
+    n.reshape(allocator, remaining, n.edgecount(), n.capacity());
+}
+
+// Makes a node with the first length bytes of the prefix of the node
+// supplied, whose subtree counts the keys of the subtree supplied.
+static node make_split_node(node_allocator& allocator,
+                            node n,
+                            std::size_t length,
+                            std::size_t nedges,
+                            std::uint32_t subtree_count)
+{
+    node split = make_node(allocator, 0, length, nedges);
+    split.set_prefix(n.prefix());
+    split.set_subtree_count(subtree_count);
+    return split;
+}
+
+// Hands the subtree rooted at the node supplied over from one allocator
+// to another. Nodes can stay where they are if both allocators forward
+// to the same one, and are copied one by one otherwise. Leaves held in
+// pointer slots move along with their parents. If copy_prefixes is set,
+// nodes referring to the bytes of their keys take a copy of them, since
+// the tree the subtree moves to doesn't keep them alive.
+static node move_subtree(tracking_allocator& allocator,
+                         tracking_allocator& source,
+                         node n,
+                         bool copy_prefixes)
+{
+    bool same_target = &allocator.target() == &source.target();
+    if ((same_target && !copy_prefixes) || n.is_inline())
+        return n;
+
+    auto move_node = [&allocator, &source, same_target, copy_prefixes](
+                         node original) {
+        if (copy_prefixes && original.prefix_is_external())
+            original.expand_prefix(source);
+        if (same_target)
+            return original;
+        std::size_t size = original.size();
+        node copy(allocator.allocate(size));
+        assert(holds_node(copy.data_));
+        std::memcpy(copy.data_, original.data_, size);
+        source.deallocate(original.data_, size);
+        return copy;
+    };
+    node copy = move_node(n);
+    std::vector<node> stack{copy};
+    while (!stack.empty()) {
+        node parent = stack.back();
+        stack.pop_back();
+        for (std::size_t i = 0; i < parent.edgecount(); ++i) {
+            if (parent.node_at(i).is_inline())
+                continue;
+            node child = move_node(parent.node_at(i));
+            parent.set_node_at(i, child);
+            stack.push_back(child);
+        }
+    }
+    return copy;
+}
+
+// A node of the other tree to be merged into the subtree at an edge of
+// this one. Both nodes start at the same depth.
+struct merge_task
+{
+    node parent; // No parent for the root.
+    std::size_t edge_idx;
+    node a;
+    node b;
+    // A copy of b if it is a leaf held in a pointer slot, since its
+    // parent is freed before the task is taken up.
+    unsigned char b_slot[sizeof(void*)];
+};
+
+void radix_tree::merge(radix_tree& other)
+{
+    assert(&other != this);
+    assert(root_.value_size() == 0 && other.root_.value_size() == 0);
+
+    // Subtrees of a tree with external keys refer to bytes that this
+    // tree isn't told to keep alive unless it has external keys too.
+    bool copies = other.external_keys_ && !external_keys_;
+    std::vector<merge_task> tasks{
+        merge_task{node(nullptr), 0, root_, other.root_, {}}};
+    auto push_task = [&tasks](node parent, std::size_t k, node b) {
+        tasks.push_back(merge_task{parent, k, parent.node_at(k), b, {}});
+        if (b.is_inline())
+            std::memcpy(tasks.back().b_slot, b.data_, sizeof(void*));
+    };
+    std::vector<std::pair<unsigned char, node>> shared;
+    while (!tasks.empty()) {
+        merge_task task = tasks.back();
+        tasks.pop_back();
+        // Leaves held in pointer slots are worked on in copies, and a is
+        // written back to its parent's slot like any node that moved.
+        unsigned char a_slot[sizeof(void*)];
+        node a = detach(task.a, a_slot);
+        node b = task.b.is_inline() ? node::inline_leaf(task.b_slot) : task.b;
+        std::size_t a_length = a.prefix_length();
+        std::size_t b_length = b.prefix_length();
+        std::size_t common = common_prefix_length(
+            a.prefix(), b.prefix(), std::min(a_length, b_length));
+        std::uint32_t count = a.subtree_count() + b.subtree_count();
+
+        if (common < a_length) {
+            // Split a where the prefixes part ways. If b goes on past
+            // that point, it becomes a's sibling and we're done here.
+            // Otherwise the new node takes a's place below.
+            bool siblings = common < b_length;
+            RADIX_TREE_COUNT(splits, 1);
+            node split = make_split_node(allocator_, a, common,
+                                         siblings ? 2 : 1,
+                                         siblings ? count
+                                                  : a.subtree_count());
+            trim_prefix(allocator_, a, common);
+            set_slot(root_, task.parent, task.edge_idx, split);
+            if (siblings) {
+                trim_prefix(other.allocator_, b, common);
+                b = move_subtree(allocator_, other.allocator_, b, copies);
+                set_two_edges(split, a, b);
+                // Either of them may be a leaf that fits in a slot now.
+                pack_child(allocator_, split, 0);
+                pack_child(allocator_, split, 1);
+                continue;
+            }
+            split.set_edge_at(0, a.prefix()[0], a);
+            pack_child(allocator_, split, 0);
+            a = split;
+            a_length = common;
+        }
+
+        if (common < b_length) {
+            // a's prefix is a proper prefix of b's, so b goes below a.
+            trim_prefix(other.allocator_, b, common);
+            if (a.is_inline())
+                a.rebuild(allocator_, a_length, 0, 1);
+            a.set_subtree_count(count);
+            unsigned char byte = b.prefix()[0];
+            std::size_t k = a.find_edge(byte);
+            if (k < a.edgecount()) {
+                push_task(a, k, b);
+            } else {
+                b = move_subtree(allocator_, other.allocator_, b, copies);
+                a.add_edge(allocator_, byte, b);
+                pack_child(allocator_, a, a.find_edge(byte));
+                set_slot(root_, task.parent, task.edge_idx, a);
+            }
+            continue;
+        }
+
+        // Both nodes stand for the same position. Children of b with no
+        // counterpart in a are spliced in, and the others are merged
+        // once a has all of its edges and won't move any more.
+        std::uint32_t refs = a.refcount() + b.refcount();
+        if (a.is_inline()
+            && (b.edgecount() > 0 || refs > node::max_inline_refcount))
+            a.rebuild(allocator_, a_length, 0, 0);
+        a.set_refcount(refs);
+        a.set_subtree_count(count);
+        shared.clear();
+        for (std::size_t i = 0; i < b.edgecount(); ++i) {
+            unsigned char byte = b.first_byte_at(i);
+            node child = b.node_at(i);
+            if (a.find_edge(byte) < a.edgecount())
+                shared.emplace_back(byte, child);
+            else
+                a.add_edge(allocator_,
+                           byte,
+                           move_subtree(allocator_, other.allocator_, child,
+                                        copies));
+        }
+        set_slot(root_, task.parent, task.edge_idx, a);
+        for (auto const& edge : shared)
+            push_task(a, a.find_edge(edge.first), edge.second);
+        free_node(other.allocator_, b);
+    }
+
+    // Whatever the other tree still counts was spliced in here.
+    if (&allocator_.target() == &other.allocator_.target())
+        allocator_.adopt(other.allocator_);
+    other.root_ = make_node(other.allocator_, 0, 0, 0);
+    size_ += other.size_;
+    other.size_ = 0;
+}
+
+// Advances a position in a tree, given as a node and the number of
+// bytes of its prefix matched so far, over the bytes supplied. Returns
+// false if no key in the tree continues with them.
+static bool follow(node& n,
+                   std::size_t& matched,
+                   const unsigned char* bytes,
+                   std::size_t size)
+{
+    std::size_t i = 0;
+    while (i < size) {
+        if (matched == n.prefix_length()) {
+            std::size_t k = n.find_edge(bytes[i]);
+            if (k == n.edgecount())
+                return false;
+            n = n.node_at(k);
+            matched = 0;
+        }
+        std::size_t chunk = std::min(size - i,
+                                     n.prefix_length() - matched);
+        if (std::memcmp(bytes + i, n.prefix() + matched, chunk) != 0)
+            return false;
+        i += chunk;
+        matched += chunk;
+    }
+    return true;
+}
+
+// A node of this tree whose keys are being filtered, along with the
+// position in the other tree at the end of the node's prefix. Frames
+// are expanded on the way down and finished on the way back up, once
+// the nodes below have been dealt with.
+struct filter_frame
+{
+    node parent; // No parent for the root.
+    std::size_t edge_idx;
+    node a;
+    node b;
+    std::size_t b_matched;
+    bool expanded;
+};
+
+// Keeps the keys of the tree rooted at the node supplied that the other
+// tree holds if keep_shared is set, and the keys it doesn't hold
+// otherwise.
+static void filter_nodes(node_allocator& allocator,
+                         node& root,
+                         node other_root,
+                         bool keep_shared)
+{
+    std::vector<filter_frame> stack{
+        filter_frame{node(nullptr), 0, root, other_root, 0, false}};
+    while (!stack.empty()) {
+        filter_frame& frame = stack.back();
+        node a = frame.a;
+
+        if (frame.expanded) {
+            // Drop the children that lost all of their keys, then merge
+            // a with its child if it is left with one and no key.
+            for (std::size_t i = a.edgecount(); i-- > 0;) {
+                node child = a.node_at(i);
+                if (child.refcount() == 0 && child.edgecount() == 0) {
+                    free_node(allocator, child);
+                    a.remove_edge(allocator, i);
+                }
+            }
+            if (frame.parent.data_ != nullptr && a.refcount() == 0
+                && a.edgecount() == 1) {
+                RADIX_TREE_COUNT(merges, 1);
+                unsigned char child_slot[sizeof(void*)];
+                node child = detach(a.node_at(0), child_slot);
+                std::uint32_t old_prefix_length = a.prefix_length();
+                a.resize(allocator,
+                         old_prefix_length + child.prefix_length(),
+                         child.edgecount());
+                std::memcpy(a.prefix() + old_prefix_length,
+                            child.prefix(),
+                            child.prefix_length());
+                a.set_edges(child);
+                a.set_refcount(child.refcount());
+                free_node(allocator, child);
+            }
+            std::uint32_t count = a.refcount();
+            for (std::size_t i = 0; i < a.edgecount(); ++i)
+                count += a.node_at(i).subtree_count();
+            a.set_subtree_count(count);
+            set_slot(root, frame.parent, frame.edge_idx, a);
+            // Losing its children may have left a as a leaf that fits
+            // in its parent's slot.
+            if (frame.parent.data_ != nullptr)
+                pack_child(allocator, frame.parent, frame.edge_idx);
+            stack.pop_back();
+            continue;
+        }
+
+        node b = frame.b;
+        std::size_t b_matched = frame.b_matched;
+        bool shared = b_matched == b.prefix_length() && b.refcount() > 0;
+        if (shared != keep_shared && a.refcount() > 0) {
+            a.set_refcount(0);
+            if (a.prefix_is_external()) {
+                a.expand_prefix(allocator);
+                set_slot(root, frame.parent, frame.edge_idx, a);
+            }
+        }
+
+        // Children with no counterpart in the other tree hold no shared
+        // keys. They go right away if we only keep shared keys, and are
+        // left as they are otherwise.
+        if (keep_shared) {
+            for (std::size_t i = a.edgecount(); i-- > 0;) {
+                node child = a.node_at(i);
+                node position = b;
+                std::size_t matched = b_matched;
+                if (!follow(position, matched,
+                            child.prefix(), child.prefix_length())) {
+                    free_nodes(allocator, child);
+                    a.remove_edge(allocator, i);
+                }
+            }
+            set_slot(root, frame.parent, frame.edge_idx, a);
+        }
+        // The frame reference doesn't survive pushing onto the stack,
+        // so finish with the frame first.
+        frame.a = a;
+        frame.expanded = true;
+        for (std::size_t i = 0; i < a.edgecount(); ++i) {
+            node child = a.node_at(i);
+            node position = b;
+            std::size_t matched = b_matched;
+            if (follow(position, matched,
+                       child.prefix(), child.prefix_length()))
+                stack.push_back(
+                    filter_frame{a, i, child, position, matched, false});
+        }
+    }
+}
+
+void radix_tree::intersect(radix_tree const& other)
+{
+    assert(&other != this);
+    filter_nodes(allocator_, root_, other.root_, true);
+    size_ = root_.subtree_count();
+}
+
+void radix_tree::subtract(radix_tree const& other)
+{
+    assert(&other != this);
+    filter_nodes(allocator_, root_, other.root_, false);
+    size_ = root_.subtree_count();
+}
+
+bool radix_tree::contains(const unsigned char* key, std::size_t size) const
+{
+    RADIX_TREE_OPERATION(instruments_, contains, key, size);
+    return contains(root_, key, size);
+}
+
+bool radix_tree::contains(node root,
+                          const unsigned char* key,
+                          std::size_t size)
+{
+    match_result result = match(root, key, size);
+
+    return result.nkey == size
+        && result.nprefix == result.current_node.prefix_length()
+        && result.current_node.refcount();
+}
+
+// Number of walks interleaved by the batched lookups.
+static constexpr std::size_t batch_group_size = 16;
+
+// What a batched walk looks for.
+enum class lookup_mode
+{
+    key, // The key itself, as in contains().
+    shortest_prefix, // The first key on the way, as in any_prefix_of().
+    longest_prefix // The last key on the way, as in longest_prefix().
+};
+
+// Walks a group of keys down the tree in lockstep, advancing each walk
+// by one node per round, and stores the length of the key each walk
+// found in lengths, or 0 if it found none, and the number of times that
+// key was inserted in counts unless counts is nullptr.
+static void lookup_group(node root,
+                         const unsigned char* const* keys,
+                         const std::size_t* sizes,
+                         std::size_t count,
+                         std::size_t* lengths,
+                         std::size_t* counts,
+                         lookup_mode mode)
+{
+    assert(count <= batch_group_size);
+
+    node nodes[batch_group_size] = {
+        root, root, root, root, root, root, root, root,
+        root, root, root, root, root, root, root, root
+    };
+    std::size_t matched[batch_group_size] = {}; // Characters matched.
+    std::size_t active[batch_group_size]; // Walks still in progress.
+    std::size_t nactive = count;
+    RADIX_TREE_COUNT(lookups, count);
+    for (std::size_t k = 0; k < count; ++k) {
+        assert(keys[k]);
+        active[k] = k;
+        lengths[k] = 0;
+        if (counts)
+            counts[k] = 0;
+    }
+
+    while (nactive > 0) {
+        std::size_t still_active = 0;
+        for (std::size_t a = 0; a < nactive; ++a) {
+            std::size_t k = active[a];
+            node n = nodes[k];
+            const unsigned char* key = keys[k];
+            std::size_t size = sizes[k];
+            std::size_t i = matched[k];
+
+            std::uint32_t prefix_length = n.prefix_length();
+            RADIX_TREE_COUNT(nodes_visited, 1);
+            RADIX_TREE_COUNT(prefix_bytes_compared,
+                             size - i < prefix_length ? 0 : prefix_length);
+            if (size - i < prefix_length
+                || std::memcmp(n.prefix(), key + i, prefix_length))
+                continue;
+            i += prefix_length;
+
+            if (n.refcount() > 0
+                && (mode != lookup_mode::key || i == size)) {
+                lengths[k] = i;
+                if (counts)
+                    counts[k] = n.refcount();
+                if (mode == lookup_mode::shortest_prefix)
+                    continue;
+            }
+            if (i == size)
+                continue;
+
+            std::size_t edge_idx = n.find_edge(key[i]);
+            if (edge_idx == n.edgecount())
+                continue; // No outgoing edge.
+            nodes[k] = n.node_at(edge_idx);
+            matched[k] = i;
+            prefetch_node(nodes[k]);
+            active[still_active++] = k;
+        }
+        nactive = still_active;
+    }
+}
+
+// Runs the batched walks a group at a time.
+static void lookup_batch(node root,
+                         const unsigned char* const* keys,
+                         const std::size_t* sizes,
+                         std::size_t count,
+                         std::size_t* lengths,
+                         std::size_t* counts,
+                         lookup_mode mode)
+{
+    for (std::size_t k = 0; k < count; k += batch_group_size) {
+        std::size_t n = count - k < batch_group_size ? count - k
+                                                     : batch_group_size;
+        lookup_group(root, keys + k, sizes + k, n, lengths + k,
+                     counts ? counts + k : nullptr, mode);
+    }
+}
+
+// Same as above, for the lookups that only report whether they found a
+// key.
+static void lookup_batch(node root,
+                         const unsigned char* const* keys,
+                         const std::size_t* sizes,
+                         std::size_t count,
+                         bool* results,
+                         lookup_mode mode)
+{
+    std::size_t lengths[batch_group_size];
+    for (std::size_t k = 0; k < count; k += batch_group_size) {
+        std::size_t n = count - k < batch_group_size ? count - k
+                                                     : batch_group_size;
+        lookup_group(root, keys + k, sizes + k, n, lengths, nullptr, mode);
+        for (std::size_t r = 0; r < n; ++r)
+            results[k + r] = lengths[r] > 0;
+    }
+}
+
+void radix_tree::contains_batch(const unsigned char* const* keys,
+                                const std::size_t* sizes,
+                                std::size_t count,
+                                bool* results) const
+{
+    RADIX_TREE_OPERATION(instruments_, contains_batch, nullptr, count);
+    contains_batch(root_, keys, sizes, count, results);
+}
+
+void radix_tree::contains_batch(node root,
+                                const unsigned char* const* keys,
+                                const std::size_t* sizes,
+                                std::size_t count,
+                                bool* results)
+{
+    lookup_batch(root, keys, sizes, count, results, lookup_mode::key);
+}
+
+void radix_tree::any_prefix_of_batch(const unsigned char* const* data,
+                                     const std::size_t* sizes,
+                                     std::size_t count,
+                                     bool* results) const
+{
+    RADIX_TREE_OPERATION(instruments_, any_prefix_of_batch, nullptr, count);
+    any_prefix_of_batch(root_, data, sizes, count, results);
+}
+
+void radix_tree::any_prefix_of_batch(node root,
+                                     const unsigned char* const* data,
+                                     const std::size_t* sizes,
+                                     std::size_t count,
+                                     bool* results)
+{
+    lookup_batch(root,
+                 data,
+                 sizes,
+                 count,
+                 results,
+                 lookup_mode::shortest_prefix);
+}
+
+bool radix_tree::any_prefix_of(const unsigned char* data,
+                               std::size_t size) const
+{
+    RADIX_TREE_OPERATION(instruments_, any_prefix_of, data, size);
+    return any_prefix_of(root_, data, size);
+}
+
+bool radix_tree::any_prefix_of(node root,
+                               const unsigned char* data,
+                               std::size_t size)
+{
+    assert(data);
+
+    std::size_t i = 0; // Number of characters matched in data.
+    node current_node = root;
+    RADIX_TREE_COUNT(lookups, 1);
+
+    while (true) {
+        std::uint32_t prefix_length = current_node.prefix_length();
+        RADIX_TREE_COUNT(nodes_visited, 1);
+        RADIX_TREE_COUNT(prefix_bytes_compared,
+                         size - i < prefix_length ? 0 : prefix_length);
+        if (size - i < prefix_length
+            || std::memcmp(current_node.prefix(), data + i, prefix_length))
+            return false;
+        i += prefix_length;
+
+        // Keys are only held by nodes whose prefix matched completely,
+        // so the first one we reach is the shortest matching key.
+        if (current_node.refcount() > 0)
+            return true;
+        if (i == size)
+            return false;
+
+        std::size_t k = current_node.find_edge(data[i]);
+        if (k == current_node.edgecount())
+            return false; // No outgoing edge.
+        current_node = current_node.node_at(k);
+    }
+}
+
+std::size_t radix_tree::longest_prefix(const unsigned char* data,
+                                       std::size_t size,
+                                       std::size_t* count) const
+{
+    RADIX_TREE_OPERATION(instruments_, longest_prefix, data, size);
+    node holder = root_;
+    std::size_t length = longest_prefix(root_, data, size, &holder);
+    if (count)
+        *count = length > 0 ? holder.refcount() : 0;
+    return length;
+}
+
+std::size_t radix_tree::longest_prefix(node root,
+                                       const unsigned char* data,
+                                       std::size_t size,
+                                       node* holder)
+{
+    assert(data);
+
+    std::size_t i = 0; // Number of characters matched in data.
+    std::size_t length = 0; // Length of the longest key found so far.
+    node current_node = root;
+    RADIX_TREE_COUNT(lookups, 1);
+
+    while (true) {
+        std::uint32_t prefix_length = current_node.prefix_length();
+        RADIX_TREE_COUNT(nodes_visited, 1);
+        RADIX_TREE_COUNT(prefix_bytes_compared,
+                         size - i < prefix_length ? 0 : prefix_length);
+        if (size - i < prefix_length
+            || std::memcmp(current_node.prefix(), data + i, prefix_length))
+            return length;
+        i += prefix_length;
+
+        if (current_node.refcount() > 0) {
+            length = i;
+            *holder = current_node;
+        }
+        if (i == size)
+            return length;
+
+        std::size_t k = current_node.find_edge(data[i]);
+        if (k == current_node.edgecount())
+            return length; // No outgoing edge.
+        current_node = current_node.node_at(k);
+    }
+}
+
+void radix_tree::longest_prefix_batch(const unsigned char* const* data,
+                                      const std::size_t* sizes,
+                                      std::size_t count,
+                                      std::size_t* lengths,
+                                      std::size_t* counts) const
+{
+    RADIX_TREE_OPERATION(instruments_, longest_prefix_batch, nullptr, count);
+    longest_prefix_batch(root_, data, sizes, count, lengths, counts);
+}
+
+void radix_tree::longest_prefix_batch(node root,
+                                      const unsigned char* const* data,
+                                      const std::size_t* sizes,
+                                      std::size_t count,
+                                      std::size_t* lengths,
+                                      std::size_t* counts)
+{
+    lookup_batch(root,
+                 data,
+                 sizes,
+                 count,
+                 lengths,
+                 counts,
+                 lookup_mode::longest_prefix);
+}
+
+void radix_tree::match_prefixes(const unsigned char* data,
+                                std::size_t size,
+                                void (*func)(const unsigned char* data,
+                                             std::size_t size,
+                                             void* arg),
+                                void* arg) const
+{
+    RADIX_TREE_OPERATION(instruments_, match_prefixes, data, size);
+    match_prefixes(root_, data, size, func, arg);
+}
+
+void radix_tree::match_prefixes(node root,
+                                const unsigned char* data,
+                                std::size_t size,
+                                void (*func)(const unsigned char* data,
+                                             std::size_t size,
+                                             void* arg),
+                                void* arg)
+{
+    assert(data);
+
+    std::size_t i = 0; // Number of characters matched in data.
+    node current_node = root;
+    RADIX_TREE_COUNT(lookups, 1);
+
+    while (true) {
+        std::uint32_t prefix_length = current_node.prefix_length();
+        RADIX_TREE_COUNT(nodes_visited, 1);
+        RADIX_TREE_COUNT(prefix_bytes_compared,
+                         size - i < prefix_length ? 0 : prefix_length);
+        if (size - i < prefix_length
+            || std::memcmp(current_node.prefix(), data + i, prefix_length))
+            return;
+        i += prefix_length;
+
+        if (current_node.refcount() > 0)
+            func(data, i, arg);
+        if (i == size)
+            return;
+
+        std::size_t k = current_node.find_edge(data[i]);
+        if (k == current_node.edgecount())
+            return; // No outgoing edge.
+        current_node = current_node.node_at(k);
+    }
+}
+
+// Applies the function to each key in the tree rooted at the node
+// supplied, in pre-order. The buffer holds the part of the key above the
+// node. The path to the current node is kept on an explicit stack, along
+// with the next edge to take from each node on it.
+static void visit_keys(node root,
+                       std::vector<unsigned char>& buffer,
+                       void (*func)(unsigned char* data,
+                                    std::size_t size,
+                                    void* arg),
+                       void *arg)
+{
+    struct frame
+    {
+        node n;
+        std::size_t edge;
+    };
+    std::vector<frame> stack;
+
+    node n = root;
+    while (true) {
+        buffer.insert(buffer.end(), n.prefix(), n.prefix() + n.prefix_length());
+        if (n.refcount() > 0)
+            func(buffer.data(), buffer.size(), arg);
+        stack.push_back(frame{n, 0});
+
+        // Go back up to the closest node with an edge left to take.
+        while (stack.back().edge == stack.back().n.edgecount()) {
+            buffer.resize(buffer.size() - stack.back().n.prefix_length());
+            stack.pop_back();
+            if (stack.empty())
+                return;
+        }
+        frame& top = stack.back();
+        n = top.n.node_at(top.edge++);
+    }
+}
+
+void radix_tree::apply(void (*func)(unsigned char* data,
+                                    std::size_t size,
+                                    void* arg),
+                       void* arg)
+{
+    apply(root_, func, arg);
+}
+
+void radix_tree::apply(node root,
+                       void (*func)(unsigned char* data,
+                                    std::size_t size,
+                                    void* arg),
+                       void* arg)
+{
+    std::vector<unsigned char> buffer;
+    visit_keys(root, buffer, func, arg);
+}
+
+void radix_tree::apply_prefix(const unsigned char* prefix,
+                              std::size_t size,
+                              void (*func)(unsigned char* data,
+                                           std::size_t size,
+                                           void* arg),
+                              void* arg) const
+{
+    if (size == 0) {
+        apply(root_, func, arg);
+        return;
+    }
+
+    // The key ends in the prefix of the current node if at all, and
+    // every key below that node starts with it.
+    match_result result = match(prefix, size);
+    if (result.nkey != size)
+        return;
+
+    std::vector<unsigned char> buffer(prefix, prefix + size - result.nprefix);
+    visit_keys(result.current_node, buffer, func, arg);
+}
+
+std::size_t radix_tree::count_prefix(const unsigned char* prefix,
+                                     std::size_t size) const
+{
+    if (size == 0)
+        return size_;
+
+    match_result result = match(prefix, size);
+    if (result.nkey != size)
+        return 0;
+    return result.current_node.subtree_count();
+}
+
+// Edges are sorted by their first byte, so the iterator finds the edge
+// it takes next by rank. These return the index of the edge with the
+// smallest first byte above the one supplied, or with the largest first
+// byte below it, or the edgecount if there is no such edge.
+static std::size_t next_edge(node n, int after)
+{
+    if (after >= 255)
+        return n.edgecount();
+    return n.rank(static_cast<unsigned char>(after + 1));
+}
+
+static std::size_t prev_edge(node n, int before)
+{
+    std::size_t below = before > 255 ? n.edgecount()
+        : before > 0 ? n.rank(static_cast<unsigned char>(before))
+                     : 0;
+    return below > 0 ? below - 1 : n.edgecount();
+}
+
+radix_tree::iterator::iterator(node root)
+    : root_(root)
+{}
+
+const unsigned char* radix_tree::iterator::data() const
+{
+    assert(!stack_.empty());
+    return key_.data();
+}
+
+std::size_t radix_tree::iterator::size() const
+{
+    assert(!stack_.empty());
+    return key_.size();
+}
+
+void radix_tree::iterator::push(node n)
+{
+    stack_.push_back(frame{n, key_.size(), -1});
+    key_.insert(key_.end(), n.prefix(), n.prefix() + n.prefix_length());
+}
+
+void radix_tree::iterator::pop()
+{
+    key_.resize(stack_.back().key_size);
+    stack_.pop_back();
+}
+
+// Moves to the next node holding a key in depth-first order, starting
+// after the edge last taken from the node on top of the stack.
+void radix_tree::iterator::next()
+{
+    while (!stack_.empty()) {
+        node n = stack_.back().n;
+        std::size_t k = next_edge(n, stack_.back().edge);
+        if (k == n.edgecount()) {
+            pop();
+            continue;
+        }
+        stack_.back().edge = n.first_byte_at(k);
+        node child = n.node_at(k);
+        push(child);
+        if (child.refcount() > 0)
+            return;
+    }
+}
+
+// Moves to the last key below the node on top of the stack, which is
+// held by the node reached by always taking the largest edge.
+void radix_tree::iterator::descend_last()
+{
+    while (stack_.back().n.edgecount() > 0) {
+        node n = stack_.back().n;
+        std::size_t k = prev_edge(n, 256);
+        stack_.back().edge = n.first_byte_at(k);
+        push(n.node_at(k));
+    }
+    if (stack_.back().n.refcount() == 0) {
+        // Only an empty root has neither keys nor edges.
+        pop();
+    }
+}
+
+radix_tree::iterator& radix_tree::iterator::operator++()
+{
+    assert(!stack_.empty());
+    next();
+    return *this;
+}
+
+radix_tree::iterator& radix_tree::iterator::operator--()
+{
+    if (stack_.empty()) {
+        push(root_);
+        descend_last();
+        return *this;
+    }
+
+    while (true) {
+        pop();
+        if (stack_.empty())
+            return *this;
+
+        // The keys below a smaller edge of the parent come right
+        // before ours, otherwise it is the parent's own key.
+        node parent = stack_.back().n;
+        std::size_t k = prev_edge(parent, stack_.back().edge);
+        if (k != parent.edgecount()) {
+            stack_.back().edge = parent.first_byte_at(k);
+            push(parent.node_at(k));
+            descend_last();
+            return *this;
+        }
+        stack_.back().edge = -1;
+        if (parent.refcount() > 0)
+            return *this;
+    }
+}
+
+bool radix_tree::iterator::operator==(iterator const& other) const
+{
+    if (stack_.empty() || other.stack_.empty())
+        return stack_.empty() && other.stack_.empty();
+    return stack_.back().n == other.stack_.back().n;
+}
+
+bool radix_tree::iterator::operator!=(iterator const& other) const
+{
+    return !(*this == other);
+}
+
+void radix_tree::iterator::seek(const unsigned char* key, std::size_t size)
+{
+    stack_.clear();
+    key_.clear();
+    push(root_);
+
+    std::size_t i = 0; // Number of characters matched in key.
+    while (true) {
+        node n = stack_.back().n;
+        if (i == size) {
+            // The key ends at this node, so its own key comes first
+            // and everything below it comes after the key.
+            if (n.refcount() == 0)
+                next();
+            return;
+        }
+
+        // Keys below edges with a larger first byte come after the
+        // key, and the node's own key and the keys below edges with a
+        // smaller first byte come before it.
+        stack_.back().edge = key[i];
+        std::size_t k = n.find_edge(key[i]);
+        if (k == n.edgecount()) {
+            next();
+            return;
+        }
+
+        node child = n.node_at(k);
+        push(child);
+        std::size_t prefix_length = child.prefix_length();
+        std::size_t limit = std::min(prefix_length, size - i);
+        std::size_t j = common_prefix_length(child.prefix(), key + i, limit);
+        if (j == prefix_length) {
+            i += prefix_length;
+            continue;
+        }
+
+        if (j == size - i || child.prefix()[j] > key[i + j]) {
+            // Every key below the child comes after the key.
+            if (child.refcount() == 0)
+                next();
+        } else {
+            // Every key below the child comes before the key.
+            pop();
+            next();
+        }
+        return;
+    }
+}
+
+radix_tree::iterator radix_tree::begin() const
+{
+    iterator it(root_);
+    it.push(root_);
+    it.next();
+    return it;
+}
+
+radix_tree::iterator radix_tree::end() const
+{
+    return iterator(root_);
+}
+
+radix_tree::iterator radix_tree::lower_bound(const unsigned char* key,
+                                             std::size_t size) const
+{
+    iterator it(root_);
+    it.seek(key, size);
+    return it;
+}
+
+// Compares byte strings the way the iterator orders them.
+static bool key_less(const unsigned char* a,
+                     std::size_t a_size,
+                     const unsigned char* b,
+                     std::size_t b_size)
+{
+    std::size_t common = std::min(a_size, b_size);
+    int order = common == 0 ? 0 : std::memcmp(a, b, common);
+    return order < 0 || (order == 0 && a_size < b_size);
+}
+
+void radix_tree::apply_range(const unsigned char* first,
+                             std::size_t first_size,
+                             const unsigned char* last,
+                             std::size_t last_size,
+                             void (*func)(const unsigned char* data,
+                                          std::size_t size,
+                                          void* arg),
+                             void* arg) const
+{
+    for (iterator it = lower_bound(first, first_size); it != end(); ++it) {
+        if (!key_less(it.data(), it.size(), last, last_size))
+            break;
+        func(it.data(), it.size(), arg);
+    }
+}
+
+std::size_t radix_tree::size() const
+{
+    return size_;
+}
+
+// Adds one to entry i of a histogram, growing it as needed.
+static void count_at(std::vector<std::size_t>& histogram, std::size_t i)
+{
+    if (histogram.size() <= i)
+        histogram.resize(i + 1, 0);
+    ++histogram[i];
+}
+
+radix_tree_stats radix_tree::stats() const
+{
+    radix_tree_stats stats{size_, 0, 0, 0, 0, 0, {}, {}, {}};
+
+    struct visit
+    {
+        node n;
+        std::size_t depth;
+    };
+    std::vector<visit> stack{visit{root_, 0}};
+    while (!stack.empty()) {
+        visit v = stack.back();
+        stack.pop_back();
+
+        std::size_t edges = v.n.edgecount();
+        ++stats.nodes;
+        stats.leaves += edges == 0;
+        stats.inline_leaves += v.n.is_inline();
+        stats.bytes += v.n.size();
+        if (v.depth > stats.max_depth)
+            stats.max_depth = v.depth;
+        count_at(stats.edgecounts, edges);
+        count_at(stats.prefix_lengths, v.n.prefix_length());
+        if (v.n.refcount() > 0)
+            count_at(stats.key_depths, v.depth);
+
+        for (std::size_t i = 0; i < edges; ++i)
+            stack.push_back(visit{v.n.node_at(i), v.depth + 1});
+    }
+    return stats;
+}
+
+std::size_t radix_tree::memory_usage() const
+{
+    return allocator_.bytes();
+}
+
+std::size_t radix_tree::node_count() const
+{
+    return allocator_.blocks();
+}
+
+radix_tree_metrics radix_tree::metrics() const
+{
+#if defined(RADIX_TREE_INSTRUMENTATION)
+    return instruments_.snapshot();
+#else
+    return radix_tree_metrics();
+#endif
+}
+
+void radix_tree::reset_metrics()
+{
+#if defined(RADIX_TREE_INSTRUMENTATION)
+    instruments_.reset();
+#endif
+}
+
+void radix_tree::set_trace(radix_tree_trace_func func, void* arg)
+{
+#if defined(RADIX_TREE_INSTRUMENTATION)
+    instruments_.trace_func = func;
+    instruments_.trace_arg = arg;
+#else
+    static_cast<void>(func);
+    static_cast<void>(arg);
+#endif
+}
+
+double radix_tree_stats::leaf_ratio() const
+{
+    std::size_t inner = nodes - leaves;
+    return inner == 0 ? 0.0
+                      : static_cast<double>(leaves)
+                            / static_cast<double>(inner);
+}
+
+double radix_tree_stats::bytes_per_key() const
+{
+    return keys == 0 ? 0.0
+                     : static_cast<double>(bytes) / static_cast<double>(keys);
 }
 
 static void visit_child(node child_node, std::size_t level)
@@ -503,13 +2624,46 @@ static void visit_child(node child_node, std::size_t level)
     if (child_node.refcount() > 0)
         std::printf(" [*]");
     std::printf("\n");
-    for (std::uint32_t i = 0; i < child_node.edgecount(); ++i)
-        visit_child(child_node.node_at(i), level + 1);
+}
+
+void radix_tree::serialize(std::vector<unsigned char>& buffer) const
+{
+    write_snapshot(root_, size_, buffer);
+}
+
+bool radix_tree::serialize(const char* path) const
+{
+    assert(path);
+
+    std::vector<unsigned char> buffer;
+    serialize(buffer);
+
+    std::FILE* file = std::fopen(path, "wb");
+    if (!file)
+        return false;
+    bool written =
+        std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+    return std::fclose(file) == 0 && written;
 }
 
 void radix_tree::print()
 {
     std::puts("[root]");
-    for (std::uint32_t i = 0; i < root_.edgecount(); ++i)
-        visit_child(root_.node_at(i), 1);
+
+    // Children are pushed last to first so they're printed in order.
+    struct visit
+    {
+        node n;
+        std::size_t level;
+    };
+    std::vector<visit> stack;
+    for (std::uint32_t i = root_.edgecount(); i-- > 0;)
+        stack.push_back(visit{root_.node_at(i), 1});
+    while (!stack.empty()) {
+        visit v = stack.back();
+        stack.pop_back();
+        visit_child(v.n, v.level);
+        for (std::uint32_t i = v.n.edgecount(); i-- > 0;)
+            stack.push_back(visit{v.n.node_at(i), v.level + 1});
+    }
 }
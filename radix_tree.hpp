@@ -1,12 +1,16 @@
 #ifndef RADIX_TREE_HPP
 #define RADIX_TREE_HPP
 
+#include "instrumentation.hpp"
+#include "node_allocator.hpp"
+
 #include <cstddef>
 #include <cstdint>
+#include <vector>
 
 // Wrapper type for a node's data layout.
 //
-// There are 3 32-bit unsigned integers that act as a header. These
+// There are 5 32-bit unsigned integers that act as a header. These
 // integers represent the following values in this order:
 //
 // (1) The reference count of the key held by the node. This is 0 if
@@ -18,23 +22,83 @@
 //
 // (3) The number of outgoing edges from this node.
 //
+// (4) The number of edges the node has room for in the low 15 bits.
+// Edges are added and removed in place until this runs out, and the
+// capacity grows and shrinks geometrically. The next bit is set if the
+// prefix is held outside the node. The high 16 bits hold the size of
+// the value slot, which is 0 except in the nodes of a radix_map.
+//
+// (5) The number of keys in the subtree rooted at the node, counting
+// each key as many times as it was inserted. The root holds the size
+// of the whole tree.
+//
+// Nodes with a value slot keep it after the header, padded so that it
+// is aligned for a pointer. The slot holds the value of the key held by
+// the node, and is unused if the node doesn't hold a key.
+//
 // The rest of the layout consists of 3 chunks in this order:
 //
 // (1) The node's prefix as a sequence of one or more bytes. The root
 // node always has an empty prefix, unlike other nodes in the tree.
+// A node whose prefix is external holds a pointer to the bytes instead,
+// which is how trees with key_storage::external refer to their keys.
 //
-// (2) The first byte of the prefix of each of this node's children.
+// (2) The first byte of the prefix of each of this node's children in
+// ascending order, followed by unused room up to the capacity.
 //
-// (3) The pointer to the data layout of each child.
+// (3) The pointer to the data layout of each child, again followed by
+// unused room up to the capacity.
 //
 // The link to each child is looked up using its index, e.g. the child
 // with index 0 will have its first byte and node pointer at the start
-// of the chunk of first bytes and node pointers respectively.
+// of the chunk of first bytes and node pointers respectively. Edges are
+// inserted and removed by shifting the ones above them, so the children
+// are always in key order.
+//
+// How the chunk of first bytes is searched depends on the size of the
+// node, in the spirit of the adaptive radix tree:
+//
+// - Nodes with up to 4 edges are scanned one byte at a time, up to the
+// first byte that isn't below the one looked up.
+//
+// - Nodes with up to 16 edges are compared in a single vector
+// instruction where one is available, and binary searched otherwise.
+//
+// - Nodes with room for more than 16 edges keep a 256-byte child index
+// between the first bytes and the node pointers. It maps a byte to the
+// index of the edge starting with it, so the lookup takes constant
+// time. Each entry is checked against the chunk of first bytes, which
+// means entries for removed edges never have to be cleared.
+//
+// A node switches between these layouts when its capacity crosses the
+// last threshold.
+//
+// A leaf whose prefix is at most max_inline_prefix bytes long and whose
+// key was inserted at most max_inline_refcount times doesn't get a node
+// of its own, unless it has a value slot. It lives in its parent's node
+// pointer instead: the byte holding the low bits of the pointer is a tag
+// with the lowest bit set, which no node's address has, the next 3 bits
+// holding the prefix length and the high 4 bits the reference count. The
+// prefix takes up the other bytes. Such a leaf is wrapped by a node whose
+// data points at the pointer slot, and reads like any other leaf: it has
+// no edges, and its subtree count is its reference count. A node pointing
+// at a slot only stays valid while the parent's edges don't move.
 struct node
 {
     unsigned char* data_;
+    bool inline_;
+
+    // Size of the 5 integers in front of every layout.
+    static constexpr std::size_t header_size = 5 * sizeof(std::uint32_t);
+    static constexpr std::size_t max_inline_prefix = sizeof(void*) - 1;
+    static constexpr std::uint32_t max_inline_refcount = 15;
 
     explicit node(unsigned char* data);
+    // Wraps the leaf held in the pointer slot supplied.
+    static node inline_leaf(unsigned char* slot);
+
+    // Whether the node is a leaf held in its parent's pointer slot.
+    bool is_inline() const;
 
     bool operator==(node other) const;
     bool operator!=(node other) const;
@@ -42,26 +106,98 @@ struct node
     std::uint32_t refcount();
     std::uint32_t prefix_length();
     std::uint32_t edgecount();
+    std::uint32_t capacity();
+    std::uint32_t subtree_count();
+    std::uint32_t value_size();
+    unsigned char* value();
+    bool prefix_is_external();
+    // The prefix bytes, wherever they are held. An external prefix must
+    // not be written to.
     unsigned char* prefix();
+    // The part of the layout holding the prefix or the pointer to it.
+    unsigned char* prefix_chunk();
+    std::size_t prefix_chunk_size();
     unsigned char* first_bytes();
     unsigned char first_byte_at(std::size_t i);
+    unsigned char* child_index();
     unsigned char* node_ptrs();
+    // Offsets of the chunks above from the start of the layout. They
+    // only depend on the header, so a copy of it is enough to find the
+    // chunks of the node it was copied from.
+    std::size_t prefix_chunk_offset();
+    std::size_t first_bytes_offset();
+    std::size_t child_index_offset();
+    std::size_t node_ptrs_offset();
     node node_at(std::size_t i);
+    // Returns the index of the edge whose first byte is the byte
+    // supplied, or edgecount() if there is no such edge.
+    std::size_t find_edge(unsigned char byte);
+    // Returns the number of edges whose first byte is below the byte
+    // supplied, which is the index an edge starting with it goes at.
+    std::size_t rank(unsigned char byte);
     void set_refcount(std::uint32_t value);
     void set_prefix_length(std::uint32_t value);
     void set_edgecount(std::uint32_t value);
+    void set_capacity(std::uint32_t value);
+    void set_subtree_count(std::uint32_t value);
+    void set_value_size(std::uint32_t value);
+    // Copies the value slot of a node with the same value size.
+    void copy_value(node other);
     void set_prefix(unsigned char const* prefix);
-    void set_first_bytes(unsigned char const* bytes);
+    // Points a node made by make_external_node() at its prefix.
+    void set_external_prefix(unsigned char const* prefix);
+    // Copies an external prefix into the node, which moves it.
+    void expand_prefix(node_allocator& allocator);
     void set_first_byte_at(std::size_t i, unsigned char byte);
-    void set_node_ptrs(unsigned char const* ptrs);
     void set_node_at(std::size_t i, node n);
     void set_edge_at(std::size_t i, unsigned char byte, node n);
-    void resize(std::size_t prefix_length, std::size_t edgecount);
+    // Copies all edges from a node with the same edgecount.
+    void set_edges(node other);
+    void add_edge(node_allocator& allocator, unsigned char byte, node n);
+    void remove_edge(node_allocator& allocator, std::size_t i);
+    // Size of the data layout in bytes, which is 0 for a leaf held in
+    // its parent's pointer slot.
+    std::size_t size();
+    // Keeps the first min(old, new) bytes of the prefix and edges, and
+    // leaves no room for more edges.
+    void resize(node_allocator& allocator,
+                std::size_t prefix_length,
+                std::size_t edgecount);
+    // Like resize(), but with room for the number of edges supplied.
+    // The prefix stays external if its length doesn't change.
+    void reshape(node_allocator& allocator,
+                 std::size_t prefix_length,
+                 std::size_t edgecount,
+                 std::size_t capacity);
+    // Like reshape(), but always builds a new node holding its prefix.
+    // Both move a leaf out of its parent's pointer slot into a node of
+    // its own, which the parent has to be pointed at.
+    void rebuild(node_allocator& allocator,
+                 std::size_t prefix_length,
+                 std::size_t edgecount,
+                 std::size_t capacity);
 };
 
-node make_node(std::size_t refcount,
+node make_node(node_allocator& allocator,
+               std::size_t refcount,
                std::size_t prefix_length,
-               std::size_t nedges);
+               std::size_t nedges,
+               std::size_t value_size = 0);
+
+// Makes a node that refers to the prefix supplied instead of copying it.
+node make_external_node(node_allocator& allocator,
+                        std::size_t refcount,
+                        const unsigned char* prefix,
+                        std::size_t prefix_length,
+                        std::size_t nedges,
+                        std::size_t value_size = 0);
+
+// Returns the number of leading bytes two byte strings of at least size
+// bytes have in common. The strings are compared 16 or 8 bytes at a
+// time, which pays off for the long prefixes of compressed paths.
+std::size_t common_prefix_length(const unsigned char* a,
+                                 const unsigned char* b,
+                                 std::size_t size);
 
 struct match_result
 {
@@ -74,31 +210,396 @@ struct match_result
     node grandparent_node;
 };
 
+// The shape of a tree and the memory it uses, as found by a walk over
+// all of its nodes.
+struct radix_tree_stats
+{
+    std::size_t keys; // Same as radix_tree::size().
+    std::size_t nodes;
+    std::size_t leaves; // Nodes without outgoing edges.
+    std::size_t inline_leaves; // Leaves held in their parent's slot.
+    std::size_t bytes; // Size of all node layouts together.
+    std::size_t max_depth; // Edges between the root and the deepest node.
+
+    // Entry i of each histogram counts the nodes with i outgoing
+    // edges, with a prefix of i bytes, or holding a key i edges below
+    // the root respectively.
+    std::vector<std::size_t> edgecounts;
+    std::vector<std::size_t> prefix_lengths;
+    std::vector<std::size_t> key_depths;
+
+    // Leaves per inner node.
+    double leaf_ratio() const;
+    double bytes_per_key() const;
+};
+
+// How a radix_tree stores the bytes of the keys inserted into it.
+//
+// With key_storage::copied, every node holds a copy of its prefix.
+//
+// With key_storage::external, the leaves made for insert() and
+// build_from_sorted() refer to the bytes of the key supplied instead of
+// copying the part of it past their parent. This saves most of the
+// memory of long keys with unique tails, such as URLs or topics ending
+// in an identifier, when the caller keeps the keys anyway, e.g. in
+// message buffers or an interned string table. The bytes of a key must
+// stay valid and unchanged until the tree no longer holds the key, and
+// for a key inserted more than once, that goes for the bytes passed to
+// each insertion. Nodes take a copy of their prefix when they are
+// merged or stop holding their key, and so does the upper part of a
+// node that is split.
+enum class key_storage
+{
+    copied,
+    external
+};
+
 class radix_tree
 {
 public:
     radix_tree();
+    // Stores the tree's nodes using the allocator supplied, which has
+    // to outlive the tree.
+    explicit radix_tree(node_allocator& allocator);
+    radix_tree(node_allocator& allocator, key_storage storage);
     ~radix_tree();
 
+    radix_tree(radix_tree const&) = delete;
+    radix_tree& operator=(radix_tree const&) = delete;
+
     // Returns true if the key wasn't already present in the tree.
     bool insert(const unsigned char* key, std::size_t size);
 
     // Returns true if the key was actually removed from the tree.
     bool erase(const unsigned char* key, std::size_t size);
 
+    // Moves every key of the other tree into this one and leaves the
+    // other tree empty. Keys held by both trees end up with the sum of
+    // their reference counts.
+    //
+    // The two trees are walked in lockstep, and each subtree of the
+    // other tree that has no counterpart here is spliced in whole, so
+    // the work depends on where the trees overlap rather than on how
+    // many keys they hold. Nodes only change hands between trees using
+    // the same allocator; otherwise the spliced subtrees are copied.
+    //
+    // If the other tree has key_storage::external and this one doesn't,
+    // the spliced nodes take a copy of the key bytes they refer to. If
+    // both have it, the bytes of the other tree's keys must stay valid
+    // for as long as this tree holds the keys.
+    void merge(radix_tree& other);
+
+    // Removes the keys that the other tree doesn't hold. The keys left
+    // keep their reference counts. Subtrees with no counterpart in the
+    // other tree are freed without looking at their keys.
+    void intersect(radix_tree const& other);
+
+    // Removes the keys that the other tree holds, whatever their
+    // reference counts. Subtrees with no counterpart in the other tree
+    // are left alone.
+    void subtract(radix_tree const& other);
+
+    // Replaces the contents of the tree with the keys supplied, which
+    // must be sorted in ascending byte order. Repeated keys have their
+    // reference count raised like repeated insertions. Every node is
+    // allocated once at its final size, parents before children, so
+    // an allocator handing out consecutive blocks lays the tree out in
+    // depth-first order.
+    void build_from_sorted(const unsigned char* const* keys,
+                           const std::size_t* sizes,
+                           std::size_t count);
+
+    // Same as above for a range of byte strings, e.g. std::string.
+    template <typename Iterator>
+    void build_from_sorted(Iterator first, Iterator last);
+
     bool contains(const unsigned char* key, std::size_t size) const;
 
-    // Applies the function supplied to each key in the tree.
+    // Looks up count keys at once, storing whether the tree contains
+    // keys[k] in results[k]. The walks for a group of keys are
+    // interleaved, and the next node of each walk is prefetched while
+    // the other walks advance, which hides much of the latency of
+    // reading nodes that aren't in the cache.
+    void contains_batch(const unsigned char* const* keys,
+                        const std::size_t* sizes,
+                        std::size_t count,
+                        bool* results) const;
+
+    // Returns true if some key in the tree is a prefix of the data
+    // supplied. This walks the tree once and stops at the first node
+    // holding a key.
+    bool any_prefix_of(const unsigned char* data, std::size_t size) const;
+
+    // Batched version of any_prefix_of(), interleaved like
+    // contains_batch().
+    void any_prefix_of_batch(const unsigned char* const* data,
+                             const std::size_t* sizes,
+                             std::size_t count,
+                             bool* results) const;
+
+    // Returns the length of the longest key in the tree that is a
+    // prefix of the data supplied, or 0 if there is none, and stores
+    // the number of times that key was inserted in *count unless count
+    // is nullptr. This walks the tree once, like any_prefix_of(), but
+    // goes on past the first node holding a key.
+    std::size_t longest_prefix(const unsigned char* data,
+                               std::size_t size,
+                               std::size_t* count = nullptr) const;
+
+    // Batched version of longest_prefix(), interleaved like
+    // contains_batch(), which stores the length found for data[k] in
+    // lengths[k], and the count in counts[k] unless counts is nullptr.
+    void longest_prefix_batch(const unsigned char* const* data,
+                              const std::size_t* sizes,
+                              std::size_t count,
+                              std::size_t* lengths,
+                              std::size_t* counts = nullptr) const;
+
+    // Applies the function supplied to each key in the tree that is a
+    // prefix of the data supplied, shortest key first. The function
+    // receives the data along with the length of the matching key.
+    void match_prefixes(const unsigned char* data,
+                        std::size_t size,
+                        void (*func)(const unsigned char* data,
+                                     std::size_t size,
+                                     void* arg),
+                        void* arg) const;
+
+    // Applies the function supplied to each key in the tree, in
+    // ascending byte order.
     void apply(void (*func)(unsigned char* data, std::size_t size, void* arg),
                 void* arg);
 
+    // Applies the function supplied to each key in the tree that
+    // starts with the prefix supplied, in ascending byte order. This
+    // descends to the prefix once and only walks the subtree below it.
+    void apply_prefix(const unsigned char* prefix,
+                      std::size_t size,
+                      void (*func)(unsigned char* data,
+                                   std::size_t size,
+                                   void* arg),
+                      void* arg) const;
+
+    // Returns the number of keys in the tree that start with the prefix
+    // supplied, counting each key as many times as it was inserted.
+    // Every node keeps the count for its subtree, so this takes time
+    // proportional to the length of the prefix.
+    std::size_t count_prefix(const unsigned char* prefix,
+                             std::size_t size) const;
+
+    // Iterates over the keys in the tree in ascending byte order. Each
+    // key is visited once, however many times it was inserted.
+    //
+    // The iterator keeps the path from the root to the node holding
+    // its key on an explicit stack, and the key itself in a buffer
+    // that is reused as it moves. Modifying the tree invalidates all
+    // of its iterators.
+    class iterator
+    {
+    public:
+        // The current key, which stays valid until the iterator moves.
+        const unsigned char* data() const;
+        std::size_t size() const;
+
+        // Incrementing past the last key gives end(), and so does
+        // decrementing past the first one. Decrementing end() moves
+        // to the last key.
+        iterator& operator++();
+        iterator& operator--();
+
+        bool operator==(iterator const& other) const;
+        bool operator!=(iterator const& other) const;
+
+        // Moves to the first key that isn't less than the key
+        // supplied, or to end() if there is none.
+        void seek(const unsigned char* key, std::size_t size);
+
+    private:
+        friend class radix_tree;
+
+        struct frame
+        {
+            node n;
+            std::size_t key_size; // Size of the key above this node.
+            int edge; // First byte of the edge taken, or -1.
+        };
+
+        explicit iterator(node root);
+
+        void push(node n);
+        void pop();
+        void next();
+        void descend_last();
+
+        node root_;
+        std::vector<frame> stack_; // Empty at end().
+        std::vector<unsigned char> key_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator lower_bound(const unsigned char* key, std::size_t size) const;
+
+    // Applies the function supplied to each key k in the tree with
+    // first <= k < last, in ascending order.
+    void apply_range(const unsigned char* first,
+                     std::size_t first_size,
+                     const unsigned char* last,
+                     std::size_t last_size,
+                     void (*func)(const unsigned char* data,
+                                  std::size_t size,
+                                  void* arg),
+                     void* arg) const;
+
     void print();
     std::size_t size() const;
 
+    // Replaces the contents of the buffer with a snapshot of the tree in
+    // the format described in snapshot.hpp.
+    void serialize(std::vector<unsigned char>& buffer) const;
+
+    // Writes a snapshot of the tree to the file at the path supplied,
+    // for mapped_radix_tree to read. Returns false if the file couldn't
+    // be written. Write to a new file and rename it over the old one if
+    // other processes may have the old one mapped.
+    bool serialize(const char* path) const;
+
+    // Walks the whole tree to work out its shape.
+    radix_tree_stats stats() const;
+
+    // Bytes currently allocated for nodes and the number of nodes.
+    // These are kept up to date as the tree changes, so reading them
+    // is cheap.
+    std::size_t memory_usage() const;
+    std::size_t node_count() const;
+
+    // Returns the counters and latency histograms of the tree's
+    // operations since it was created or since reset_metrics(). They
+    // are all zero unless instrumentation is compiled in, as described
+    // in instrumentation.hpp.
+    radix_tree_metrics metrics() const;
+    void reset_metrics();
+
+    // Calls the function supplied after each timed operation, or stops
+    // calling it if func is nullptr. The function must not modify the
+    // tree, and the trace must not be changed while an operation runs.
+    void set_trace(radix_tree_trace_func func, void* arg);
+
 private:
+    friend class concurrent_radix_tree;
+    friend class olc_radix_tree;
+    template <typename T> friend class radix_map;
+
+    // Gives every node a value slot of the size supplied.
+    radix_tree(node_allocator& allocator,
+               std::size_t value_size,
+               key_storage storage = key_storage::copied);
+
+    // The lookups below work on the tree rooted at the node supplied,
+    // so that trees sharing nodes can reuse them.
+    //
+    // match() adds delta to the subtree count of every node it passes
+    // through on the way to the node it stops at, which lets insert()
+    // and erase() keep the counts up to date without a second walk.
+    static match_result match(node root,
+                              const unsigned char* key,
+                              std::size_t size,
+                              std::int32_t delta = 0);
+    static bool contains(node root,
+                         const unsigned char* key,
+                         std::size_t size);
+    static void contains_batch(node root,
+                               const unsigned char* const* keys,
+                               const std::size_t* sizes,
+                               std::size_t count,
+                               bool* results);
+    static bool any_prefix_of(node root,
+                              const unsigned char* data,
+                              std::size_t size);
+    static void any_prefix_of_batch(node root,
+                                    const unsigned char* const* data,
+                                    const std::size_t* sizes,
+                                    std::size_t count,
+                                    bool* results);
+    // Also stores the node holding the key found in *holder, unless
+    // there is none.
+    static std::size_t longest_prefix(node root,
+                                      const unsigned char* data,
+                                      std::size_t size,
+                                      node* holder);
+    static void longest_prefix_batch(node root,
+                                     const unsigned char* const* data,
+                                     const std::size_t* sizes,
+                                     std::size_t count,
+                                     std::size_t* lengths,
+                                     std::size_t* counts);
+    static void match_prefixes(node root,
+                               const unsigned char* data,
+                               std::size_t size,
+                               void (*func)(const unsigned char* data,
+                                            std::size_t size,
+                                            void* arg),
+                               void* arg);
+    static void apply(node root,
+                      void (*func)(unsigned char* data,
+                                   std::size_t size,
+                                   void* arg),
+                      void* arg);
+
+    // Apply a modification to the tree rooted at the node supplied,
+    // given the result of matching the key against it. The root is
+    // updated if the modification moves it. insert_at() returns
+    // whether the key is new and erase_at() whether it was found;
+    // neither of them touches size_. If holder is set, insert_at()
+    // stores the node that holds the key afterwards in it.
+    //
+    // Nodes created along the way get a value slot of the same size as
+    // the nodes they split from, and keys keep their values as they
+    // move between nodes. If external is set, a new leaf refers to the
+    // key instead of copying it. If inline_leaves is set, leaves that
+    // fit are kept in their parent's pointer slot, and erase_at() moves
+    // leaves there once they fit. Nodes with a value slot never are, and
+    // olc_radix_tree leaves it unset, since its readers load pointers
+    // while writers change them.
+    static bool insert_at(node_allocator& allocator,
+                          node& root,
+                          const match_result& result,
+                          const unsigned char* key,
+                          std::size_t size,
+                          node* holder = nullptr,
+                          bool external = false,
+                          bool inline_leaves = false);
+    static bool erase_at(node_allocator& allocator,
+                         node& root,
+                         const match_result& result,
+                         std::size_t size,
+                         bool inline_leaves = false);
+
+    // Replaces every node match() would visit for the key with a copy,
+    // handing the originals to the allocator. Modifications made for
+    // the key afterwards only touch the copies.
+    void copy_path(const unsigned char* key, std::size_t size);
+
     match_result match(const unsigned char* key, std::size_t size) const;
+    tracking_allocator allocator_;
     node root_;
     std::size_t size_;
+    bool external_keys_;
+#if defined(RADIX_TREE_INSTRUMENTATION)
+    mutable radix_tree_instruments instruments_;
+#endif
 };
 
+template <typename Iterator>
+void radix_tree::build_from_sorted(Iterator first, Iterator last)
+{
+    std::vector<const unsigned char*> keys;
+    std::vector<std::size_t> sizes;
+    for (; first != last; ++first) {
+        keys.push_back(reinterpret_cast<const unsigned char*>(first->data()));
+        sizes.push_back(first->size());
+    }
+    build_from_sorted(keys.data(), sizes.data(), keys.size());
+}
+
 #endif
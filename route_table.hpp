@@ -0,0 +1,285 @@
+#ifndef ROUTE_TABLE_HPP
+#define ROUTE_TABLE_HPP
+
+#include "fixed_key_tree.hpp"
+#include "node_allocator.hpp"
+#include "radix_map.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// A routing table mapping address prefixes in CIDR notation, such as
+// 10.0.0.0/8, to values of type T, which finds the longest prefix
+// covering an address. Address is std::uint32_t for IPv4, ipv6_address
+// for IPv6, or any other type with fixed_key_traits.
+//
+// The tree works on bytes, while prefixes end at any bit, so a prefix
+// whose length isn't a multiple of 8 is expanded into a slot for each
+// value of the bits missing from its last byte: 10.0.0.0/14 covers the
+// slots 10.0, 10.1, 10.2 and 10.3. Each slot keeps a mask of the
+// prefixes ending in its last byte that cover it, and a copy of the
+// value of the longest of them, so a lookup is a single walk down to
+// the deepest slot matching the address. The prefixes are also held
+// on their own, for the slots to fall back to when their longest
+// prefix is erased.
+template <typename Address, typename T>
+class route_table
+{
+public:
+    using traits = fixed_key_traits<Address>;
+
+    static constexpr std::size_t width = traits::width;
+    static constexpr unsigned max_length = width * 8;
+
+    route_table();
+    // Stores the table's nodes using the allocator supplied, which has
+    // to outlive the table. The table holds two trees, so the allocator
+    // has to be one that trees can share, unlike slab_allocator.
+    explicit route_table(node_allocator& allocator);
+    // Stores the prefixes and the slots using separate allocators, which
+    // may be allocators that can't be shared, such as slab_allocator.
+    route_table(node_allocator& prefix_allocator,
+                node_allocator& slot_allocator);
+
+    route_table(route_table const&) = delete;
+    route_table& operator=(route_table const&) = delete;
+
+    // Sets the value of the prefix made of the first length bits of the
+    // address supplied, adding the prefix if the table doesn't hold it
+    // yet. The remaining bits of the address are ignored.
+    void insert_or_assign(Address const& address,
+                          unsigned length,
+                          T const& value);
+
+    // Returns true if the prefix was actually removed from the table.
+    bool erase(Address const& address, unsigned length);
+
+    // Returns the value of the prefix, or nullptr if the table doesn't
+    // hold the prefix.
+    const T* find(Address const& address, unsigned length) const;
+
+    // Returns the value of the longest prefix in the table that covers
+    // the address, or nullptr if there is none. Stores the length of
+    // that prefix in *length unless length is nullptr.
+    const T* longest_match(Address const& address,
+                           unsigned* length = nullptr) const;
+
+    std::size_t size() const;
+
+private:
+    // A prefix is held under the bytes it touches, with the bits past
+    // its length cleared, followed by its length.
+    static constexpr std::size_t max_key_size = width + 1;
+
+    // Fills the buffer with the key of the prefix and returns its size.
+    static std::size_t prefix_key(Address const& address,
+                                  unsigned length,
+                                  unsigned char* key);
+    static unsigned char mask(unsigned bits);
+
+    // The prefixes ending in the last byte of a slot that cover it, as
+    // a mask with bit i - 1 set for the one with i bits in that byte,
+    // and the value of the longest of them.
+    struct slot
+    {
+        std::uint8_t lengths;
+        T value;
+    };
+
+    // Returns the number of bits the longest prefix of a slot has in
+    // its last byte.
+    static unsigned longest_bits(std::uint8_t lengths);
+
+    // Adds a prefix to each slot it covers, or updates its value there,
+    // given the key of the prefix.
+    void add_to_slots(const unsigned char* key,
+                      unsigned length,
+                      T const& value);
+    void remove_from_slots(const unsigned char* key, unsigned length);
+
+    radix_map<T> prefixes_;
+    radix_map<slot> slots_;
+};
+
+template <typename Address, typename T>
+route_table<Address, T>::route_table()
+    : route_table(default_node_allocator())
+{}
+
+template <typename Address, typename T>
+route_table<Address, T>::route_table(node_allocator& allocator)
+    : route_table(allocator, allocator)
+{}
+
+template <typename Address, typename T>
+route_table<Address, T>::route_table(node_allocator& prefix_allocator,
+                                     node_allocator& slot_allocator)
+    : prefixes_(prefix_allocator)
+    , slots_(slot_allocator)
+{}
+
+template <typename Address, typename T>
+unsigned char route_table<Address, T>::mask(unsigned bits)
+{
+    assert(bits >= 1 && bits <= 8);
+    return static_cast<unsigned char>(0xff << (8 - bits));
+}
+
+template <typename Address, typename T>
+std::size_t route_table<Address, T>::prefix_key(Address const& address,
+                                                unsigned length,
+                                                unsigned char* key)
+{
+    assert(length <= max_length);
+
+    unsigned char bytes[width];
+    traits::encode(address, bytes);
+    std::size_t size = (length + 7) / 8;
+    std::memcpy(key, bytes, size);
+    if (size > 0)
+        key[size - 1] &= mask(length - 8 * (static_cast<unsigned>(size) - 1));
+    key[size] = static_cast<unsigned char>(length);
+    return size + 1;
+}
+
+template <typename Address, typename T>
+unsigned route_table<Address, T>::longest_bits(std::uint8_t lengths)
+{
+    assert(lengths != 0);
+    unsigned bits = 8;
+    while (!(lengths & 1u << (bits - 1)))
+        --bits;
+    return bits;
+}
+
+template <typename Address, typename T>
+void route_table<Address, T>::add_to_slots(const unsigned char* key,
+                                           unsigned length,
+                                           T const& value)
+{
+    if (length == 0)
+        return; // The default route covers everything without slots.
+
+    std::size_t size = (length + 7) / 8;
+    unsigned bits = length - 8 * (static_cast<unsigned>(size) - 1);
+    auto bit = static_cast<std::uint8_t>(1u << (bits - 1));
+    unsigned char bytes[width];
+    std::memcpy(bytes, key, size);
+
+    for (unsigned rest = 0; rest < 1u << (8 - bits); ++rest) {
+        bytes[size - 1] = static_cast<unsigned char>(key[size - 1] | rest);
+        slot* covered = slots_.find(bytes, size);
+        if (!covered) {
+            slots_.insert_or_assign(bytes, size, slot{bit, value});
+            continue;
+        }
+        covered->lengths = static_cast<std::uint8_t>(covered->lengths | bit);
+        if (longest_bits(covered->lengths) == bits)
+            covered->value = value;
+    }
+}
+
+template <typename Address, typename T>
+void route_table<Address, T>::remove_from_slots(const unsigned char* key,
+                                                unsigned length)
+{
+    if (length == 0)
+        return;
+
+    std::size_t size = (length + 7) / 8;
+    unsigned bits = length - 8 * (static_cast<unsigned>(size) - 1);
+    auto bit = static_cast<std::uint8_t>(1u << (bits - 1));
+    unsigned char bytes[width];
+    std::memcpy(bytes, key, size);
+
+    for (unsigned rest = 0; rest < 1u << (8 - bits); ++rest) {
+        bytes[size - 1] = static_cast<unsigned char>(key[size - 1] | rest);
+        slot* covered = slots_.find(bytes, size);
+        assert(covered && (covered->lengths & bit));
+        covered->lengths = static_cast<std::uint8_t>(covered->lengths & ~bit);
+        if (covered->lengths == 0) {
+            slots_.erase(bytes, size);
+            continue;
+        }
+
+        // The next longest prefix takes over the slot if this one was
+        // the longest. Its key is the slot with fewer bits kept.
+        unsigned next = longest_bits(covered->lengths);
+        if (next > bits)
+            continue;
+        unsigned char next_key[max_key_size];
+        std::memcpy(next_key, bytes, size);
+        next_key[size - 1] &= mask(next);
+        next_key[size] = static_cast<unsigned char>(
+            8 * (static_cast<unsigned>(size) - 1) + next);
+        const T* next_value = prefixes_.find(next_key, size + 1);
+        assert(next_value);
+        covered->value = *next_value;
+    }
+}
+
+template <typename Address, typename T>
+void route_table<Address, T>::insert_or_assign(Address const& address,
+                                               unsigned length,
+                                               T const& value)
+{
+    unsigned char key[max_key_size];
+    std::size_t size = prefix_key(address, length, key);
+    prefixes_.insert_or_assign(key, size, value);
+    add_to_slots(key, length, value);
+}
+
+template <typename Address, typename T>
+bool route_table<Address, T>::erase(Address const& address,
+                                    unsigned length)
+{
+    unsigned char key[max_key_size];
+    std::size_t size = prefix_key(address, length, key);
+    if (!prefixes_.erase(key, size))
+        return false;
+    remove_from_slots(key, length);
+    return true;
+}
+
+template <typename Address, typename T>
+const T* route_table<Address, T>::find(Address const& address,
+                                       unsigned length) const
+{
+    unsigned char key[max_key_size];
+    std::size_t size = prefix_key(address, length, key);
+    return prefixes_.find(key, size);
+}
+
+template <typename Address, typename T>
+const T* route_table<Address, T>::longest_match(Address const& address,
+                                                unsigned* length) const
+{
+    unsigned char bytes[width];
+    traits::encode(address, bytes);
+    std::size_t size = 0;
+    const slot* deepest = slots_.longest_prefix(bytes, width, &size);
+
+    if (!deepest) {
+        unsigned char key[max_key_size];
+        size = prefix_key(address, 0, key);
+        const T* value = prefixes_.find(key, size);
+        if (value && length)
+            *length = 0;
+        return value;
+    }
+
+    if (length)
+        *length = 8 * (static_cast<unsigned>(size) - 1)
+            + longest_bits(deepest->lengths);
+    return &deepest->value;
+}
+
+template <typename Address, typename T>
+std::size_t route_table<Address, T>::size() const
+{
+    return prefixes_.size();
+}
+
+#endif
@@ -0,0 +1,350 @@
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace
+{
+
+constexpr std::uint32_t edge_bits = 9;
+constexpr std::uint32_t edge_mask = (1u << edge_bits) - 1;
+constexpr std::uint32_t key_flag = 1u << edge_bits;
+constexpr std::uint32_t prefix_shift = edge_bits + 1;
+constexpr std::size_t max_prefix_length =
+    (std::size_t(1) << (32 - prefix_shift)) - 1;
+
+// Nodes with more edges than this are binary searched.
+constexpr std::size_t linear_search_limit = 8;
+
+std::size_t align(std::size_t size)
+{
+    return (size + 3) & ~std::size_t(3);
+}
+
+std::size_t node_size(std::size_t prefix_length, std::size_t edgecount)
+{
+    return align(sizeof(std::uint32_t) + prefix_length + edgecount)
+        + edgecount * sizeof(std::uint32_t);
+}
+
+std::uint32_t read_u32(const unsigned char* data)
+{
+    std::uint32_t u32;
+    std::memcpy(&u32, data, sizeof(u32));
+    return u32;
+}
+
+void write_u32(unsigned char* data, std::uint32_t value)
+{
+    std::memcpy(data, &value, sizeof(value));
+}
+
+// Wrapper type for the layout of a node in a snapshot, like node is for
+// the nodes of a radix_tree.
+struct packed_node
+{
+    const unsigned char* data;
+
+    std::uint32_t info() const
+    {
+        return read_u32(data);
+    }
+
+    std::size_t edgecount() const
+    {
+        return info() & edge_mask;
+    }
+
+    bool holds_key() const
+    {
+        return (info() & key_flag) != 0;
+    }
+
+    std::size_t prefix_length() const
+    {
+        return info() >> prefix_shift;
+    }
+
+    const unsigned char* prefix() const
+    {
+        return data + sizeof(std::uint32_t);
+    }
+
+    const unsigned char* first_bytes() const
+    {
+        return prefix() + prefix_length();
+    }
+
+    // Returns the index of the edge whose first byte is the byte
+    // supplied, or edgecount() if there is no such edge.
+    std::size_t find_edge(unsigned char byte) const
+    {
+        std::size_t count = edgecount();
+        const unsigned char* bytes = first_bytes();
+        if (count <= linear_search_limit) {
+            for (std::size_t i = 0; i < count; ++i) {
+                if (bytes[i] >= byte)
+                    return bytes[i] == byte ? i : count;
+            }
+            return count;
+        }
+        const unsigned char* found = std::lower_bound(bytes,
+                                                      bytes + count,
+                                                      byte);
+        return found != bytes + count && *found == byte
+            ? static_cast<std::size_t>(found - bytes)
+            : count;
+    }
+
+    packed_node node_at(const unsigned char* base, std::size_t i) const
+    {
+        assert(i < edgecount());
+        const unsigned char* offsets =
+            data + align(sizeof(std::uint32_t) + prefix_length()
+                         + edgecount());
+        std::size_t offset = read_u32(offsets + i * sizeof(std::uint32_t));
+        return packed_node{base + offset * 4};
+    }
+};
+
+// A node of the tree being written, or the part of it that starts at
+// the byte of its prefix supplied if the prefix has to be split.
+struct pending_node
+{
+    node n;
+    std::size_t start;
+    std::size_t offset; // Where it goes in the buffer.
+};
+
+// Offsets of the leaves written so far, by prefix.
+using leaf_map = std::unordered_map<std::string, std::uint32_t>;
+
+// Makes room at the end of the buffer for the node supplied and queues
+// it to be written there. Returns its offset in 4-byte units.
+//
+// Leaves with the same prefix are identical, and lookups never need to
+// know which parent they came from, so they are written once and
+// shared. Many keys end in the same few bytes, e.g. a common suffix
+// after a unique identifier.
+std::uint32_t reserve(std::vector<unsigned char>& buffer,
+                      std::deque<pending_node>& queue,
+                      leaf_map& leaves,
+                      node n,
+                      std::size_t start)
+{
+    std::uint32_t* shared = nullptr;
+    if (n.edgecount() == 0 && start == 0
+        && n.prefix_length() <= max_prefix_length) {
+        std::string prefix(reinterpret_cast<const char*>(n.prefix()),
+                           n.prefix_length());
+        auto found = leaves.emplace(std::move(prefix), 0);
+        if (!found.second)
+            return found.first->second;
+        shared = &found.first->second;
+    }
+
+    std::size_t remaining = n.prefix_length() - start;
+    std::size_t size = remaining > max_prefix_length
+        ? node_size(max_prefix_length, 1)
+        : node_size(remaining, n.edgecount());
+
+    std::size_t offset = buffer.size();
+    assert(offset % 4 == 0);
+    assert(offset / 4 <= UINT32_MAX);
+    buffer.resize(offset + size);
+    queue.push_back(pending_node{n, start, offset});
+    auto units = static_cast<std::uint32_t>(offset / 4);
+    if (shared)
+        *shared = units;
+    return units;
+}
+
+const unsigned char* empty_snapshot()
+{
+    static const std::vector<unsigned char> buffer = [] {
+        std::vector<unsigned char> data;
+        node_allocator& allocator = default_node_allocator();
+        node root = make_node(allocator, 0, 0, 0);
+        write_snapshot(root, 0, data);
+        allocator.deallocate(root.data_, root.size());
+        return data;
+    }();
+    return buffer.data();
+}
+
+}
+
+void write_snapshot(node root,
+                    std::size_t size,
+                    std::vector<unsigned char>& buffer)
+{
+    buffer.assign(snapshot_header_size, 0);
+    std::memcpy(buffer.data(), "RDXT", 4);
+    write_u32(buffer.data() + 4, snapshot_version);
+    auto size64 = static_cast<std::uint64_t>(size);
+    std::memcpy(buffer.data() + 8, &size64, sizeof(size64));
+
+    // Each node is given its place in the buffer when its parent is
+    // written, and written once it comes off the queue, which makes the
+    // order breadth-first.
+    std::deque<pending_node> queue;
+    leaf_map leaves;
+    reserve(buffer, queue, leaves, root, 0);
+
+    std::vector<std::pair<unsigned char, node>> edges;
+    std::vector<std::uint32_t> offsets;
+    while (!queue.empty()) {
+        pending_node pending = queue.front();
+        queue.pop_front();
+        node n = pending.n;
+
+        std::size_t prefix_length = n.prefix_length() - pending.start;
+        bool holds_key = n.refcount() > 0;
+        edges.clear();
+        offsets.clear();
+        if (prefix_length > max_prefix_length) {
+            // The rest of the prefix goes in a node of its own.
+            prefix_length = max_prefix_length;
+            holds_key = false;
+            std::size_t next = pending.start + prefix_length;
+            edges.emplace_back(n.prefix()[next], n);
+            offsets.push_back(reserve(buffer, queue, leaves, n, next));
+        } else {
+            // The edges of a node are already sorted, which is the
+            // order lookups in the snapshot rely on.
+            for (std::size_t i = 0; i < n.edgecount(); ++i)
+                edges.emplace_back(n.first_byte_at(i), n.node_at(i));
+            for (auto const& edge : edges)
+                offsets.push_back(
+                    reserve(buffer, queue, leaves, edge.second, 0));
+        }
+
+        unsigned char* data = buffer.data() + pending.offset;
+        auto info = static_cast<std::uint32_t>(edges.size()
+            | (holds_key ? key_flag : 0)
+            | prefix_length << prefix_shift);
+        write_u32(data, info);
+        data += sizeof(info);
+        std::memcpy(data, n.prefix() + pending.start, prefix_length);
+        data += prefix_length;
+        for (auto const& edge : edges)
+            *data++ = edge.first;
+        data = buffer.data() + pending.offset
+            + align(sizeof(info) + prefix_length + edges.size());
+        for (std::uint32_t offset : offsets) {
+            write_u32(data, offset);
+            data += sizeof(offset);
+        }
+    }
+}
+
+bool is_snapshot(const unsigned char* data, std::size_t size)
+{
+    return size >= snapshot_header_size + sizeof(std::uint32_t)
+        && std::memcmp(data, "RDXT", 4) == 0
+        && read_u32(data + 4) == snapshot_version;
+}
+
+snapshot_view::snapshot_view()
+    : data_(empty_snapshot())
+{}
+
+snapshot_view::snapshot_view(const unsigned char* data)
+    : data_(data)
+{
+    assert(is_snapshot(data, snapshot_header_size + sizeof(std::uint32_t)));
+}
+
+bool snapshot_view::contains(const unsigned char* key, std::size_t size) const
+{
+    assert(key);
+    assert(size > 0);
+
+    std::size_t i = 0; // Number of characters matched in key.
+    packed_node current_node{data_ + snapshot_header_size};
+
+    while (true) {
+        std::size_t prefix_length = current_node.prefix_length();
+        if (size - i < prefix_length
+            || std::memcmp(current_node.prefix(), key + i, prefix_length))
+            return false;
+        i += prefix_length;
+        if (i == size)
+            return current_node.holds_key();
+
+        std::size_t k = current_node.find_edge(key[i]);
+        if (k == current_node.edgecount())
+            return false; // No outgoing edge.
+        current_node = current_node.node_at(data_, k);
+    }
+}
+
+bool snapshot_view::any_prefix_of(const unsigned char* data,
+                                  std::size_t size) const
+{
+    assert(data);
+
+    std::size_t i = 0; // Number of characters matched in data.
+    packed_node current_node{data_ + snapshot_header_size};
+
+    while (true) {
+        std::size_t prefix_length = current_node.prefix_length();
+        if (size - i < prefix_length
+            || std::memcmp(current_node.prefix(), data + i, prefix_length))
+            return false;
+        i += prefix_length;
+
+        if (current_node.holds_key())
+            return true;
+        if (i == size)
+            return false;
+
+        std::size_t k = current_node.find_edge(data[i]);
+        if (k == current_node.edgecount())
+            return false; // No outgoing edge.
+        current_node = current_node.node_at(data_, k);
+    }
+}
+
+void snapshot_view::match_prefixes(const unsigned char* data,
+                                   std::size_t size,
+                                   void (*func)(const unsigned char* data,
+                                                std::size_t size,
+                                                void* arg),
+                                   void* arg) const
+{
+    assert(data);
+
+    std::size_t i = 0; // Number of characters matched in data.
+    packed_node current_node{data_ + snapshot_header_size};
+
+    while (true) {
+        std::size_t prefix_length = current_node.prefix_length();
+        if (size - i < prefix_length
+            || std::memcmp(current_node.prefix(), data + i, prefix_length))
+            return;
+        i += prefix_length;
+
+        if (current_node.holds_key())
+            func(data, i, arg);
+        if (i == size)
+            return;
+
+        std::size_t k = current_node.find_edge(data[i]);
+        if (k == current_node.edgecount())
+            return; // No outgoing edge.
+        current_node = current_node.node_at(data_, k);
+    }
+}
+
+std::size_t snapshot_view::size() const
+{
+    std::uint64_t size64;
+    std::memcpy(&size64, data_ + 8, sizeof(size64));
+    return static_cast<std::size_t>(size64);
+}
@@ -0,0 +1,76 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "radix_tree.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A read-only copy of a radix tree laid out in a single buffer, which
+// can be written to a file and used straight from its mapped pages.
+//
+// The buffer starts with a 16-byte header: the bytes "RDXT", the
+// format version as a 32-bit unsigned integer, and the size of the
+// tree as a 64-bit unsigned integer. The root node follows.
+//
+// Nodes are aligned to 4 bytes and laid out in breadth-first order, so
+// the levels close to the root, which every lookup reads, share a few
+// cache lines and pages. Leaves with the same prefix are stored once
+// and shared by their parents. Each node consists of:
+//
+// (1) A 32-bit unsigned integer holding the number of outgoing edges in
+// the low 9 bits, whether the node holds a key in the next bit, and the
+// length of the prefix in the remaining 22 bits. Longer prefixes are
+// split across a chain of nodes with a single edge.
+//
+// (2) The prefix.
+//
+// (3) The first byte of the prefix of each child, in ascending order.
+//
+// (4) Padding up to a multiple of 4 bytes, followed by the offset of
+// each child as a 32-bit unsigned integer. Offsets count 4-byte units
+// from the start of the buffer, so a snapshot can be up to 16 GiB.
+//
+// Integers are stored in the byte order of the machine that wrote the
+// snapshot. Keys are held once, however many times they were inserted,
+// but the size in the header counts them like radix_tree::size().
+static constexpr std::uint32_t snapshot_version = 1;
+static constexpr std::size_t snapshot_header_size = 16;
+
+// Appends a snapshot of the tree rooted at the node supplied, which
+// holds size keys, to the buffer.
+void write_snapshot(node root,
+                    std::size_t size,
+                    std::vector<unsigned char>& buffer);
+
+// Returns true if the data starts with the header of a snapshot in the
+// format written by write_snapshot(). The rest of the data is trusted.
+bool is_snapshot(const unsigned char* data, std::size_t size);
+
+// Answers lookups from a snapshot without copying it.
+class snapshot_view
+{
+public:
+    // An empty tree.
+    snapshot_view();
+    // The data has to hold a snapshot and outlive the view.
+    explicit snapshot_view(const unsigned char* data);
+
+    // These have the same semantics as the radix_tree functions of the
+    // same name.
+    bool contains(const unsigned char* key, std::size_t size) const;
+    bool any_prefix_of(const unsigned char* data, std::size_t size) const;
+    void match_prefixes(const unsigned char* data,
+                        std::size_t size,
+                        void (*func)(const unsigned char* data,
+                                     std::size_t size,
+                                     void* arg),
+                        void* arg) const;
+    std::size_t size() const;
+
+private:
+    const unsigned char* data_;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "concurrent_radix_tree.hpp"
+#include "node_allocator.hpp"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+bool tree_insert(concurrent_radix_tree& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.insert(data, key.size());
+}
+
+bool tree_erase(concurrent_radix_tree& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.erase(data, key.size());
+}
+
+bool tree_contains(concurrent_radix_tree const& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.contains(data, key.size());
+}
+
+bool tree_any_prefix_of(concurrent_radix_tree const& tree,
+                        std::string const& data)
+{
+    auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    return tree.any_prefix_of(bytes, data.size());
+}
+
+void count_key(unsigned char* data, std::size_t size, void* arg)
+{
+    static_cast<void>(data);
+    static_cast<void>(size);
+    ++*static_cast<std::size_t*>(arg);
+}
+
+}
+
+
+TEST_CASE("concurrent tree from a single thread", "[concurrent]")
+{
+    slab_allocator allocator;
+    concurrent_radix_tree tree(allocator);
+
+    std::vector<std::string> keys = {
+        "tester", "water", "slow", "slower", "test", "team", "toast"
+    };
+
+    for (auto const& key : keys)
+        REQUIRE(tree_insert(tree, key));
+    REQUIRE_FALSE(tree_insert(tree, "test"));
+    REQUIRE(tree.size() == keys.size() + 1);
+    REQUIRE(tree.node_count() == 5);
+    REQUIRE(tree.memory_usage() > 0);
+
+    for (auto const& key : keys)
+        REQUIRE(tree_contains(tree, key));
+    REQUIRE_FALSE(tree_contains(tree, "tes"));
+    REQUIRE(tree_any_prefix_of(tree, "slowly"));
+    REQUIRE_FALSE(tree_any_prefix_of(tree, "sl"));
+
+    std::size_t count = 0;
+    tree.apply(count_key, &count);
+    REQUIRE(count == keys.size());
+
+    REQUIRE_FALSE(tree_erase(tree, "tes"));
+    REQUIRE(tree_erase(tree, "test"));
+    REQUIRE(tree_erase(tree, "test"));
+    REQUIRE_FALSE(tree_erase(tree, "test"));
+    REQUIRE(tree_contains(tree, "tester"));
+    REQUIRE(tree.size() == keys.size() - 1);
+}
+
+TEST_CASE("concurrent readers and a writer", "[concurrent]")
+{
+    concurrent_radix_tree tree;
+
+    // Keys that stay in the tree throughout, interleaved with keys the
+    // writer keeps adding and removing, so that the writer splits and
+    // merges nodes on the readers' paths.
+    std::vector<std::string> stable;
+    std::vector<std::string> churn;
+    for (int i = 0; i < 200; ++i) {
+        stable.push_back("topic." + std::to_string(i));
+        churn.push_back("topic." + std::to_string(i) + ".sub");
+        churn.push_back("topic." + std::to_string(i * 7) + "x");
+    }
+    for (auto const& key : stable)
+        tree_insert(tree, key);
+
+    std::atomic<bool> done(false);
+    std::atomic<std::size_t> failures(0);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; ++r) {
+        readers.emplace_back([&tree, &stable, &done, &failures]() {
+            while (!done.load()) {
+                for (auto const& key : stable) {
+                    if (!tree_contains(tree, key)
+                        || !tree_any_prefix_of(tree, key + ".sub"))
+                        ++failures;
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 20; ++round) {
+        for (auto const& key : churn)
+            tree_insert(tree, key);
+        for (auto const& key : churn)
+            tree_erase(tree, key);
+    }
+    done.store(true);
+    for (auto& reader : readers)
+        reader.join();
+
+    REQUIRE(failures.load() == 0);
+    REQUIRE(tree.size() == stable.size());
+    for (auto const& key : stable)
+        REQUIRE(tree_contains(tree, key));
+    for (auto const& key : churn)
+        REQUIRE_FALSE(tree_contains(tree, key));
+}
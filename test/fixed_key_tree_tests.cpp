@@ -0,0 +1,291 @@
+#include "fixed_key_tree.hpp"
+#include "route_table.hpp"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+template <typename Key>
+void collect_key(Key const& key, void* arg)
+{
+    static_cast<std::vector<Key>*>(arg)->push_back(key);
+}
+
+std::uint32_t ipv4(unsigned a, unsigned b, unsigned c, unsigned d)
+{
+    return static_cast<std::uint32_t>(a << 24 | b << 16 | c << 8 | d);
+}
+
+// The value of the longest of the routes covering the address, or -1,
+// found the slow way.
+struct route
+{
+    std::uint32_t address;
+    unsigned length;
+    int value;
+};
+
+bool covers(route const& r, std::uint32_t address)
+{
+    return r.length == 0
+        || (r.address ^ address) >> (32 - r.length) == 0;
+}
+
+int expected_match(std::vector<route> const& routes, std::uint32_t address)
+{
+    int value = -1;
+    int longest = -1;
+    for (auto const& r : routes) {
+        if (covers(r, address) && static_cast<int>(r.length) > longest) {
+            longest = static_cast<int>(r.length);
+            value = r.value;
+        }
+    }
+    return value;
+}
+
+}
+
+TEST_CASE("fixed-width keys", "[fixed_key_tree]")
+{
+    SECTION("integers keep their order")
+    {
+        fixed_key_tree<std::int32_t> tree;
+        std::vector<std::int32_t> keys = {
+            5, -1, 0, INT32_MIN, INT32_MAX, -300, 300, 256
+        };
+        for (auto key : keys)
+            REQUIRE(tree.insert(key));
+        REQUIRE_FALSE(tree.insert(300));
+        REQUIRE(tree.size() == keys.size() + 1);
+
+        std::vector<std::int32_t> visited;
+        tree.scan(INT32_MIN, INT32_MAX, collect_key<std::int32_t>, &visited);
+        std::sort(keys.begin(), keys.end());
+        REQUIRE(visited == keys);
+
+        visited.clear();
+        tree.scan(-300, 255, collect_key<std::int32_t>, &visited);
+        REQUIRE(visited == std::vector<std::int32_t>({-300, -1, 0, 5}));
+
+        REQUIRE(tree.erase(300));
+        REQUIRE(tree.contains(300));
+        REQUIRE(tree.erase(300));
+        REQUIRE_FALSE(tree.contains(300));
+        REQUIRE_FALSE(tree.erase(300));
+    }
+
+    SECTION("IPv6 addresses")
+    {
+        fixed_key_tree<ipv6_address> tree;
+        ipv6_address a = {{0x20, 0x01, 0x0d, 0xb8}};
+        ipv6_address b = a;
+        b.bytes[15] = 1;
+        REQUIRE(tree.insert(b));
+        REQUIRE(tree.insert(a));
+        REQUIRE(tree.contains(a));
+        b.bytes[15] = 2;
+        REQUIRE_FALSE(tree.contains(b));
+
+        std::vector<ipv6_address> visited;
+        tree.scan(a, b, collect_key<ipv6_address>, &visited);
+        REQUIRE(visited.size() == 2);
+        REQUIRE(visited[0].bytes[15] == 0);
+        REQUIRE(visited[1].bytes[15] == 1);
+    }
+}
+
+TEST_CASE("fuzz fixed-width keys", "[fuzz][fixed_key_tree]")
+{
+    auto seed = static_cast<unsigned>(std::time(nullptr));
+    std::mt19937_64 rng(seed);
+    CAPTURE(seed);
+
+    // Identifiers from a few dense ranges share long prefixes, and the
+    // rest spread over the whole key space.
+    auto random_id = [&rng]() -> std::uint64_t {
+        if (rng() % 2 == 0)
+            return (rng() % 4) << 40 | rng() % 5000;
+        return rng();
+    };
+
+    fixed_key_tree<std::uint64_t> tree;
+    std::set<std::uint64_t> expected;
+    for (int i = 0; i < 20000; ++i) {
+        std::uint64_t key = random_id();
+        if (rng() % 3 == 0 && !expected.empty()) {
+            auto found = expected.lower_bound(key);
+            key = found != expected.end() ? *found : *expected.begin();
+            INFO("erase: " << key);
+            REQUIRE(tree.erase(key));
+            expected.erase(key);
+        } else if (expected.insert(key).second) {
+            INFO("insert: " << key);
+            REQUIRE(tree.insert(key));
+        }
+        REQUIRE(tree.size() == expected.size());
+    }
+
+    std::vector<std::uint64_t> keys;
+    for (int i = 0; i < 1000; ++i)
+        keys.push_back(random_id());
+    std::unique_ptr<bool[]> results(new bool[keys.size()]);
+    tree.contains_batch(keys.data(), keys.size(), results.get());
+    for (std::size_t k = 0; k < keys.size(); ++k) {
+        INFO("contains: " << keys[k]);
+        REQUIRE(results[k] == (expected.count(keys[k]) > 0));
+        REQUIRE(tree.contains(keys[k]) == results[k]);
+    }
+
+    std::uint64_t first = random_id();
+    std::uint64_t last = first + (std::uint64_t(1) << 40);
+    std::vector<std::uint64_t> visited;
+    tree.scan(first, last, collect_key<std::uint64_t>, &visited);
+    REQUIRE(visited == std::vector<std::uint64_t>(
+                expected.lower_bound(first), expected.upper_bound(last)));
+
+    std::vector<std::uint64_t> sorted(expected.begin(), expected.end());
+    fixed_key_tree<std::uint64_t> loaded;
+    loaded.build_from_sorted(sorted.data(), sorted.size());
+    visited.clear();
+    loaded.scan(0, UINT64_MAX, collect_key<std::uint64_t>, &visited);
+    REQUIRE(visited == sorted);
+}
+
+TEST_CASE("longest prefix match", "[route_table]")
+{
+    route_table<std::uint32_t, std::string> table;
+    unsigned length = 0;
+    REQUIRE(table.longest_match(ipv4(10, 1, 2, 3)) == nullptr);
+
+    table.insert_or_assign(ipv4(10, 0, 0, 0), 8, "10/8");
+    table.insert_or_assign(ipv4(10, 1, 2, 0), 24, "10.1.2/24");
+    // The bits past the length don't matter.
+    table.insert_or_assign(ipv4(10, 3, 255, 255), 14, "10.0/14");
+    table.insert_or_assign(ipv4(192, 168, 1, 128), 25, "192.168.1.128/25");
+    REQUIRE(table.size() == 4);
+
+    REQUIRE(*table.longest_match(ipv4(10, 1, 2, 3), &length) == "10.1.2/24");
+    REQUIRE(length == 24);
+    REQUIRE(*table.longest_match(ipv4(10, 1, 3, 3), &length) == "10.0/14");
+    REQUIRE(length == 14);
+    REQUIRE(*table.longest_match(ipv4(10, 4, 0, 0), &length) == "10/8");
+    REQUIRE(length == 8);
+    REQUIRE(*table.longest_match(ipv4(192, 168, 1, 200)) == "192.168.1.128/25");
+    REQUIRE(table.longest_match(ipv4(192, 168, 1, 127)) == nullptr);
+    REQUIRE(table.longest_match(ipv4(11, 0, 0, 0)) == nullptr);
+
+    table.insert_or_assign(0, 0, "default");
+    REQUIRE(*table.longest_match(ipv4(11, 0, 0, 0), &length) == "default");
+    REQUIRE(length == 0);
+    table.insert_or_assign(ipv4(10, 1, 2, 3), 32, "host");
+    REQUIRE(*table.longest_match(ipv4(10, 1, 2, 3)) == "host");
+
+    REQUIRE(*table.find(ipv4(10, 2, 0, 0), 14) == "10.0/14");
+    REQUIRE(table.find(ipv4(10, 2, 0, 0), 15) == nullptr);
+    table.insert_or_assign(ipv4(10, 0, 0, 0), 14, "replaced");
+    REQUIRE(table.size() == 6);
+
+    REQUIRE(table.erase(ipv4(10, 1, 2, 0), 24));
+    REQUIRE_FALSE(table.erase(ipv4(10, 1, 2, 0), 24));
+    REQUIRE(*table.longest_match(ipv4(10, 1, 2, 4)) == "replaced");
+    REQUIRE(table.erase(ipv4(10, 0, 0, 0), 14));
+    REQUIRE(*table.longest_match(ipv4(10, 1, 2, 4)) == "10/8");
+    REQUIRE(table.erase(0, 0));
+    REQUIRE(table.longest_match(ipv4(11, 0, 0, 0)) == nullptr);
+
+    route_table<ipv6_address, int> table6;
+    ipv6_address net = {{0x20, 0x01, 0x0d, 0xb8}};
+    table6.insert_or_assign(net, 32, 1);
+    net.bytes[4] = 0x80;
+    table6.insert_or_assign(net, 33, 2);
+    ipv6_address host = net;
+    host.bytes[15] = 1;
+    REQUIRE(*table6.longest_match(host) == 2);
+    host.bytes[4] = 0x7f;
+    REQUIRE(*table6.longest_match(host, &length) == 1);
+    REQUIRE(length == 32);
+}
+
+TEST_CASE("fuzz longest prefix match", "[fuzz][route_table]")
+{
+    auto seed = static_cast<unsigned>(std::time(nullptr));
+    std::minstd_rand rng(seed);
+    CAPTURE(seed);
+
+    // Routes are drawn from a small part of the address space so that
+    // they overlap a lot.
+    auto random_address = [&rng]() {
+        return ipv4(10, static_cast<unsigned>(rng() % 4),
+                    static_cast<unsigned>(rng() % 256),
+                    static_cast<unsigned>(rng() % 256));
+    };
+
+    route_table<std::uint32_t, int> table;
+    std::vector<route> routes;
+    for (int i = 0; i < 3000; ++i) {
+        if (rng() % 3 == 0 && !routes.empty()) {
+            std::size_t k = rng() % routes.size();
+            REQUIRE(table.erase(routes[k].address, routes[k].length));
+            routes.erase(routes.begin() + static_cast<std::ptrdiff_t>(k));
+        } else {
+            auto length = static_cast<unsigned>(rng() % 33);
+            std::uint32_t address = random_address();
+            if (length < 32)
+                address &= ~(UINT32_MAX >> length);
+            auto found = std::find_if(routes.begin(),
+                                      routes.end(),
+                                      [&](route const& r) {
+                                          return r.address == address
+                                              && r.length == length;
+                                      });
+            if (found != routes.end())
+                found->value = i;
+            else
+                routes.push_back(route{address, length, i});
+            table.insert_or_assign(address, length, i);
+        }
+        REQUIRE(table.size() == routes.size());
+
+        std::uint32_t address = random_address();
+        INFO("longest_match: " << address);
+        const int* value = table.longest_match(address);
+        int expected = expected_match(routes, address);
+        REQUIRE((value ? *value : -1) == expected);
+    }
+}
+
+TEST_CASE("route table with slab allocators", "[route_table][allocator]")
+{
+    // Each of the table's trees releases its allocator when destroyed,
+    // so they get one each.
+    slab_allocator prefix_allocator;
+    slab_allocator slot_allocator;
+    route_table<std::uint32_t, std::string> table(prefix_allocator,
+                                                  slot_allocator);
+    for (unsigned i = 0; i < 256; ++i) {
+        table.insert_or_assign(ipv4(10, i, 0, 0), 16, "16");
+        table.insert_or_assign(ipv4(10, i, 128, 0), 17 + i % 8, "long");
+    }
+    for (unsigned i = 0; i < 256; i += 2)
+        REQUIRE(table.erase(ipv4(10, i, 128, 0), 17 + i % 8));
+    REQUIRE(table.size() == 384);
+
+    for (unsigned i = 0; i < 256; ++i) {
+        const std::string* value = table.longest_match(ipv4(10, i, 128, 1));
+        REQUIRE(value);
+        REQUIRE(*value == (i % 2 ? "long" : "16"));
+    }
+    REQUIRE(slot_allocator.reserved_bytes() > 0);
+}
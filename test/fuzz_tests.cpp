@@ -1,12 +1,18 @@
+#include "node_allocator.hpp"
 #include "radix_tree.hpp"
 
 #include <catch.hpp>
 
+#include <algorithm>
 #include <cstdlib>
 #include <ctime>
+#include <iterator>
+#include <map>
 #include <random>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace
 {
@@ -23,6 +29,18 @@ bool tree_erase(radix_tree& tree, std::string const& key)
     return tree.erase(data, key.size());
 }
 
+bool tree_contains(radix_tree const& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.contains(data, key.size());
+}
+
+std::size_t tree_count_prefix(radix_tree const& tree, std::string const& prefix)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(prefix.data());
+    return tree.count_prefix(data, prefix.size());
+}
+
 std::string random_key(std::minstd_rand& rng, std::size_t key_length)
 {
     const char* chars = "abcdefghijklmnopqrstuvwxyz0123456789";
@@ -40,12 +58,8 @@ std::string random_key(std::minstd_rand& rng, std::size_t key_length)
 constexpr std::size_t operations = 100000;
 constexpr std::size_t key_length = 50;
 
-}
-
-
-TEST_CASE("fuzz", "[fuzz]")
+void fuzz(radix_tree& tree)
 {
-    radix_tree tree;
     std::unordered_map<std::string, std::size_t> set;
     std::size_t set_size = 0;
 
@@ -86,5 +100,327 @@ TEST_CASE("fuzz", "[fuzz]")
             REQUIRE(tree_result == set_result);
         }
         REQUIRE(set_size == tree.size());
+        REQUIRE(tree_count_prefix(tree, "") == tree.size());
     }
 }
+
+}
+
+
+TEST_CASE("fuzz", "[fuzz]")
+{
+    radix_tree tree;
+    fuzz(tree);
+}
+
+TEST_CASE("fuzz with a slab allocator", "[fuzz][allocator]")
+{
+    slab_allocator allocator;
+    radix_tree tree(allocator);
+    fuzz(tree);
+}
+
+TEST_CASE("fuzz bulk loading", "[fuzz][build_from_sorted][longest_prefix]")
+{
+    auto seed = static_cast<unsigned>(std::time(nullptr));
+    std::minstd_rand rng(seed);
+    CAPTURE(seed);
+
+    std::vector<std::string> keys;
+    std::unordered_map<std::string, std::size_t> set;
+    for (std::size_t i = 0; i < operations / 10; ++i) {
+        std::size_t len = (static_cast<std::size_t>(rng()) % 8) + 1;
+        keys.push_back(random_key(rng, len));
+        ++set[keys.back()];
+    }
+    std::sort(keys.begin(), keys.end());
+
+    radix_tree tree;
+    tree.build_from_sorted(keys.begin(), keys.end());
+    REQUIRE(tree.size() == keys.size());
+
+    for (std::size_t i = 0; i < operations; ++i) {
+        std::size_t len = (static_cast<std::size_t>(rng()) % 8) + 1;
+        std::string key = random_key(rng, len);
+        INFO("contains: " << key);
+        REQUIRE(tree_contains(tree, key) == (set.count(key) > 0));
+    }
+    for (std::size_t i = 0; i < operations / 10; ++i) {
+        std::size_t len = (static_cast<std::size_t>(rng()) % 3) + 1;
+        std::string prefix = random_key(rng, len);
+        std::size_t expected = 0;
+        for (auto k = std::lower_bound(keys.begin(), keys.end(), prefix);
+             k != keys.end() && k->compare(0, len, prefix) == 0; ++k)
+            ++expected;
+        INFO("count prefix: " << prefix);
+        REQUIRE(tree_count_prefix(tree, prefix) == expected);
+    }
+    for (std::size_t i = 0; i < operations / 10; ++i) {
+        std::size_t len = (static_cast<std::size_t>(rng()) % 10) + 1;
+        std::string data = random_key(rng, len);
+        std::size_t expected = len;
+        while (expected > 0 && set.count(data.substr(0, expected)) == 0)
+            --expected;
+        INFO("longest prefix: " << data);
+        std::size_t count = 0;
+        auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+        REQUIRE(tree.longest_prefix(bytes, len, &count) == expected);
+        REQUIRE(count == (expected > 0 ? set[data.substr(0, expected)] : 0));
+    }
+    for (auto const& key : keys) {
+        INFO("erase: " << key);
+        REQUIRE(tree_erase(tree, key));
+    }
+    REQUIRE(tree.size() == 0);
+}
+
+TEST_CASE("fuzz ordered iteration", "[fuzz][iterator]")
+{
+    auto seed = static_cast<unsigned>(std::time(nullptr));
+    std::minstd_rand rng(seed);
+    CAPTURE(seed);
+
+    // Short keys over a small alphabet give plenty of keys that are
+    // prefixes of others, and erasing some of them merges nodes.
+    radix_tree tree;
+    std::set<std::string> set;
+    for (std::size_t i = 0; i < operations / 10; ++i) {
+        std::size_t len = (static_cast<std::size_t>(rng()) % 6) + 1;
+        std::string key = random_key(rng, len);
+        if (rng() % 4 == 0) {
+            if (set.erase(key) > 0)
+                REQUIRE(tree_erase(tree, key));
+        } else if (set.insert(key).second) {
+            REQUIRE(tree_insert(tree, key));
+        }
+    }
+
+    for (std::size_t i = 0; i < operations / 10; ++i) {
+        std::size_t len = (static_cast<std::size_t>(rng()) % 4) + 1;
+        std::string prefix = random_key(rng, len);
+        std::size_t expected = 0;
+        for (auto k = set.lower_bound(prefix);
+             k != set.end() && k->compare(0, len, prefix) == 0; ++k)
+            ++expected;
+        INFO("count prefix: " << prefix);
+        REQUIRE(tree_count_prefix(tree, prefix) == expected);
+    }
+
+    std::vector<std::string> visited;
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+        visited.emplace_back(reinterpret_cast<const char*>(it.data()),
+                             it.size());
+    REQUIRE(visited == std::vector<std::string>(set.begin(), set.end()));
+
+    auto it = tree.end();
+    for (auto expected = set.rbegin(); expected != set.rend(); ++expected) {
+        --it;
+        REQUIRE(std::string(reinterpret_cast<const char*>(it.data()),
+                            it.size()) == *expected);
+    }
+
+    for (std::size_t i = 0; i < operations / 10; ++i) {
+        std::size_t len = (static_cast<std::size_t>(rng()) % 7) + 1;
+        std::string key = random_key(rng, len);
+        INFO("lower bound: " << key);
+        auto* data = reinterpret_cast<const unsigned char*>(key.data());
+        auto found = tree.lower_bound(data, key.size());
+        auto expected = set.lower_bound(key);
+        if (expected == set.end()) {
+            REQUIRE(found == tree.end());
+        } else {
+            REQUIRE(found != tree.end());
+            REQUIRE(std::string(reinterpret_cast<const char*>(found.data()),
+                                found.size()) == *expected);
+        }
+    }
+}
+
+namespace
+{
+
+using counted_keys = std::map<std::string, std::size_t>;
+
+counted_keys random_counted_keys(std::minstd_rand& rng)
+{
+    counted_keys keys;
+    for (std::size_t i = 0; i < operations / 50; ++i) {
+        std::size_t len = (static_cast<std::size_t>(rng()) % 4) + 1;
+        ++keys[random_key(rng, len)];
+    }
+    return keys;
+}
+
+void fill(radix_tree& tree, counted_keys const& keys)
+{
+    for (auto const& item : keys) {
+        for (std::size_t i = 0; i < item.second; ++i)
+            tree_insert(tree, item.first);
+    }
+}
+
+// Checks the keys of the tree, their counts, and that the tree has the
+// same shape as one built from scratch, i.e. no nodes are left over.
+void check(radix_tree const& tree, counted_keys const& expected)
+{
+    std::size_t size = 0;
+    std::vector<std::string> keys;
+    for (auto const& item : expected) {
+        size += item.second;
+        keys.push_back(item.first);
+    }
+    REQUIRE(tree.size() == size);
+    REQUIRE(tree_count_prefix(tree, "") == size);
+
+    std::vector<std::string> visited;
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+        visited.emplace_back(reinterpret_cast<const char*>(it.data()),
+                             it.size());
+    REQUIRE(visited == keys);
+
+    for (auto const& key : keys) {
+        std::size_t count = 0;
+        for (auto k = expected.lower_bound(key);
+             k != expected.end() && k->first.compare(0, key.size(), key) == 0;
+             ++k)
+            count += k->second;
+        INFO("count prefix: " << key);
+        REQUIRE(tree_count_prefix(tree, key) == count);
+    }
+
+    radix_tree rebuilt;
+    fill(rebuilt, expected);
+    REQUIRE(tree.node_count() == rebuilt.node_count());
+}
+
+}
+
+TEST_CASE("fuzz set operations", "[fuzz][set_operations]")
+{
+    auto seed = static_cast<unsigned>(std::time(nullptr));
+    std::minstd_rand rng(seed);
+    CAPTURE(seed);
+    constexpr int rounds = 20;
+
+    SECTION("merge") {
+        for (int round = 0; round < rounds; ++round) {
+            counted_keys a_keys = random_counted_keys(rng);
+            counted_keys b_keys = random_counted_keys(rng);
+            radix_tree a;
+            radix_tree b;
+            fill(a, a_keys);
+            fill(b, b_keys);
+            a.merge(b);
+            for (auto const& item : b_keys)
+                a_keys[item.first] += item.second;
+            check(a, a_keys);
+            check(b, counted_keys());
+        }
+    }
+
+    SECTION("merge across allocators") {
+        for (int round = 0; round < rounds; ++round) {
+            counted_keys a_keys = random_counted_keys(rng);
+            counted_keys b_keys = random_counted_keys(rng);
+            slab_allocator allocator;
+            radix_tree a;
+            radix_tree b(allocator);
+            fill(a, a_keys);
+            fill(b, b_keys);
+            a.merge(b);
+            for (auto const& item : b_keys)
+                a_keys[item.first] += item.second;
+            check(a, a_keys);
+            check(b, counted_keys());
+            REQUIRE(b.node_count() == 1);
+        }
+    }
+
+    SECTION("intersect") {
+        for (int round = 0; round < rounds; ++round) {
+            counted_keys a_keys = random_counted_keys(rng);
+            counted_keys b_keys = random_counted_keys(rng);
+            radix_tree a;
+            radix_tree b;
+            fill(a, a_keys);
+            fill(b, b_keys);
+            a.intersect(b);
+            counted_keys expected;
+            for (auto const& item : a_keys) {
+                if (b_keys.count(item.first) > 0)
+                    expected.insert(item);
+            }
+            check(a, expected);
+            check(b, b_keys);
+        }
+    }
+
+    SECTION("subtract") {
+        for (int round = 0; round < rounds; ++round) {
+            counted_keys a_keys = random_counted_keys(rng);
+            counted_keys b_keys = random_counted_keys(rng);
+            radix_tree a;
+            radix_tree b;
+            fill(a, a_keys);
+            fill(b, b_keys);
+            a.subtract(b);
+            counted_keys expected;
+            for (auto const& item : a_keys) {
+                if (b_keys.count(item.first) == 0)
+                    expected.insert(item);
+            }
+            check(a, expected);
+            check(b, b_keys);
+        }
+    }
+}
+
+TEST_CASE("fuzz with external keys", "[fuzz][external]")
+{
+    auto seed = static_cast<unsigned>(std::time(nullptr));
+    std::minstd_rand rng(seed);
+    CAPTURE(seed);
+
+    // The tree refers to the keys held by the map, which are freed as
+    // soon as the tree no longer holds them, so a node still referring
+    // to them would be caught by the sanitizers or the checks below.
+    radix_tree tree(default_node_allocator(), key_storage::external);
+    std::unordered_map<std::string, std::size_t> set;
+    std::size_t set_size = 0;
+
+    for (std::size_t i = 0; i < operations / 2; ++i) {
+        if (rng() % 2 == 1) {
+            std::size_t len = (static_cast<std::size_t>(rng())
+                               % key_length) + 1;
+            auto item = set.emplace(random_key(rng, len), 0).first;
+            INFO("insert: " << item->first);
+            bool set_result = ++item->second == 1;
+            REQUIRE(tree_insert(tree, item->first) == set_result);
+            ++set_size;
+        } else if (set.size() > 0) {
+            auto idx = static_cast<std::size_t>(rng()) % set.size();
+            auto item = set.begin();
+            std::advance(item, static_cast<std::ptrdiff_t>(idx));
+            INFO("erase: " << item->first);
+            REQUIRE(tree_erase(tree, item->first));
+            --set_size;
+            if (--item->second == 0) {
+                std::string key = item->first;
+                set.erase(item);
+                REQUIRE_FALSE(tree_contains(tree, key));
+            }
+        }
+        REQUIRE(set_size == tree.size());
+    }
+
+    std::vector<std::string> visited;
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+        visited.emplace_back(reinterpret_cast<const char*>(it.data()),
+                             it.size());
+    std::sort(visited.begin(), visited.end());
+    std::vector<std::string> expected;
+    for (auto const& item : set)
+        expected.push_back(item.first);
+    std::sort(expected.begin(), expected.end());
+    REQUIRE(visited == expected);
+}
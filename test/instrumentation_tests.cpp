@@ -0,0 +1,104 @@
+#include "radix_tree.hpp"
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+bool tree_insert(radix_tree& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.insert(data, key.size());
+}
+
+bool tree_erase(radix_tree& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.erase(data, key.size());
+}
+
+bool tree_contains(radix_tree const& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.contains(data, key.size());
+}
+
+using traced_operation = std::pair<radix_tree_operation, std::string>;
+
+void record_event(radix_tree_trace_event const& event, void* arg)
+{
+    auto* events = reinterpret_cast<std::vector<traced_operation>*>(arg);
+    events->emplace_back(event.operation,
+                         std::string(reinterpret_cast<const char*>(event.key),
+                                     event.size));
+}
+
+std::uint64_t operations(radix_tree_metrics const& metrics,
+                         radix_tree_operation operation)
+{
+    std::uint64_t count = 0;
+    for (std::uint64_t bucket :
+         metrics.latencies[static_cast<std::size_t>(operation)])
+        count += bucket;
+    return count;
+}
+
+}
+
+TEST_CASE("instrumentation", "[instrumentation]")
+{
+    radix_tree tree;
+    std::vector<traced_operation> events;
+    tree.set_trace(record_event, &events);
+
+    // "test" splits "tester", "team" splits "test", and erasing "team"
+    // merges "te" with "st".
+    tree_insert(tree, "tester");
+    tree_insert(tree, "test");
+    tree_insert(tree, "team");
+    REQUIRE(tree_erase(tree, "team"));
+    REQUIRE(tree_contains(tree, "test"));
+    radix_tree_metrics metrics = tree.metrics();
+
+#if defined(RADIX_TREE_INSTRUMENTATION)
+    REQUIRE(metrics.lookups == 5);
+    REQUIRE(metrics.nodes_visited >= metrics.lookups);
+    REQUIRE(metrics.prefix_bytes_compared >= 4);
+    REQUIRE(metrics.splits == 2);
+    REQUIRE(metrics.merges == 1);
+    REQUIRE(metrics.reallocations > 0);
+    REQUIRE(metrics.bytes_moved > 0);
+    REQUIRE(operations(metrics, radix_tree_operation::insert) == 3);
+    REQUIRE(operations(metrics, radix_tree_operation::erase) == 1);
+    REQUIRE(operations(metrics, radix_tree_operation::contains) == 1);
+    REQUIRE(operations(metrics, radix_tree_operation::match_prefixes) == 0);
+
+    REQUIRE(events == std::vector<traced_operation>({
+        {radix_tree_operation::insert, "tester"},
+        {radix_tree_operation::insert, "test"},
+        {radix_tree_operation::insert, "team"},
+        {radix_tree_operation::erase, "team"},
+        {radix_tree_operation::contains, "test"}
+    }));
+
+    tree.set_trace(nullptr, nullptr);
+    tree_contains(tree, "tester");
+    REQUIRE(events.size() == 5);
+
+    tree.reset_metrics();
+    metrics = tree.metrics();
+    REQUIRE(metrics.lookups == 0);
+    REQUIRE(operations(metrics, radix_tree_operation::contains) == 0);
+#else
+    // Compiled out, the tree doesn't count or trace anything.
+    REQUIRE(metrics.lookups == 0);
+    REQUIRE(metrics.splits == 0);
+    REQUIRE(operations(metrics, radix_tree_operation::insert) == 0);
+    REQUIRE(events.empty());
+#endif
+}
@@ -0,0 +1,91 @@
+#include "node_allocator.hpp"
+#include "radix_tree.hpp"
+
+#include <catch.hpp>
+
+#include <cstring>
+#include <string>
+
+namespace
+{
+
+bool tree_insert(radix_tree& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.insert(data, key.size());
+}
+
+bool tree_contains(radix_tree const& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.contains(data, key.size());
+}
+
+}
+
+
+TEST_CASE("slab allocator", "[allocator]")
+{
+    slab_allocator allocator(4096);
+
+    SECTION("freed blocks are reused within a size class")
+    {
+        unsigned char* a = allocator.allocate(20);
+        unsigned char* b = allocator.allocate(30);
+        REQUIRE(a != b);
+        allocator.deallocate(a, 20);
+        REQUIRE(allocator.allocate(32) == a);
+        REQUIRE(allocator.allocate(20) != a);
+    }
+
+    SECTION("blocks are carved next to each other")
+    {
+        unsigned char* a = allocator.allocate(16);
+        unsigned char* b = allocator.allocate(16);
+        REQUIRE(b == a + 16);
+        REQUIRE(allocator.reserved_bytes() == 4096);
+    }
+
+    SECTION("reallocate keeps the contents")
+    {
+        unsigned char* a = allocator.allocate(10);
+        std::memcpy(a, "radix tree", 10);
+        REQUIRE(allocator.reallocate(a, 10, 12) == a);
+        unsigned char* b = allocator.reallocate(a, 10, 5000);
+        REQUIRE(std::memcmp(b, "radix tree", 10) == 0);
+        unsigned char* c = allocator.reallocate(b, 5000, 40);
+        REQUIRE(std::memcmp(c, "radix tree", 10) == 0);
+        allocator.deallocate(c, 40);
+    }
+
+    SECTION("release everything at once")
+    {
+        allocator.allocate(100);
+        unsigned char* large = allocator.allocate(10000);
+        allocator.deallocate(large, 10000);
+        allocator.allocate(20000);
+        REQUIRE(allocator.reserved_bytes() > 20000);
+        REQUIRE(allocator.release_all());
+        REQUIRE(allocator.reserved_bytes() == 0);
+    }
+}
+
+TEST_CASE("tree with a slab allocator", "[allocator]")
+{
+    slab_allocator allocator;
+
+    {
+        radix_tree tree(allocator);
+        for (int i = 0; i < 1000; ++i)
+            REQUIRE(tree_insert(tree, "key" + std::to_string(i)));
+        REQUIRE(tree_contains(tree, "key999"));
+        REQUIRE(allocator.reserved_bytes() > 0);
+    }
+
+    // The tree hands all of its nodes back in bulk when destroyed.
+    REQUIRE(allocator.reserved_bytes() == 0);
+
+    radix_tree tree(allocator);
+    REQUIRE(tree_insert(tree, "reused"));
+    REQUIRE(tree_contains(tree, "reused"));
+}
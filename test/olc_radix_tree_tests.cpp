@@ -0,0 +1,226 @@
+#include "olc_radix_tree.hpp"
+#include "radix_tree.hpp"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+bool tree_insert(olc_radix_tree& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.insert(data, key.size());
+}
+
+bool tree_erase(olc_radix_tree& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.erase(data, key.size());
+}
+
+bool tree_contains(olc_radix_tree const& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.contains(data, key.size());
+}
+
+bool tree_any_prefix_of(olc_radix_tree const& tree, std::string const& data)
+{
+    auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    return tree.any_prefix_of(bytes, data.size());
+}
+
+}
+
+
+TEST_CASE("olc tree from a single thread", "[olc]")
+{
+    olc_radix_tree tree;
+
+    std::vector<std::string> keys = {
+        "tester", "water", "slow", "slower", "test", "team", "toast"
+    };
+
+    for (auto const& key : keys)
+        REQUIRE(tree_insert(tree, key));
+    REQUIRE_FALSE(tree_insert(tree, "test"));
+    REQUIRE(tree.size() == keys.size() + 1);
+
+    for (auto const& key : keys)
+        REQUIRE(tree_contains(tree, key));
+    REQUIRE_FALSE(tree_contains(tree, "tes"));
+    REQUIRE_FALSE(tree_contains(tree, "testers"));
+    REQUIRE(tree_any_prefix_of(tree, "slowly"));
+    REQUIRE_FALSE(tree_any_prefix_of(tree, "sl"));
+
+    REQUIRE_FALSE(tree_erase(tree, "tes"));
+    REQUIRE(tree_erase(tree, "test"));
+    REQUIRE(tree_erase(tree, "test"));
+    REQUIRE_FALSE(tree_erase(tree, "test"));
+    REQUIRE(tree_contains(tree, "tester"));
+    REQUIRE(tree.size() == keys.size() - 1);
+
+    for (auto const& key : keys)
+        tree_erase(tree, key);
+    REQUIRE(tree.size() == 0);
+    REQUIRE_FALSE(tree_any_prefix_of(tree, "slowly"));
+}
+
+TEST_CASE("olc tree with many writers", "[olc]")
+{
+    olc_radix_tree tree;
+
+    // Every writer owns a range of keys that it adds and removes, while
+    // all of them share keys that they add and remove in turn. Nodes
+    // are split, merged, grown and shrunk all over the tree, with
+    // writers often working on neighbouring nodes.
+    const int nwriters = 4;
+    std::vector<std::string> stable;
+    for (int i = 0; i < 100; ++i)
+        stable.push_back("topic." + std::to_string(i));
+    for (auto const& key : stable)
+        tree_insert(tree, key);
+
+    std::atomic<bool> done(false);
+    std::atomic<std::size_t> failures(0);
+    std::thread reader([&tree, &stable, &done, &failures]() {
+        while (!done.load()) {
+            for (auto const& key : stable) {
+                if (!tree_contains(tree, key)
+                    || !tree_any_prefix_of(tree, key + ".sub"))
+                    ++failures;
+            }
+        }
+    });
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < nwriters; ++w) {
+        writers.emplace_back([&tree, &failures, w]() {
+            std::minstd_rand rng(static_cast<unsigned>(w + 1));
+            std::vector<std::string> own;
+            for (int i = 0; i < 300; ++i) {
+                std::string id = std::to_string(rng() % 1000);
+                own.push_back("topic." + id + "." + std::to_string(w));
+                own.push_back("topic." + std::to_string(w) + id);
+            }
+            for (int round = 0; round < 10; ++round) {
+                for (auto const& key : own)
+                    tree_insert(tree, key);
+                for (int i = 0; i < 100; ++i)
+                    tree_insert(tree, "shared." + std::to_string(i));
+                for (auto const& key : own) {
+                    if (!tree_contains(tree, key))
+                        ++failures;
+                }
+                for (auto const& key : own)
+                    tree_erase(tree, key);
+                for (int i = 0; i < 100; ++i) {
+                    if (!tree_erase(tree, "shared." + std::to_string(i)))
+                        ++failures;
+                }
+            }
+        });
+    }
+    for (auto& writer : writers)
+        writer.join();
+    done.store(true);
+    reader.join();
+
+    REQUIRE(failures.load() == 0);
+    REQUIRE(tree.size() == stable.size());
+    for (auto const& key : stable)
+        REQUIRE(tree_contains(tree, key));
+    REQUIRE_FALSE(tree_contains(tree, "shared.1"));
+    REQUIRE_FALSE(tree_contains(tree, "topic.1.1"));
+    REQUIRE_FALSE(tree_any_prefix_of(tree, "topic"));
+}
+
+TEST_CASE("olc tree with many writers on shared parents", "[olc]")
+{
+    olc_radix_tree tree;
+
+    // All writers work below the same parents. Some add edges to its
+    // children, which have room for them and stay where they are, while
+    // others add and remove siblings, which shifts the parent's edges.
+    // A writer that changed a parent it didn't hold would overwrite the
+    // edge to another child.
+    const int nwriters = 4;
+    std::vector<std::string> stable;
+    for (int p = 0; p < 4; ++p) {
+        for (char c = 'a'; c <= 'p'; ++c) {
+            std::string child = "p" + std::to_string(p) + "." + c;
+            stable.push_back(child + "1");
+            stable.push_back(child + "2");
+        }
+    }
+    for (auto const& key : stable)
+        tree_insert(tree, key);
+
+    std::atomic<bool> done(false);
+    std::atomic<std::size_t> failures(0);
+    std::thread reader([&tree, &stable, &done, &failures]() {
+        while (!done.load()) {
+            for (auto const& key : stable) {
+                if (!tree_contains(tree, key))
+                    ++failures;
+            }
+        }
+    });
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < nwriters; ++w) {
+        writers.emplace_back([&tree, &stable, &failures, w]() {
+            std::minstd_rand rng(static_cast<unsigned>(w + 1));
+            for (int round = 0; round < 10000; ++round) {
+                std::string parent = "p" + std::to_string(rng() % 4) + ".";
+                std::vector<std::string> keys;
+                if (w % 2) {
+                    // Edges to new children in front of and between the
+                    // stable ones.
+                    for (int i = 0; i < 4; ++i) {
+                        auto c = static_cast<char>('A' + rng() % 26);
+                        keys.push_back(parent + c + std::to_string(w));
+                    }
+                } else {
+                    // Edges to new grandchildren below the stable
+                    // children.
+                    for (int i = 0; i < 4; ++i) {
+                        auto c = static_cast<char>('a' + rng() % 16);
+                        keys.push_back(parent + c + std::to_string(w + 3));
+                    }
+                }
+                for (auto const& key : keys)
+                    tree_insert(tree, key);
+                for (auto const& key : keys) {
+                    if (!tree_contains(tree, key))
+                        ++failures;
+                }
+                for (auto const& key : keys) {
+                    if (!tree_erase(tree, key))
+                        ++failures;
+                }
+            }
+            for (auto const& key : stable) {
+                if (!tree_contains(tree, key))
+                    ++failures;
+            }
+        });
+    }
+    for (auto& writer : writers)
+        writer.join();
+    done.store(true);
+    reader.join();
+
+    REQUIRE(failures.load() == 0);
+    REQUIRE(tree.size() == stable.size());
+    for (auto const& key : stable)
+        REQUIRE(tree_contains(tree, key));
+    REQUIRE_FALSE(tree_contains(tree, "p0.a4"));
+    REQUIRE_FALSE(tree_contains(tree, "p0.A1"));
+}
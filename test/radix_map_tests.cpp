@@ -0,0 +1,154 @@
+#include "node_allocator.hpp"
+#include "radix_map.hpp"
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+template <typename T>
+T* map_find(radix_map<T>& map, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return map.find(data, key.size());
+}
+
+template <typename T>
+T& map_insert(radix_map<T>& map, std::string const& key, T const& value)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return map.insert_or_assign(data, key.size(), value);
+}
+
+template <typename T>
+bool map_erase(radix_map<T>& map, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return map.erase(data, key.size());
+}
+
+void collect_value(const unsigned char* data,
+                   std::size_t size,
+                   std::string& value,
+                   void* arg)
+{
+    auto* vec = reinterpret_cast<std::vector<std::string>*>(arg);
+    vec->push_back(std::string(reinterpret_cast<const char*>(data), size)
+                   + "=" + value);
+}
+
+}
+
+
+TEST_CASE("map with values in the nodes", "[radix_map]")
+{
+    radix_map<std::uint64_t> map;
+
+    std::vector<std::string> keys = {
+        "tester", "water", "slow", "slower", "test", "team", "toast"
+    };
+
+    // Inserting in this order splits and grows nodes along the way, and
+    // every key has to keep its value through that.
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        REQUIRE(map_insert(map, keys[i], std::uint64_t(i)) == i);
+    REQUIRE(map.size() == keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        INFO("find: " << keys[i]);
+        REQUIRE(map_find(map, keys[i]));
+        REQUIRE(*map_find(map, keys[i]) == i);
+    }
+    REQUIRE_FALSE(map_find(map, "tes"));
+    REQUIRE_FALSE(map_find(map, "testers"));
+
+    map_insert(map, "test", std::uint64_t(42));
+    REQUIRE(map.size() == keys.size());
+    REQUIRE(*map_find(map, "test") == 42);
+    *map_find(map, "slow") = 7;
+    REQUIRE(*map_find(map, "slow") == 7);
+
+    // Erasing merges nodes, which moves the values of their keys.
+    REQUIRE(map_erase(map, "test"));
+    REQUIRE_FALSE(map_erase(map, "test"));
+    REQUIRE(*map_find(map, "tester") == 0);
+    REQUIRE(map_erase(map, "team"));
+    REQUIRE(*map_find(map, "tester") == 0);
+    REQUIRE(*map_find(map, "toast") == 6);
+    REQUIRE(map_erase(map, "slow"));
+    REQUIRE(*map_find(map, "slower") == 3);
+    REQUIRE(map.size() == keys.size() - 3);
+
+    radix_map<std::uint64_t> const& cmap = map;
+    auto* data = reinterpret_cast<const unsigned char*>("water");
+    REQUIRE(cmap.find(data, 5));
+    REQUIRE(*cmap.find(data, 5) == 1);
+}
+
+TEST_CASE("map with values stored apart", "[radix_map]")
+{
+    slab_allocator allocator;
+    radix_map<std::string> map(allocator);
+
+    map_insert(map, std::string("topic"), std::string("a"));
+    map_insert(map, std::string("topic.sub"), std::string("b"));
+    map_insert(map, std::string("topic.subsub"), std::string("c"));
+    map_insert(map, std::string("top"), std::string("d"));
+    map_insert(map, std::string("other"), std::string("e"));
+    REQUIRE(*map_find(map, "topic.sub") == "b");
+
+    std::vector<std::string> matches;
+    auto* data = reinterpret_cast<const unsigned char*>("topic.subsub.x");
+    map.match_prefixes(data, 14, collect_value, &matches);
+    REQUIRE(matches == std::vector<std::string>({
+        "top=d", "topic=a", "topic.sub=b", "topic.subsub=c"
+    }));
+
+    map_insert(map, std::string("topic"), std::string("f"));
+    REQUIRE(map_erase(map, "topic.sub"));
+    REQUIRE(*map_find(map, "topic") == "f");
+    REQUIRE(*map_find(map, "topic.subsub") == "c");
+
+    // The map frees the values it still holds.
+}
+
+TEST_CASE("fuzz map", "[fuzz][radix_map]")
+{
+    auto seed = static_cast<unsigned>(std::time(nullptr));
+    std::minstd_rand rng(seed);
+    CAPTURE(seed);
+
+    // A small alphabet makes many keys prefixes of others, so nodes
+    // are split and merged all the time.
+    radix_map<std::string> map;
+    std::map<std::string, std::string> expected;
+    for (int i = 0; i < 20000; ++i) {
+        std::string key;
+        std::size_t len = rng() % 6 + 1;
+        for (std::size_t k = 0; k < len; ++k)
+            key.push_back(static_cast<char>('a' + rng() % 4));
+
+        if (rng() % 3 == 0) {
+            INFO("erase: " << key);
+            REQUIRE(map_erase(map, key) == (expected.erase(key) > 0));
+        } else {
+            std::string value = std::to_string(i);
+            INFO("insert: " << key);
+            REQUIRE(map_insert(map, key, value) == value);
+            expected[key] = value;
+        }
+        REQUIRE(map.size() == expected.size());
+    }
+
+    for (auto const& item : expected) {
+        INFO("find: " << item.first);
+        REQUIRE(map_find(map, item.first));
+        REQUIRE(*map_find(map, item.first) == item.second);
+    }
+}
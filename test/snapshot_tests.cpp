@@ -0,0 +1,219 @@
+#include "frozen_radix_tree.hpp"
+#include "mapped_radix_tree.hpp"
+#include "radix_tree.hpp"
+#include "snapshot.hpp"
+
+#include <catch.hpp>
+
+#include <cstdio>
+#include <ctime>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+bool tree_insert(radix_tree& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.insert(data, key.size());
+}
+
+template <typename Tree>
+bool tree_contains(Tree const& tree, std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.contains(data, key.size());
+}
+
+template <typename Tree>
+bool tree_any_prefix_of(Tree const& tree, std::string const& data)
+{
+    auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    return tree.any_prefix_of(bytes, data.size());
+}
+
+void return_prefix(const unsigned char* data, std::size_t size, void* arg)
+{
+    auto* vec = reinterpret_cast<std::vector<std::string>*>(arg);
+    vec->emplace_back(reinterpret_cast<const char*>(data), size);
+}
+
+}
+
+
+TEST_CASE("snapshots in a buffer", "[snapshot]")
+{
+    radix_tree tree;
+
+    std::vector<std::string> keys = {
+        "tester", "water", "slow", "slower", "test", "team", "toast"
+    };
+    for (auto const& key : keys)
+        tree_insert(tree, key);
+    tree_insert(tree, "test");
+    // Enough edges from a single node for the lookup to search them
+    // by halves.
+    for (int c = 0; c < 40; ++c)
+        tree_insert(tree, "wide" + std::string(1, static_cast<char>(c)));
+
+    std::vector<unsigned char> buffer;
+    tree.serialize(buffer);
+    REQUIRE(is_snapshot(buffer.data(), buffer.size()));
+    snapshot_view view(buffer.data());
+    REQUIRE(view.size() == tree.size());
+
+    for (auto const& key : keys)
+        REQUIRE(tree_contains(view, key));
+    for (int c = 0; c < 40; ++c)
+        REQUIRE(tree_contains(view,
+                              "wide" + std::string(1, static_cast<char>(c))));
+    REQUIRE_FALSE(tree_contains(view, "wide"));
+    REQUIRE_FALSE(tree_contains(view, std::string("wide\x28")));
+    REQUIRE_FALSE(tree_contains(view, "tes"));
+    REQUIRE_FALSE(tree_contains(view, "testers"));
+    REQUIRE(tree_any_prefix_of(view, "slowly"));
+    REQUIRE_FALSE(tree_any_prefix_of(view, "sl"));
+
+    std::vector<std::string> matches;
+    auto* data = reinterpret_cast<const unsigned char*>("testers");
+    view.match_prefixes(data, 7, return_prefix, &matches);
+    REQUIRE(matches == std::vector<std::string>({"test", "tester"}));
+
+    snapshot_view empty;
+    REQUIRE(empty.size() == 0);
+    REQUIRE_FALSE(tree_contains(empty, "test"));
+    REQUIRE_FALSE(tree_any_prefix_of(empty, "test"));
+}
+
+TEST_CASE("snapshots split long prefixes", "[snapshot]")
+{
+    // A prefix too long for the header of a node in a snapshot is split
+    // across several nodes.
+    radix_tree tree;
+    std::string key(5u << 20, 'x');
+    tree_insert(tree, key);
+    tree_insert(tree, key + "y");
+
+    std::vector<unsigned char> buffer;
+    tree.serialize(buffer);
+    snapshot_view view(buffer.data());
+    REQUIRE(tree_contains(view, key));
+    REQUIRE(tree_contains(view, key + "y"));
+    REQUIRE_FALSE(tree_contains(view, key.substr(0, 4u << 20)));
+    REQUIRE_FALSE(tree_contains(view, key + "x"));
+}
+
+TEST_CASE("fuzz snapshots", "[fuzz][snapshot]")
+{
+    auto seed = static_cast<unsigned>(std::time(nullptr));
+    std::minstd_rand rng(seed);
+    CAPTURE(seed);
+
+    auto random_key = [&rng]() {
+        std::string key;
+        std::size_t len = rng() % 8 + 1;
+        for (std::size_t k = 0; k < len; ++k)
+            key.push_back(static_cast<char>('a' + rng() % 8));
+        return key;
+    };
+
+    radix_tree tree;
+    std::unordered_set<std::string> set;
+    for (int i = 0; i < 5000; ++i) {
+        std::string key = random_key();
+        tree_insert(tree, key);
+        set.insert(key);
+    }
+
+    std::vector<unsigned char> buffer;
+    tree.serialize(buffer);
+    snapshot_view view(buffer.data());
+    for (int i = 0; i < 20000; ++i) {
+        std::string key = random_key();
+        INFO("lookup: " << key);
+        REQUIRE(tree_contains(view, key) == (set.count(key) > 0));
+        REQUIRE(tree_any_prefix_of(view, key)
+                == tree_any_prefix_of(tree, key));
+    }
+}
+
+TEST_CASE("frozen trees", "[snapshot][frozen_radix_tree]")
+{
+    radix_tree tree;
+
+    // The leaves below "ax" and "bx" have the same prefixes, so the
+    // frozen tree shares them.
+    std::vector<std::string> keys = {
+        "ax1", "ax2", "bx1", "bx2", "bx", "slow", "slower"
+    };
+    for (auto const& key : keys)
+        tree_insert(tree, key);
+
+    frozen_radix_tree frozen(tree);
+    REQUIRE(frozen.size() == keys.size());
+    REQUIRE(frozen.memory_usage() < tree.memory_usage());
+    for (auto const& key : keys)
+        REQUIRE(tree_contains(frozen, key));
+    REQUIRE_FALSE(tree_contains(frozen, "ax"));
+    REQUIRE_FALSE(tree_contains(frozen, "ax3"));
+    REQUIRE(tree_any_prefix_of(frozen, "bx3"));
+    REQUIRE_FALSE(tree_any_prefix_of(frozen, "ax3"));
+
+    // The original tree is left alone.
+    tree_insert(tree, "ax3");
+    REQUIRE_FALSE(tree_contains(frozen, "ax3"));
+
+    frozen_radix_tree moved(std::move(frozen));
+    REQUIRE(tree_contains(moved, "bx2"));
+    REQUIRE(frozen.size() == 0);
+    REQUIRE_FALSE(tree_contains(frozen, "bx2"));
+    frozen = std::move(moved);
+    REQUIRE(tree_contains(frozen, "bx2"));
+}
+
+TEST_CASE("mapped trees", "[snapshot][mapped_radix_tree]")
+{
+    radix_tree tree;
+    std::vector<std::string> keys = {
+        "tester", "water", "slow", "slower", "test", "team", "toast"
+    };
+    for (auto const& key : keys)
+        tree_insert(tree, key);
+
+    std::string file = "rt-snapshot-" + std::to_string(std::time(nullptr));
+    std::string other_file = file + ".other";
+    REQUIRE(tree.serialize(file.c_str()));
+
+    mapped_radix_tree mapped;
+    REQUIRE(mapped.size() == 0);
+    REQUIRE_FALSE(tree_contains(mapped, "test"));
+
+    REQUIRE(mapped.open(file.c_str()));
+    REQUIRE(mapped.size() == keys.size());
+    for (auto const& key : keys)
+        REQUIRE(tree_contains(mapped, key));
+    REQUIRE_FALSE(tree_contains(mapped, "tes"));
+    REQUIRE(tree_any_prefix_of(mapped, "waterfall"));
+
+    // The file has to hold a snapshot.
+    std::FILE* other = std::fopen(other_file.c_str(), "wb");
+    REQUIRE(other);
+    std::fputs("not a snapshot at all", other);
+    std::fclose(other);
+    REQUIRE_FALSE(mapped.open(other_file.c_str()));
+    REQUIRE(mapped.size() == 0);
+    REQUIRE_FALSE(tree_contains(mapped, "slower"));
+    REQUIRE_FALSE(mapped.open("no/such/file"));
+
+    REQUIRE(mapped.open(file.c_str()));
+    REQUIRE(tree_contains(mapped, "slower"));
+    mapped.close();
+    REQUIRE_FALSE(tree_contains(mapped, "slower"));
+
+    std::remove(file.c_str());
+    std::remove(other_file.c_str());
+}
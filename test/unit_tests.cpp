@@ -2,8 +2,12 @@
 
 #include <catch.hpp>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
+#include <random>
+#include <set>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -29,6 +33,45 @@ bool tree_contains(radix_tree const& tree, std::string const& key)
     return tree.contains(data, key.size());
 }
 
+bool tree_any_prefix_of(radix_tree const& tree, std::string const& data)
+{
+    auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    return tree.any_prefix_of(bytes, data.size());
+}
+
+std::size_t tree_longest_prefix(radix_tree const& tree,
+                                std::string const& data,
+                                std::size_t* count = nullptr)
+{
+    auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    return tree.longest_prefix(bytes, data.size(), count);
+}
+
+std::size_t tree_count_prefix(radix_tree const& tree,
+                              std::string const& prefix)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(prefix.data());
+    return tree.count_prefix(data, prefix.size());
+}
+
+void return_prefix(const unsigned char* data, std::size_t size, void* arg)
+{
+    auto* vec = reinterpret_cast<std::vector<std::string>*>(arg);
+    vec->emplace_back(reinterpret_cast<const char*>(data), size);
+}
+
+std::string iterator_key(radix_tree::iterator const& it)
+{
+    return std::string(reinterpret_cast<const char*>(it.data()), it.size());
+}
+
+radix_tree::iterator tree_lower_bound(radix_tree const& tree,
+                                      std::string const& key)
+{
+    auto* data = reinterpret_cast<const unsigned char*>(key.data());
+    return tree.lower_bound(data, key.size());
+}
+
 void print_key(unsigned char* data, std::size_t size, void* arg)
 {
     static_cast<void>(arg);
@@ -46,6 +89,42 @@ void return_key(unsigned char* data, std::size_t size, void* arg)
     vec->emplace_back(key);
 }
 
+void count_key(unsigned char* data, std::size_t size, void* arg)
+{
+    static_cast<void>(data);
+    static_cast<void>(size);
+    ++*static_cast<std::size_t*>(arg);
+}
+
+// Counts the blocks handed out, whether allocated or reallocated.
+class counting_allocator : public node_allocator
+{
+public:
+    unsigned char* allocate(std::size_t size) override
+    {
+        ++allocations;
+        return allocator_.allocate(size);
+    }
+
+    void deallocate(unsigned char* data, std::size_t size) override
+    {
+        allocator_.deallocate(data, size);
+    }
+
+    unsigned char* reallocate(unsigned char* data,
+                              std::size_t old_size,
+                              std::size_t new_size) override
+    {
+        ++allocations;
+        return allocator_.reallocate(data, old_size, new_size);
+    }
+
+    std::size_t allocations = 0;
+
+private:
+    malloc_allocator allocator_;
+};
+
 }
 
 
@@ -133,6 +212,550 @@ TEST_CASE("lookup", "[contains]")
     }
 }
 
+TEST_CASE("prefix matching", "[any_prefix_of]")
+{
+    radix_tree tree;
+
+    SECTION("empty tree")
+    {
+        REQUIRE_FALSE(tree_any_prefix_of(tree, "message"));
+    }
+
+    SECTION("key equal to the data")
+    {
+        tree_insert(tree, "topic");
+        REQUIRE(tree_any_prefix_of(tree, "topic"));
+    }
+
+    SECTION("key shorter than the data")
+    {
+        tree_insert(tree, "market.");
+        REQUIRE(tree_any_prefix_of(tree, "market.eu.fx"));
+        REQUIRE_FALSE(tree_any_prefix_of(tree, "market"));
+        REQUIRE_FALSE(tree_any_prefix_of(tree, "marker.eu"));
+    }
+
+    SECTION("key ending inside a node's prefix")
+    {
+        tree_insert(tree, "introduce");
+        tree_insert(tree, "introspect");
+        REQUIRE_FALSE(tree_any_prefix_of(tree, "intro"));
+        REQUIRE_FALSE(tree_any_prefix_of(tree, "introd"));
+        REQUIRE(tree_any_prefix_of(tree, "introspection"));
+    }
+
+    SECTION("erased key")
+    {
+        tree_insert(tree, "a.b");
+        tree_insert(tree, "a.b.c");
+        tree_erase(tree, "a.b");
+        REQUIRE_FALSE(tree_any_prefix_of(tree, "a.b.d"));
+        REQUIRE(tree_any_prefix_of(tree, "a.b.c.d"));
+    }
+
+    SECTION("enumerate all matching keys")
+    {
+        std::vector<std::string> keys = {
+            "a", "a.b", "a.b.c", "a.c", "b", "a.b.cd"
+        };
+        for (auto const& key : keys)
+            tree_insert(tree, key);
+
+        std::string data = "a.b.c.d";
+        std::vector<std::string> matches;
+        tree.match_prefixes(reinterpret_cast<const unsigned char*>(data.data()),
+                            data.size(), return_prefix, &matches);
+        REQUIRE(matches == std::vector<std::string>({"a", "a.b", "a.b.c"}));
+    }
+}
+
+TEST_CASE("longest matching key", "[longest_prefix]")
+{
+    radix_tree tree;
+    std::size_t count = 1;
+    REQUIRE(tree_longest_prefix(tree, "a.b.c", &count) == 0);
+    REQUIRE(count == 0);
+
+    std::vector<std::string> keys = {
+        "a", "a.b", "a.b.c", "a.c", "b", "a.b.cd"
+    };
+    for (auto const& key : keys)
+        tree_insert(tree, key);
+    tree_insert(tree, "a.b");
+
+    REQUIRE(tree_longest_prefix(tree, "a.b.c.d", &count) == 5);
+    REQUIRE(count == 1);
+    REQUIRE(tree_longest_prefix(tree, "a.b.x", &count) == 3);
+    REQUIRE(count == 2);
+    // The data ends inside the prefix of "a.b.cd".
+    REQUIRE(tree_longest_prefix(tree, "a.b.c") == 5);
+    REQUIRE(tree_longest_prefix(tree, "a.bc") == 3);
+    REQUIRE(tree_longest_prefix(tree, "a.x") == 1);
+    REQUIRE(tree_longest_prefix(tree, "c") == 0);
+    REQUIRE(tree_longest_prefix(tree, "") == 0);
+
+    tree_erase(tree, "a.b.c");
+    REQUIRE(tree_longest_prefix(tree, "a.b.c.d") == 3);
+}
+
+TEST_CASE("batched lookups",
+          "[contains_batch][any_prefix_of_batch][longest_prefix_batch]")
+{
+    radix_tree tree;
+
+    std::vector<std::string> keys = {
+        "tester", "water", "slow", "slower", "test", "team", "toast"
+    };
+    for (auto const& key : keys)
+        tree_insert(tree, key);
+
+    // More queries than walks in a group, mixing hits and misses.
+    std::vector<std::string> queries = {
+        "tester", "tes", "testers", "water", "waterfall", "slo", "slow",
+        "slower", "slowest", "test", "team", "teams", "toast", "toaster",
+        "t", "", "blue", "slowe", "wat", "toas", "tea", "testing"
+    };
+    std::vector<const unsigned char*> data;
+    std::vector<std::size_t> sizes;
+    for (auto const& query : queries) {
+        data.push_back(reinterpret_cast<const unsigned char*>(query.data()));
+        sizes.push_back(query.size());
+    }
+
+    std::unique_ptr<bool[]> results(new bool[queries.size()]);
+
+    SECTION("contains")
+    {
+        tree.contains_batch(data.data(), sizes.data(), queries.size(),
+                            results.get());
+        for (std::size_t k = 0; k < queries.size(); ++k) {
+            INFO(queries[k]);
+            bool expected = !queries[k].empty()
+                && tree_contains(tree, queries[k]);
+            REQUIRE(results[k] == expected);
+        }
+    }
+
+    SECTION("prefix matching")
+    {
+        tree.any_prefix_of_batch(data.data(), sizes.data(), queries.size(),
+                                 results.get());
+        for (std::size_t k = 0; k < queries.size(); ++k) {
+            INFO(queries[k]);
+            REQUIRE(results[k] == tree_any_prefix_of(tree, queries[k]));
+        }
+    }
+
+    SECTION("longest prefix")
+    {
+        // Keys inserted more than once report how many times.
+        tree_insert(tree, "slow");
+        tree_insert(tree, "test");
+        tree_insert(tree, "test");
+        std::vector<std::size_t> lengths(queries.size());
+        std::vector<std::size_t> counts(queries.size());
+        tree.longest_prefix_batch(data.data(), sizes.data(), queries.size(),
+                                  lengths.data(), counts.data());
+        for (std::size_t k = 0; k < queries.size(); ++k) {
+            INFO(queries[k]);
+            std::size_t count = 0;
+            REQUIRE(lengths[k]
+                    == tree_longest_prefix(tree, queries[k], &count));
+            REQUIRE(counts[k] == count);
+        }
+        REQUIRE(counts[9] == 3); // "test"
+
+        // Counts are optional.
+        std::fill(lengths.begin(), lengths.end(), 0);
+        tree.longest_prefix_batch(data.data(), sizes.data(), queries.size(),
+                                  lengths.data());
+        for (std::size_t k = 0; k < queries.size(); ++k)
+            REQUIRE(lengths[k] == tree_longest_prefix(tree, queries[k]));
+    }
+}
+
+TEST_CASE("edge search", "[find_edge]")
+{
+    // Either side of the limits between the scan, the vector compare
+    // and the child index, with the edges spread over the byte range or
+    // packed at its top, where bytes have the sign bit set. Nodes grown
+    // an edge at a time have room to spare, and their copies have none.
+    malloc_allocator allocator;
+    const std::size_t counts[] = {1, 4, 5, 16, 17, 256};
+    for (std::size_t count : counts) {
+        for (bool packed : {false, true}) {
+            std::vector<unsigned char> bytes;
+            for (std::size_t k = 0; k < count; ++k) {
+                std::size_t byte = packed ? 256 - count + k
+                                          : k * 256 / count + 256 / count / 2;
+                bytes.push_back(static_cast<unsigned char>(byte));
+            }
+            std::vector<unsigned char> shuffled = bytes;
+            std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(3));
+
+            // The edges don't lead anywhere, since only the node is
+            // looked at.
+            node grown = make_node(allocator, 0, 0, 0);
+            for (unsigned char byte : shuffled)
+                grown.add_edge(allocator, byte, node(nullptr));
+            node exact = make_node(allocator, 0, 0, count);
+            exact.set_edges(grown);
+
+            for (node n : {grown, exact}) {
+                INFO(count << " edges of room for " << n.capacity()
+                     << (packed ? ", packed" : ", spread"));
+                REQUIRE(n.edgecount() == count);
+                std::size_t below = 0;
+                for (std::size_t byte = 0; byte < 256; ++byte) {
+                    auto b = static_cast<unsigned char>(byte);
+                    REQUIRE(n.rank(b) == below);
+                    if (below < count && bytes[below] == b) {
+                        REQUIRE(n.find_edge(b) == below);
+                        ++below;
+                    } else {
+                        REQUIRE(n.find_edge(b) == count);
+                    }
+                }
+            }
+            allocator.deallocate(grown.data_, grown.size());
+            allocator.deallocate(exact.data_, exact.size());
+        }
+    }
+}
+
+TEST_CASE("nodes of every width", "[insert][erase][contains]")
+{
+    radix_tree tree;
+
+    // Grow the root and one inner node through every layout and back.
+    std::vector<std::string> keys;
+    for (int byte = 0; byte < 256; ++byte) {
+        keys.emplace_back(1, static_cast<char>(byte));
+        keys.push_back("inner" + std::string(1, static_cast<char>(byte)));
+    }
+
+    for (auto const& key : keys) {
+        REQUIRE(tree_insert(tree, key));
+        REQUIRE(tree_contains(tree, key));
+    }
+    for (auto const& key : keys)
+        REQUIRE(tree_contains(tree, key));
+    REQUIRE_FALSE(tree_contains(tree, "inne"));
+    REQUIRE_FALSE(tree_contains(tree, "inner"));
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        REQUIRE(tree_erase(tree, keys[i]));
+        REQUIRE_FALSE(tree_contains(tree, keys[i]));
+        for (std::size_t k = i + 1; k < keys.size(); k += 37)
+            REQUIRE(tree_contains(tree, keys[k]));
+    }
+    REQUIRE(tree.size() == 0);
+}
+
+TEST_CASE("edges kept in order", "[insert][erase][apply]")
+{
+    // Bytes in a shuffled order take a node through every layout, with
+    // edges going in and out at all positions.
+    std::vector<std::string> keys;
+    for (int byte = 0; byte < 256; ++byte)
+        keys.push_back("inner" + std::string(1, static_cast<char>(byte)));
+    std::vector<std::string> shuffled = keys;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(42));
+
+    auto require_sorted = [](radix_tree const& tree,
+                             std::vector<std::string> const& expected) {
+        std::vector<std::string> applied;
+        tree.apply_prefix(nullptr, 0, return_key, &applied);
+        REQUIRE(applied == expected);
+
+        std::vector<std::string> visited;
+        auto it = tree.end();
+        while (it != tree.begin()) {
+            --it;
+            visited.push_back(iterator_key(it));
+        }
+        std::reverse(visited.begin(), visited.end());
+        REQUIRE(visited == expected);
+    };
+
+    radix_tree tree;
+    std::set<std::string> expected;
+    for (std::size_t i = 0; i < shuffled.size(); ++i) {
+        tree_insert(tree, shuffled[i]);
+        expected.insert(shuffled[i]);
+        if (i % 7 == 0)
+            require_sorted(tree, {expected.begin(), expected.end()});
+    }
+    require_sorted(tree, keys);
+
+    // Merging interleaves the edges of two nodes.
+    radix_tree odd;
+    for (std::size_t i = 1; i < keys.size(); i += 2)
+        tree_insert(odd, keys[i]);
+    radix_tree even;
+    for (std::size_t i = 0; i < keys.size(); i += 2)
+        tree_insert(even, keys[i]);
+    odd.merge(even);
+    require_sorted(odd, keys);
+
+    for (std::size_t i = 0; i < shuffled.size(); ++i) {
+        REQUIRE(tree_erase(tree, shuffled[i]));
+        expected.erase(shuffled[i]);
+        if (i % 7 == 0)
+            require_sorted(tree, {expected.begin(), expected.end()});
+    }
+    REQUIRE(tree.size() == 0);
+}
+
+TEST_CASE("edge capacity", "[insert][erase][stats]")
+{
+    SECTION("doubles up to 256 and halves at a quarter")
+    {
+        malloc_allocator allocator;
+        node n = make_node(allocator, 0, 0, 0);
+        std::vector<unsigned char> bytes;
+        for (int byte = 0; byte < 256; ++byte)
+            bytes.push_back(static_cast<unsigned char>(byte));
+        std::shuffle(bytes.begin(), bytes.end(), std::mt19937(7));
+
+        // The edges don't lead anywhere, since only the node is looked at.
+        std::size_t expected = 0;
+        for (std::size_t k = 0; k < bytes.size(); ++k) {
+            std::size_t old_size = n.size();
+            n.add_edge(allocator, bytes[k], node(nullptr));
+            if (k == expected)
+                expected = k == 0 ? 1 : 2 * k;
+            REQUIRE(n.capacity() == expected);
+            // The child index comes in past 16 edges.
+            if (k == 16)
+                REQUIRE(n.size() >= old_size + 256);
+            for (std::size_t i = 0; i <= k; ++i)
+                REQUIRE(n.first_byte_at(n.find_edge(bytes[i])) == bytes[i]);
+        }
+        REQUIRE(n.capacity() == 256);
+
+        std::mt19937 rng(8);
+        for (std::size_t count = bytes.size(); count-- > 0;) {
+            std::size_t old_size = n.size();
+            std::size_t i = rng() % (count + 1);
+            unsigned char removed = n.first_byte_at(i);
+            n.remove_edge(allocator, i);
+            bytes.erase(std::find(bytes.begin(), bytes.end(), removed));
+            if (count <= expected / 4)
+                expected /= 2;
+            REQUIRE(n.capacity() == expected);
+            // The child index goes at 8 edges, when 32 halves to 16.
+            if (count == 8)
+                REQUIRE(n.size() + 256 <= old_size);
+            REQUIRE(n.find_edge(removed) == n.edgecount());
+            for (unsigned char byte : bytes)
+                REQUIRE(n.first_byte_at(n.find_edge(byte)) == byte);
+        }
+        REQUIRE(n.capacity() == 1);
+        allocator.deallocate(n.data_, n.size());
+    }
+
+    SECTION("of a node in a tree")
+    {
+        // The leaves of "inner" are held in its slots, so it is the only
+        // node allocated besides the root.
+        counting_allocator allocator;
+        radix_tree tree(allocator);
+        std::vector<std::string> keys;
+        for (char c = 'a'; c < 'a' + 18; ++c)
+            keys.push_back("inner" + std::string(1, c));
+
+        auto require_keys = [&tree, &keys](std::size_t count) {
+            for (std::size_t i = 0; i < keys.size(); ++i)
+                REQUIRE(tree_contains(tree, keys[i]) == (i < count));
+            REQUIRE(tree.size() == count);
+            radix_tree_stats stats = tree.stats();
+            REQUIRE(stats.bytes == tree.memory_usage());
+            REQUIRE(stats.nodes - stats.inline_leaves == tree.node_count());
+        };
+        // Going back and forth over a capacity leaves the node where it
+        // is. With count keys in the tree, the key supplied is erased and
+        // inserted again if it is one of them, and inserted and erased
+        // again otherwise.
+        auto require_stable = [&tree, &keys, &allocator](std::size_t count,
+                                                         std::size_t key) {
+            std::size_t allocations = allocator.allocations;
+            std::size_t bytes = tree.memory_usage();
+            if (key < count) {
+                REQUIRE(tree_erase(tree, keys[key]));
+                REQUIRE(tree_insert(tree, keys[key]));
+            } else {
+                REQUIRE(tree_insert(tree, keys[key]));
+                REQUIRE(tree_erase(tree, keys[key]));
+            }
+            REQUIRE(allocator.allocations == allocations);
+            REQUIRE(tree.memory_usage() == bytes);
+        };
+
+        std::vector<std::size_t> usage(keys.size() + 1);
+        for (std::size_t count = 1; count <= keys.size(); ++count) {
+            tree_insert(tree, keys[count - 1]);
+            require_keys(count);
+            usage[count] = tree.memory_usage();
+            if (count == 5 || count == 17)
+                require_stable(count, count - 1);
+        }
+        // Past 4 and 16 edges the node grows, and in between it doesn't.
+        REQUIRE(usage[5] > usage[4]);
+        REQUIRE(usage[8] == usage[5]);
+        REQUIRE(usage[9] > usage[8]);
+        REQUIRE(usage[16] == usage[9]);
+        REQUIRE(usage[17] >= usage[16] + 256);
+        REQUIRE(usage[18] == usage[17]);
+
+        for (std::size_t count = keys.size(); count-- > 1;) {
+            std::size_t bytes = tree.memory_usage();
+            REQUIRE(tree_erase(tree, keys[count]));
+            require_keys(count);
+            // Room for 32 edges is kept down to 8 of them, and room for
+            // 16 down to 4.
+            if (count == 8)
+                REQUIRE(tree.memory_usage() + 256 <= bytes);
+            else if (count == 4)
+                REQUIRE(tree.memory_usage() < bytes);
+            else if (count > 4)
+                REQUIRE(tree.memory_usage() == bytes);
+            if (count == 16 || count == 4)
+                require_stable(count, count);
+        }
+        REQUIRE(tree_erase(tree, keys[0]));
+        require_keys(0);
+    }
+}
+
+TEST_CASE("bulk loading", "[build_from_sorted]")
+{
+    radix_tree tree;
+
+    SECTION("empty range")
+    {
+        std::vector<std::string> keys;
+        tree.build_from_sorted(keys.begin(), keys.end());
+        REQUIRE(tree.size() == 0);
+        REQUIRE(tree_insert(tree, "key"));
+    }
+
+    SECTION("keys sharing prefixes")
+    {
+        std::vector<std::string> keys = {
+            "slow", "slower", "team", "test", "tester", "toast", "water"
+        };
+        tree.build_from_sorted(keys.begin(), keys.end());
+        REQUIRE(tree.size() == keys.size());
+        for (auto const& key : keys)
+            REQUIRE(tree_contains(tree, key));
+        REQUIRE_FALSE(tree_contains(tree, "t"));
+        REQUIRE_FALSE(tree_contains(tree, "tes"));
+        REQUIRE_FALSE(tree_contains(tree, "slowest"));
+
+        // The tree built in bulk must support later updates.
+        REQUIRE(tree_insert(tree, "tea"));
+        REQUIRE(tree_erase(tree, "test"));
+        REQUIRE(tree_contains(tree, "tester"));
+        REQUIRE(tree_contains(tree, "tea"));
+        REQUIRE_FALSE(tree_contains(tree, "test"));
+    }
+
+    SECTION("repeated keys")
+    {
+        std::vector<std::string> keys = {"a", "a", "ab", "ab", "ab"};
+        tree.build_from_sorted(keys.begin(), keys.end());
+        REQUIRE(tree.size() == 5);
+        REQUIRE_FALSE(tree_insert(tree, "a"));
+        for (int i = 0; i < 3; ++i)
+            REQUIRE(tree_erase(tree, "a"));
+        REQUIRE_FALSE(tree_erase(tree, "a"));
+        REQUIRE(tree_contains(tree, "ab"));
+    }
+
+    SECTION("replaces previous contents")
+    {
+        tree_insert(tree, "old");
+        std::vector<std::string> keys = {"new"};
+        tree.build_from_sorted(keys.begin(), keys.end());
+        REQUIRE(tree.size() == 1);
+        REQUIRE_FALSE(tree_contains(tree, "old"));
+        REQUIRE(tree_contains(tree, "new"));
+    }
+
+    SECTION("wide nodes")
+    {
+        std::vector<std::string> keys;
+        for (int byte = 1; byte < 256; ++byte)
+            keys.push_back("x" + std::string(1, static_cast<char>(byte)));
+        tree.build_from_sorted(keys.begin(), keys.end());
+        for (auto const& key : keys)
+            REQUIRE(tree_contains(tree, key));
+        for (auto const& key : keys)
+            REQUIRE(tree_erase(tree, key));
+        REQUIRE(tree.size() == 0);
+    }
+}
+
+TEST_CASE("chains 100k levels deep", "[build_from_sorted][apply]")
+{
+    // Every key is a prefix of the next one, so each node holds a key
+    // and has a single child, and the tree is as deep as there are keys.
+    // Walking it with a call per level would overflow the stack.
+    const std::size_t depth = 100000;
+    std::string chain(depth, 'a');
+    std::vector<const unsigned char*> keys(
+        depth, reinterpret_cast<const unsigned char*>(chain.data()));
+    std::vector<std::size_t> sizes(depth);
+    for (std::size_t k = 0; k < depth; ++k)
+        sizes[k] = k + 1;
+
+    radix_tree tree;
+    tree.build_from_sorted(keys.data(), sizes.data(), depth);
+    REQUIRE(tree.size() == depth);
+    REQUIRE(tree.stats().max_depth == depth);
+    REQUIRE(tree_contains(tree, chain));
+    REQUIRE(tree_contains(tree, chain.substr(0, depth / 2)));
+    REQUIRE_FALSE(tree_contains(tree, chain + "a"));
+
+    std::size_t visited = 0;
+    tree.apply(count_key, &visited);
+    REQUIRE(visited == depth);
+
+    visited = 0;
+    for (auto it = tree.begin(); it != tree.end(); ++it)
+        ++visited;
+    REQUIRE(visited == depth);
+
+    REQUIRE(tree_erase(tree, chain));
+    REQUIRE(tree_erase(tree, chain.substr(0, depth / 2)));
+    REQUIRE(tree_insert(tree, chain + "b"));
+    REQUIRE(tree.size() == depth - 1);
+
+    // Rebuilding frees the deep tree first, and the destructor frees
+    // the new one.
+    tree.build_from_sorted(keys.data(), sizes.data(), depth);
+    REQUIRE(tree.size() == depth);
+}
+
+TEST_CASE("prefix comparison", "[common_prefix_length]")
+{
+    // Every length and mismatch position around the word and vector
+    // boundaries.
+    for (std::size_t size = 0; size <= 40; ++size) {
+        std::vector<unsigned char> a(size, 'x');
+        REQUIRE(common_prefix_length(a.data(), a.data(), size) == size);
+        for (std::size_t i = 0; i < size; ++i) {
+            std::vector<unsigned char> b = a;
+            b[i] = 'y';
+            INFO("size " << size << ", mismatch at " << i);
+            REQUIRE(common_prefix_length(a.data(), b.data(), size) == i);
+            b.back() = 'z';
+            REQUIRE(common_prefix_length(a.data(), b.data(), size) == i);
+        }
+    }
+}
+
 TEST_CASE("check if size is updated correctly")
 {
     radix_tree tree;
@@ -225,3 +848,538 @@ TEST_CASE("apply a function to all keys", "[apply]")
         delete vec;
     }
 }
+
+TEST_CASE("keys with a common prefix", "[apply_prefix][count_prefix]")
+{
+    radix_tree tree;
+
+    std::vector<std::string> keys = {
+        "tester", "water", "slow", "slower", "test", "team", "toast"
+    };
+
+    for (auto const& key : keys)
+        tree_insert(tree, key);
+    tree_insert(tree, "test");
+
+    auto count = [&tree](std::string const& prefix) {
+        auto* data = reinterpret_cast<const unsigned char*>(prefix.data());
+        return tree.count_prefix(data, prefix.size());
+    };
+    auto visit = [&tree](std::string const& prefix) {
+        auto* data = reinterpret_cast<const unsigned char*>(prefix.data());
+        std::vector<std::string> visited;
+        tree.apply_prefix(data, prefix.size(), return_key, &visited);
+        std::sort(visited.begin(), visited.end());
+        return visited;
+    };
+
+    REQUIRE(count("") == tree.size());
+    REQUIRE(count("t") == 5);
+    REQUIRE(count("te") == 4);
+    REQUIRE(count("tes") == 3);
+    REQUIRE(count("test") == 3);
+    REQUIRE(count("teste") == 1);
+    REQUIRE(count("slow") == 2);
+    REQUIRE(count("w") == 1);
+    REQUIRE(count("x") == 0);
+    REQUIRE(count("testers") == 0);
+    REQUIRE(count("tea") == 1);
+    REQUIRE(count("tex") == 0);
+
+    REQUIRE(visit("te") == std::vector<std::string>({
+        "team", "test", "tester"
+    }));
+    REQUIRE(visit("tes") == std::vector<std::string>({"test", "tester"}));
+    REQUIRE(visit("slowe") == std::vector<std::string>({"slower"}));
+    REQUIRE(visit("x").empty());
+    REQUIRE(visit("waters").empty());
+    REQUIRE(visit("").size() == keys.size());
+
+    // Splits and merges carry the counts over.
+    tree_insert(tree, "tea");
+    REQUIRE(count("te") == 5);
+    REQUIRE(count("tea") == 2);
+    REQUIRE(tree_erase(tree, "team"));
+    REQUIRE(count("tea") == 1);
+    REQUIRE_FALSE(tree_erase(tree, "teams"));
+    REQUIRE_FALSE(tree_erase(tree, "tes"));
+    REQUIRE(count("te") == 4);
+    REQUIRE(tree_erase(tree, "test"));
+    REQUIRE(tree_erase(tree, "test"));
+    REQUIRE(count("test") == 1);
+    REQUIRE(count("t") == 3);
+    REQUIRE(count("") == tree.size());
+}
+
+TEST_CASE("set operations", "[merge][intersect][subtract]")
+{
+    auto make = [](std::vector<std::string> const& keys,
+                   radix_tree& tree) {
+        for (auto const& key : keys)
+            tree_insert(tree, key);
+    };
+    auto keys_of = [](radix_tree const& tree) {
+        std::vector<std::string> keys;
+        for (auto it = tree.begin(); it != tree.end(); ++it)
+            keys.push_back(iterator_key(it));
+        return keys;
+    };
+
+    // Prefixes that match, split, diverge and run past each other.
+    std::vector<std::string> a_keys = {
+        "test", "tester", "team", "slow", "toast"
+    };
+    std::vector<std::string> b_keys = {
+        "test", "tes", "teamwork", "slower", "water", "toaster"
+    };
+
+    SECTION("merge") {
+        radix_tree a;
+        radix_tree b;
+        make(a_keys, a);
+        make(b_keys, b);
+        a.merge(b);
+        REQUIRE(keys_of(a) == std::vector<std::string>({
+            "slow", "slower", "team", "teamwork", "tes", "test", "tester",
+            "toast", "toaster", "water"
+        }));
+        REQUIRE(a.size() == 11);
+        REQUIRE(b.size() == 0);
+        REQUIRE(keys_of(b).empty());
+
+        // Both trees held the key, so it takes two erasures.
+        REQUIRE(tree_erase(a, "test"));
+        REQUIRE(tree_contains(a, "test"));
+        REQUIRE(tree_erase(a, "test"));
+        REQUIRE_FALSE(tree_contains(a, "test"));
+
+        // The emptied tree can be used again.
+        tree_insert(b, "water");
+        REQUIRE(tree_contains(b, "water"));
+    }
+
+    SECTION("intersect") {
+        radix_tree a;
+        radix_tree b;
+        make(a_keys, a);
+        tree_insert(a, "test");
+        make(b_keys, b);
+        a.intersect(b);
+        REQUIRE(keys_of(a) == std::vector<std::string>({"test"}));
+        REQUIRE(a.size() == 2);
+        REQUIRE(b.size() == b_keys.size());
+    }
+
+    SECTION("subtract") {
+        radix_tree a;
+        radix_tree b;
+        make(a_keys, a);
+        make(b_keys, b);
+        a.subtract(b);
+        REQUIRE(keys_of(a) == std::vector<std::string>({
+            "slow", "team", "tester", "toast"
+        }));
+        REQUIRE(a.size() == 4);
+
+        radix_tree empty;
+        a.subtract(empty);
+        REQUIRE(a.size() == 4);
+        a.intersect(empty);
+        REQUIRE(a.size() == 0);
+        REQUIRE(a.node_count() == 1);
+    }
+}
+
+TEST_CASE("ordered iteration", "[iterator]")
+{
+    radix_tree tree;
+    REQUIRE(tree.begin() == tree.end());
+    REQUIRE(tree_lower_bound(tree, "a") == tree.end());
+
+    // Inserted out of order, with keys that are prefixes of others and
+    // enough keys below "x" to give a node a child index.
+    std::vector<std::string> keys = {
+        "water", "tester", "slow", "test", "toast", "slower", "team", "t"
+    };
+    for (char c = 'z'; c >= 'a'; --c)
+        keys.push_back(std::string("x") + c);
+    for (auto const& key : keys)
+        tree_insert(tree, key);
+    tree_insert(tree, "test");
+
+    std::vector<std::string> sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+
+    SECTION("forward")
+    {
+        std::vector<std::string> visited;
+        for (auto it = tree.begin(); it != tree.end(); ++it)
+            visited.push_back(iterator_key(it));
+        REQUIRE(visited == sorted);
+    }
+
+    SECTION("backward")
+    {
+        std::vector<std::string> visited;
+        auto it = tree.end();
+        do {
+            --it;
+            visited.push_back(iterator_key(it));
+        } while (it != tree.begin());
+        std::reverse(visited.begin(), visited.end());
+        REQUIRE(visited == sorted);
+
+        --it;
+        REQUIRE(it == tree.end());
+    }
+
+    SECTION("lower bound")
+    {
+        REQUIRE(iterator_key(tree_lower_bound(tree, "")) == "slow");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "test")) == "test");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "tes")) == "test");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "testa")) == "tester");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "testz")) == "toast");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "ta")) == "team");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "tz")) == "water");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "slowest")) == "t");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "xm")) == "xm");
+        REQUIRE(iterator_key(tree_lower_bound(tree, "xm0")) == "xn");
+        REQUIRE(tree_lower_bound(tree, "xzz") == tree.end());
+        REQUIRE(tree_lower_bound(tree, "y") == tree.end());
+
+        auto it = tree_lower_bound(tree, "toast");
+        --it;
+        REQUIRE(iterator_key(it) == "tester");
+        ++it;
+        ++it;
+        REQUIRE(iterator_key(it) == "water");
+    }
+
+    SECTION("seek")
+    {
+        auto it = tree.begin();
+        auto* key = reinterpret_cast<const unsigned char*>("tf");
+        it.seek(key, 2);
+        REQUIRE(iterator_key(it) == "toast");
+        it.seek(key, 1);
+        REQUIRE(iterator_key(it) == "t");
+    }
+
+    SECTION("range")
+    {
+        std::vector<std::string> visited;
+        auto* first = reinterpret_cast<const unsigned char*>("te");
+        auto* last = reinterpret_cast<const unsigned char*>("tester");
+        tree.apply_range(first, 2, last, 6, return_prefix, &visited);
+        REQUIRE(visited == std::vector<std::string>({"team", "test"}));
+
+        visited.clear();
+        last = reinterpret_cast<const unsigned char*>("xc");
+        tree.apply_range(first, 2, last, 2, return_prefix, &visited);
+        REQUIRE(visited == std::vector<std::string>({
+            "team", "test", "tester", "toast", "water", "xa", "xb"}));
+    }
+}
+
+TEST_CASE("tree statistics", "[stats]")
+{
+    radix_tree tree;
+    std::size_t empty_usage = tree.memory_usage();
+    REQUIRE(tree.node_count() == 1);
+    REQUIRE(tree.stats().bytes == empty_usage);
+
+    std::vector<std::string> keys = {
+        "tester", "water", "slow", "slower", "test", "team", "toast"
+    };
+    for (auto const& key : keys)
+        tree_insert(tree, key);
+
+    // The root has edges to "t", "water" and "slow". "t" leads to "e"
+    // and "oast", "e" to "st" and "am", and "st" and "slow" each have
+    // an edge to "er". The leaves are short enough to be held in the
+    // slots of their parents.
+    radix_tree_stats stats = tree.stats();
+    REQUIRE(stats.keys == keys.size());
+    REQUIRE(stats.nodes == 10);
+    REQUIRE(stats.leaves == 5);
+    REQUIRE(stats.inline_leaves == 5);
+    REQUIRE(stats.max_depth == 4);
+    REQUIRE(stats.edgecounts == std::vector<std::size_t>({5, 2, 2, 1}));
+    REQUIRE(stats.prefix_lengths
+            == std::vector<std::size_t>({1, 2, 4, 0, 2, 1}));
+    REQUIRE(stats.key_depths == std::vector<std::size_t>({0, 2, 2, 2, 1}));
+    REQUIRE(stats.leaf_ratio() == Approx(1.0));
+    REQUIRE(stats.bytes == tree.memory_usage());
+    REQUIRE(stats.nodes - stats.inline_leaves == tree.node_count());
+    REQUIRE(stats.bytes_per_key()
+            == Approx(static_cast<double>(stats.bytes) / keys.size()));
+
+    // The counters follow the tree through churn and back.
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 300; ++i)
+            tree_insert(tree, "topic." + std::to_string(i));
+        stats = tree.stats();
+        REQUIRE(stats.bytes == tree.memory_usage());
+        REQUIRE(stats.nodes - stats.inline_leaves == tree.node_count());
+        for (int i = 0; i < 300; ++i)
+            tree_erase(tree, "topic." + std::to_string(i));
+    }
+    REQUIRE(tree.stats().bytes == tree.memory_usage());
+    REQUIRE(tree.node_count() == 5);
+
+    for (auto const& key : keys)
+        tree_erase(tree, key);
+    REQUIRE(tree.node_count() == 1);
+    REQUIRE(tree.memory_usage() == tree.stats().bytes);
+}
+
+TEST_CASE("leaves held in pointer slots", "[insert][erase][stats]")
+{
+    // A leaf fits in the slot of its parent if its prefix is a byte
+    // shorter than a pointer and its key was inserted at most 15 times.
+    const std::size_t max_prefix = sizeof(void*) - 1;
+    radix_tree tree;
+    auto require_consistent = [&tree]() {
+        radix_tree_stats stats = tree.stats();
+        REQUIRE(stats.bytes == tree.memory_usage());
+        REQUIRE(stats.nodes - stats.inline_leaves == tree.node_count());
+    };
+
+    SECTION("short keys")
+    {
+        std::vector<std::string> keys;
+        for (char c = 'a'; c <= 'z'; ++c)
+            keys.push_back(std::string(1, c) + std::string(max_prefix - 1, c));
+        for (auto const& key : keys)
+            REQUIRE(tree_insert(tree, key));
+        REQUIRE(tree.node_count() == 1);
+        REQUIRE(tree.stats().inline_leaves == keys.size());
+        require_consistent();
+
+        std::vector<std::string> applied;
+        tree.apply(return_key, &applied);
+        REQUIRE(applied == keys);
+        std::vector<std::string> visited;
+        for (auto it = tree.begin(); it != tree.end(); ++it)
+            visited.push_back(iterator_key(it));
+        REQUIRE(visited == keys);
+
+        // A byte more takes a node.
+        REQUIRE(tree_insert(tree, std::string(max_prefix + 1, '#')));
+        REQUIRE(tree.node_count() == 2);
+        for (auto const& key : keys)
+            REQUIRE(tree_erase(tree, key));
+        REQUIRE(tree.node_count() == 2);
+        require_consistent();
+    }
+
+    SECTION("reference counts")
+    {
+        for (int i = 0; i < 15; ++i)
+            tree_insert(tree, "key");
+        REQUIRE(tree.node_count() == 1);
+        REQUIRE_FALSE(tree_insert(tree, "key"));
+        REQUIRE(tree.node_count() == 2);
+        REQUIRE(tree_count_prefix(tree, "k") == 16);
+        require_consistent();
+
+        REQUIRE(tree_erase(tree, "key"));
+        REQUIRE(tree.node_count() == 1);
+        REQUIRE(tree_count_prefix(tree, "k") == 15);
+        for (int i = 0; i < 15; ++i)
+            REQUIRE(tree_erase(tree, "key"));
+        REQUIRE_FALSE(tree_contains(tree, "key"));
+        REQUIRE(tree.size() == 0);
+    }
+
+    SECTION("splits and merges")
+    {
+        // Splitting a long leaf leaves a short one below.
+        std::string key(max_prefix + 3, 'x');
+        tree_insert(tree, key);
+        tree_insert(tree, key.substr(0, 3));
+        REQUIRE(tree.node_count() == 2);
+        REQUIRE(tree.stats().inline_leaves == 1);
+        REQUIRE(tree_erase(tree, key.substr(0, 3)));
+        REQUIRE(tree.node_count() == 2);
+        REQUIRE(tree_contains(tree, key));
+        REQUIRE(tree_erase(tree, key));
+
+        // A leaf that gains an edge or a sibling moves into a node, and
+        // back into a slot once the tree shrinks around it.
+        tree_insert(tree, "abcd");
+        tree_insert(tree, "abcdef");
+        REQUIRE(tree.node_count() == 2);
+        tree_insert(tree, "abxy");
+        REQUIRE(tree.node_count() == 3);
+        require_consistent();
+        REQUIRE(tree_erase(tree, "abcdef"));
+        REQUIRE(tree.node_count() == 2);
+        REQUIRE(tree_erase(tree, "abxy"));
+        REQUIRE(tree.node_count() == 1);
+        REQUIRE(tree_contains(tree, "abcd"));
+        require_consistent();
+    }
+
+    SECTION("same nodes whatever the way in")
+    {
+        std::vector<std::string> keys;
+        for (int i = 0; i < 2000; ++i)
+            keys.push_back(std::to_string(i * 7));
+        std::vector<std::string> sorted = keys;
+        std::sort(sorted.begin(), sorted.end());
+        for (auto const& key : keys)
+            tree_insert(tree, key);
+        require_consistent();
+
+        radix_tree loaded;
+        loaded.build_from_sorted(sorted.begin(), sorted.end());
+        REQUIRE(loaded.node_count() == tree.node_count());
+
+        radix_tree odd;
+        radix_tree even;
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            tree_insert(i % 2 ? odd : even, keys[i]);
+        odd.merge(even);
+        REQUIRE(odd.node_count() == tree.node_count());
+        odd.subtract(even);
+        REQUIRE(odd.node_count() == tree.node_count());
+        for (std::size_t i = 0; i < keys.size(); i += 2)
+            tree_insert(even, keys[i]);
+        odd.subtract(even);
+        odd.intersect(tree);
+        for (std::size_t i = 0; i < keys.size(); i += 2)
+            tree_erase(tree, keys[i]);
+        REQUIRE(odd.node_count() == tree.node_count());
+    }
+}
+
+TEST_CASE("keys stored outside the tree", "[key_storage]")
+{
+    // Keys are held in buffers of their own and freed once the tree no
+    // longer holds them, so nodes still referring to them are caught by
+    // the sanitizers.
+    std::vector<std::unique_ptr<std::string>> keys;
+    for (int i = 0; i < 200; ++i)
+        keys.emplace_back(new std::string(
+            "https://example.com/items/" + std::to_string(i % 20) + "/"
+            + std::to_string(i * 7919) + "-0123456789abcdef0123456789"));
+
+    radix_tree tree(default_node_allocator(), key_storage::external);
+    for (auto const& key : keys)
+        REQUIRE(tree_insert(tree, *key));
+    REQUIRE(tree.size() == keys.size());
+    REQUIRE(tree.stats().bytes == tree.memory_usage());
+
+    SECTION("saves memory")
+    {
+        radix_tree copied;
+        for (auto const& key : keys)
+            tree_insert(copied, *key);
+        REQUIRE(tree.node_count() == copied.node_count());
+        REQUIRE(tree.memory_usage() * 4 < copied.memory_usage() * 3);
+    }
+
+    SECTION("splits and erasure")
+    {
+        // Split the leaves, then drop every other key and its bytes.
+        std::vector<std::string> shorter;
+        for (std::size_t i = 0; i < keys.size(); i += 3)
+            shorter.push_back(keys[i]->substr(0, keys[i]->size() - 10));
+        for (auto const& key : shorter)
+            REQUIRE(tree_insert(tree, key));
+        for (std::size_t i = 0; i < keys.size(); i += 2) {
+            REQUIRE(tree_erase(tree, *keys[i]));
+            keys[i].reset();
+        }
+
+        for (auto const& key : keys) {
+            if (key)
+                REQUIRE(tree_contains(tree, *key));
+        }
+        for (auto const& key : shorter)
+            REQUIRE(tree_contains(tree, key));
+        REQUIRE(tree.size() == keys.size() / 2 + shorter.size());
+        REQUIRE(tree.stats().bytes == tree.memory_usage());
+
+        std::vector<std::string> expected;
+        for (auto const& key : keys) {
+            if (key)
+                expected.push_back(*key);
+        }
+        expected.insert(expected.end(), shorter.begin(), shorter.end());
+        std::sort(expected.begin(), expected.end());
+        std::vector<std::string> visited;
+        for (auto it = tree.begin(); it != tree.end(); ++it)
+            visited.push_back(iterator_key(it));
+        REQUIRE(visited == expected);
+    }
+
+    SECTION("repeated keys")
+    {
+        // The bytes of every insertion stay in use until the last one
+        // is erased.
+        std::unique_ptr<std::string> copy(new std::string(*keys[0]));
+        REQUIRE_FALSE(tree_insert(tree, *copy));
+        REQUIRE(tree_erase(tree, *keys[0]));
+        REQUIRE(tree_contains(tree, *copy));
+        REQUIRE(tree_erase(tree, *copy));
+        std::string key = *copy;
+        keys[0].reset();
+        copy.reset();
+        REQUIRE_FALSE(tree_contains(tree, key));
+        REQUIRE(tree_insert(tree, key + "/"));
+        for (std::size_t i = 1; i < keys.size(); ++i)
+            REQUIRE(tree_contains(tree, *keys[i]));
+    }
+
+    SECTION("bulk loading and set operations")
+    {
+        std::vector<std::string> sorted;
+        for (auto const& key : keys)
+            sorted.push_back(*key);
+        std::sort(sorted.begin(), sorted.end());
+        radix_tree loaded(default_node_allocator(), key_storage::external);
+        loaded.build_from_sorted(sorted.begin(), sorted.end());
+        REQUIRE(loaded.memory_usage() <= tree.memory_usage());
+
+        radix_tree other;
+        for (std::size_t i = 0; i < keys.size(); i += 2)
+            tree_insert(other, *keys[i]);
+        loaded.subtract(other);
+        REQUIRE(loaded.size() == keys.size() / 2);
+        tree.intersect(loaded);
+        REQUIRE(tree.size() == keys.size() / 2);
+        for (std::size_t i = 0; i < keys.size(); i += 2)
+            REQUIRE_FALSE(tree_contains(tree, *keys[i]));
+
+        tree.merge(other);
+        REQUIRE(tree.size() == keys.size());
+        std::vector<std::string> visited;
+        for (auto it = tree.begin(); it != tree.end(); ++it)
+            visited.push_back(iterator_key(it));
+        REQUIRE(visited == sorted);
+    }
+
+    SECTION("merged into a tree that copies its keys")
+    {
+        // The nodes spliced in must stop referring to the bytes, which
+        // go away along with the tree that did.
+        radix_tree copied;
+        for (std::size_t i = 0; i < keys.size(); i += 4)
+            tree_insert(copied, *keys[i]);
+        copied.merge(tree);
+        REQUIRE(tree.size() == 0);
+
+        std::vector<std::string> saved;
+        for (auto& key : keys) {
+            saved.push_back(*key);
+            key.reset();
+        }
+        for (auto const& key : saved)
+            REQUIRE(tree_contains(copied, key));
+        REQUIRE(copied.size() == saved.size() + (saved.size() + 3) / 4);
+        REQUIRE(copied.stats().bytes == copied.memory_usage());
+    }
+}